@@ -0,0 +1,305 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef __BinaryMessage_h__
+#define __BinaryMessage_h__
+
+#include "PacketBuilder.h"
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/// body starts with a uint32 holding size of fixed section
+#define kCCMessagePrefixLength 4
+
+/**
+ * Binary packet bodies described by a field list, an alternative to json bodies.
+ *
+ * Body layout, little endian: uint32 size of fixed section, fixed section with one slot per
+ * field in declaration order, then data of strings and arrays. A number takes its own size, a
+ * string or array takes 8 bytes, uint32 offset from body start and uint32 length in bytes or
+ * elements. Readers ignore slots they don't know and return zero for slots a sender didn't
+ * write, so fields may be appended to a message without breaking older peers.
+ *
+ * @code
+ * #define PLAYER_STATE_FIELDS(F) \
+ *     F(int32_t, id) \
+ *     F(float, x) \
+ *     F(float, y) \
+ *     F(std::string, name) \
+ *     F(std::vector<int32_t>, items)
+ * CC_BINARY_MESSAGE(PlayerState, 1001, PLAYER_STATE_FIELDS)
+ *
+ * PlayerState s;
+ * s.id = 7;
+ * Packet* p = s.toPacket("GAME", 1, 1);
+ *
+ * // on receiving side, fields are read from packet body, nothing is copied
+ * PlayerState::View v(packet);
+ * if(v.isValid())
+ *     move(v.id(), v.x(), v.y());
+ * @endcode
+ *
+ * Field types are numbers, bool, std::string and std::vector of numbers.
+ */
+#define CC_BINARY_MESSAGE(Name, command, FIELDS) \
+struct Name { \
+    static const int kCommand = command; \
+    FIELDS(CC_MESSAGE_MEMBER) \
+    struct Layout { \
+        FIELDS(CC_MESSAGE_SLOT) \
+    }; \
+    class View : public funny::network::MessageView { \
+    public: \
+        View() {} \
+        View(const char* body, size_t length) : MessageView(body, length) {} \
+        explicit View(funny::network::Packet* p) : MessageView(p, command) {} \
+        FIELDS(CC_MESSAGE_ACCESSOR) \
+    }; \
+    size_t encodedSize() const { \
+        size_t n = kCCMessagePrefixLength + sizeof(Layout); \
+        FIELDS(CC_MESSAGE_VAR_SIZE) \
+        return n; \
+    } \
+    void encode(funny::network::ByteBuffer& bb) const { \
+        uint32_t varOffset = kCCMessagePrefixLength + sizeof(Layout); \
+        bb.reserve(bb.getWritePos() + encodedSize()); \
+        bb.writeLE<uint32_t>(sizeof(Layout)); \
+        FIELDS(CC_MESSAGE_WRITE_SLOT) \
+        FIELDS(CC_MESSAGE_WRITE_VAR) \
+    } \
+    bool decode(const View& view) { \
+        if(!view.isValid()) \
+            return false; \
+        FIELDS(CC_MESSAGE_ASSIGN) \
+        return true; \
+    } \
+    bool decode(funny::network::Packet* p) { return decode(View(p)); } \
+    funny::network::Packet* toPacket(const std::string& magic, int protocolVersion, int serverVersion, int algorithm=-1) const { \
+        funny::network::PacketBuilder b; \
+        if(!b.begin(magic, kCommand, protocolVersion, serverVersion, algorithm, encodedSize())) \
+            return NULL; \
+        encode(b); \
+        return b.finish(); \
+    } \
+}
+
+#define CC_MESSAGE_MEMBER(type, name) type name = type();
+#define CC_MESSAGE_SLOT(type, name) char name[funny::network::MessageField<type>::kSlotSize];
+#define CC_MESSAGE_ACCESSOR(type, name) \
+    funny::network::MessageField<type>::ViewType name() const { return field<type>(offsetof(Layout, name)); }
+#define CC_MESSAGE_VAR_SIZE(type, name) n += funny::network::MessageField<type>::varSize(name);
+#define CC_MESSAGE_WRITE_SLOT(type, name) funny::network::MessageField<type>::writeSlot(bb, name, varOffset);
+#define CC_MESSAGE_WRITE_VAR(type, name) funny::network::MessageField<type>::writeVar(bb, name);
+#define CC_MESSAGE_ASSIGN(type, name) funny::network::MessageField<type>::assign(name, view.name());
+
+namespace funny {
+    namespace network {
+        
+        /// bytes of a string field inside a message body, valid while the body lives
+        struct BytesRef {
+            const char* data;
+            size_t length;
+            
+            BytesRef() : data(NULL), length(0) {}
+            BytesRef(const char* d, size_t l) : data(d), length(l) {}
+            
+            /// copy into a string
+            std::string str() const { return std::string(data ? data : "", length); }
+        };
+        
+        /// array field inside a message body, elements are read on access, valid while the body lives
+        template<typename T> class ArrayRef {
+        private:
+            const char* m_data;
+            size_t m_size;
+            
+        public:
+            ArrayRef() : m_data(NULL), m_size(0) {}
+            ArrayRef(const char* data, size_t size) : m_data(data), m_size(size) {}
+            
+            /// number of elements
+            size_t size() const { return m_size; }
+            
+            /// element at index i, no bounds check
+            T operator[](size_t i) const {
+                T v;
+                memcpy(&v, m_data + i * sizeof(T), sizeof(T));
+                return ByteOrder::little(v);
+            }
+            
+            /// copy all elements in one go
+            void copyTo(std::vector<T>& v) const {
+                v.resize(m_size);
+                if(m_size == 0)
+                    return;
+                if(kCCHostBigEndian)
+                    ByteOrder::swapArray(v.data(), m_data, sizeof(T), m_size);
+                else
+                    memcpy(v.data(), m_data, m_size * sizeof(T));
+            }
+        };
+        
+        /// how a field type is stored, see CC_BINARY_MESSAGE
+        template<typename T, typename Enable = void> struct MessageField;
+        
+        /// numbers and bool, stored in their slot
+        template<typename T> struct MessageField<T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+            typedef T ViewType;
+            static const size_t kSlotSize = sizeof(T);
+            
+            static size_t varSize(const T& /*v*/) { return 0; }
+            static void writeSlot(ByteBuffer& bb, const T& v, uint32_t& /*varOffset*/) { bb.writeLE<T>(v); }
+            static void writeVar(ByteBuffer& /*bb*/, const T& /*v*/) {}
+            
+            static T read(const char* /*body*/, size_t /*length*/, const char* slot) {
+                T v;
+                memcpy(&v, slot, sizeof(T));
+                return ByteOrder::little(v);
+            }
+            
+            static void assign(T& dst, T v) { dst = v; }
+        };
+        
+        /// strings, slot holds offset and length of bytes
+        template<> struct MessageField<std::string> {
+            typedef BytesRef ViewType;
+            static const size_t kSlotSize = 8;
+            
+            static size_t varSize(const std::string& v) { return v.length(); }
+            
+            static void writeSlot(ByteBuffer& bb, const std::string& v, uint32_t& varOffset) {
+                bb.writeLE<uint32_t>(varOffset);
+                bb.writeLE<uint32_t>((uint32_t)v.length());
+                varOffset += (uint32_t)v.length();
+            }
+            
+            static void writeVar(ByteBuffer& bb, const std::string& v) {
+                bb.write((const uint8_t*)v.data(), v.length());
+            }
+            
+            static BytesRef read(const char* body, size_t length, const char* slot) {
+                uint32_t offset, size;
+                memcpy(&offset, slot, 4);
+                memcpy(&size, slot + 4, 4);
+                offset = ByteOrder::little(offset);
+                size = ByteOrder::little(size);
+                if(offset > length || size > length - offset)
+                    return BytesRef();
+                return BytesRef(body + offset, size);
+            }
+            
+            static void assign(std::string& dst, const BytesRef& v) { dst.assign(v.data ? v.data : "", v.length); }
+        };
+        
+        /// arrays of numbers, slot holds offset and element count
+        template<typename T> struct MessageField<std::vector<T> > {
+            static_assert(std::is_arithmetic<T>::value && !std::is_same<T, bool>::value,
+                          "message arrays hold numbers");
+            
+            typedef ArrayRef<T> ViewType;
+            static const size_t kSlotSize = 8;
+            
+            static size_t varSize(const std::vector<T>& v) { return v.size() * sizeof(T); }
+            
+            static void writeSlot(ByteBuffer& bb, const std::vector<T>& v, uint32_t& varOffset) {
+                bb.writeLE<uint32_t>(varOffset);
+                bb.writeLE<uint32_t>((uint32_t)v.size());
+                varOffset += (uint32_t)(v.size() * sizeof(T));
+            }
+            
+            static void writeVar(ByteBuffer& bb, const std::vector<T>& v) {
+                bb.writeArrayLE(v.data(), v.size());
+            }
+            
+            static ArrayRef<T> read(const char* body, size_t length, const char* slot) {
+                uint32_t offset, count;
+                memcpy(&offset, slot, 4);
+                memcpy(&count, slot + 4, 4);
+                offset = ByteOrder::little(offset);
+                count = ByteOrder::little(count);
+                if(offset > length || count > (length - offset) / sizeof(T))
+                    return ArrayRef<T>();
+                return ArrayRef<T>(body + offset, count);
+            }
+            
+            static void assign(std::vector<T>& dst, const ArrayRef<T>& v) { v.copyTo(dst); }
+        };
+        
+        /**
+         * Base of message views made by CC_BINARY_MESSAGE, it reads fields straight from a packet
+         * body. A view does not retain the packet.
+         */
+        class MessageView {
+        protected:
+            /// packet body, NULL if invalid
+            const char* m_body;
+            
+            /// body length
+            size_t m_length;
+            
+            /// size of fixed section written by sender
+            size_t m_fixedSize;
+            
+        protected:
+            MessageView() : m_body(NULL), m_length(0), m_fixedSize(0) {}
+            
+            MessageView(const char* body, size_t length) : m_body(NULL), m_length(0), m_fixedSize(0) {
+                init(body, length);
+            }
+            
+            /// view of packet body, invalid if packet is raw or carries another command
+            MessageView(Packet* p, int command) : m_body(NULL), m_length(0), m_fixedSize(0) {
+                if(p && !p->getRaw() && p->getHeader().command == command)
+                    init(p->getBody(), p->getBodyLength());
+            }
+            
+            void init(const char* body, size_t length) {
+                if(!body || length < kCCMessagePrefixLength)
+                    return;
+                uint32_t fixedSize;
+                memcpy(&fixedSize, body, 4);
+                fixedSize = ByteOrder::little(fixedSize);
+                if(fixedSize > length - kCCMessagePrefixLength)
+                    return;
+                m_body = body;
+                m_length = length;
+                m_fixedSize = fixedSize;
+            }
+            
+            /// field whose slot starts at offset in fixed section, zero if sender didn't write it
+            template<typename T> typename MessageField<T>::ViewType field(size_t offset) const {
+                if(offset + MessageField<T>::kSlotSize > m_fixedSize)
+                    return typename MessageField<T>::ViewType();
+                return MessageField<T>::read(m_body, m_length, m_body + kCCMessagePrefixLength + offset);
+            }
+            
+        public:
+            /// false if body is too short or packet didn't match
+            bool isValid() const { return m_body != NULL; }
+        };
+        
+    }
+}
+
+#endif //__BinaryMessage_h__
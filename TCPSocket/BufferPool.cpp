@@ -0,0 +1,161 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+#include "BufferPool.h"
+
+#include <stdlib.h>
+
+namespace funny {
+    namespace network {
+        
+        FreeList::FreeList(size_t blockSize, size_t maxCached) :
+        m_blockSize(blockSize < sizeof(Block) ? sizeof(Block) : blockSize),
+        m_maxCached(maxCached),
+        m_head(NULL) {
+            m_stats.hits = 0;
+            m_stats.misses = 0;
+            m_stats.cached = 0;
+            pthread_mutex_init(&m_mutex, NULL);
+        }
+        
+        FreeList::~FreeList() {
+            while(m_head) {
+                Block* b = m_head;
+                m_head = b->next;
+                ::free(b);
+            }
+            pthread_mutex_destroy(&m_mutex);
+        }
+        
+        void* FreeList::allocate() {
+            pthread_mutex_lock(&m_mutex);
+            Block* b = m_head;
+            if(b) {
+                m_head = b->next;
+                m_stats.cached--;
+                m_stats.hits++;
+            } else {
+                m_stats.misses++;
+            }
+            pthread_mutex_unlock(&m_mutex);
+            
+            if(!b) {
+                return malloc(m_blockSize);
+            }
+            return b;
+        }
+        
+        void FreeList::free(void* p) {
+            if(!p) {
+                return;
+            }
+            
+            pthread_mutex_lock(&m_mutex);
+            if(m_stats.cached < m_maxCached) {
+                Block* b = (Block*)p;
+                b->next = m_head;
+                m_head = b;
+                m_stats.cached++;
+                p = NULL;
+            }
+            pthread_mutex_unlock(&m_mutex);
+            
+            // free list is full
+            if(p) {
+                ::free(p);
+            }
+        }
+        
+        PoolStats FreeList::getStats() {
+            pthread_mutex_lock(&m_mutex);
+            PoolStats s = m_stats;
+            pthread_mutex_unlock(&m_mutex);
+            return s;
+        }
+        
+        BufferPool::BufferPool() :
+        m_oversize(0) {
+            size_t size = kCCBufferPoolMinClassSize;
+            for(int i = 0; i < kCCBufferPoolClassCount; i++) {
+                m_classes[i] = new FreeList(size, kCCBufferPoolMaxCachedPerClass);
+                size <<= 1;
+            }
+        }
+        
+        BufferPool* BufferPool::getInstance() {
+            static BufferPool* s_instance = new BufferPool();
+            return s_instance;
+        }
+        
+        int BufferPool::classIndex(size_t len) {
+            size_t size = kCCBufferPoolMinClassSize;
+            for(int i = 0; i < kCCBufferPoolClassCount; i++) {
+                if(len <= size) {
+                    return i;
+                }
+                size <<= 1;
+            }
+            return -1;
+        }
+        
+        char* BufferPool::allocate(size_t len, size_t& capacity) {
+            int i = classIndex(len);
+            if(i < 0) {
+                m_oversize++;
+                capacity = len;
+                return (char*)malloc(len);
+            }
+            
+            capacity = m_classes[i]->getBlockSize();
+            return (char*)m_classes[i]->allocate();
+        }
+        
+        void BufferPool::free(char* buf, size_t capacity) {
+            if(!buf) {
+                return;
+            }
+            
+            // capacity of a pooled buffer is exactly its class size
+            int i = classIndex(capacity);
+            if(i < 0 || m_classes[i]->getBlockSize() != capacity) {
+                ::free(buf);
+            } else {
+                m_classes[i]->free(buf);
+            }
+        }
+        
+        PoolStats BufferPool::getStats() {
+            PoolStats total;
+            total.hits = 0;
+            total.misses = m_oversize.load();
+            total.cached = 0;
+            for(int i = 0; i < kCCBufferPoolClassCount; i++) {
+                PoolStats s = m_classes[i]->getStats();
+                total.hits += s.hits;
+                total.misses += s.misses;
+                total.cached += s.cached;
+            }
+            return total;
+        }
+        
+    }
+}
@@ -0,0 +1,155 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+#ifndef __BufferPool_h__
+#define __BufferPool_h__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+/// smallest buffer size class
+#define kCCBufferPoolMinClassSize 64
+
+/// number of size classes, each doubles previous one, 64 bytes .. 128K
+#define kCCBufferPoolClassCount 12
+
+/// free blocks kept per size class, extra blocks go back to malloc
+#define kCCBufferPoolMaxCachedPerClass 256
+
+/// free packet objects kept
+#define kCCPacketPoolMaxCached 1024
+
+namespace funny {
+    namespace network {
+        
+        /// counters of a pool
+        struct PoolStats {
+            /// allocations served from free list
+            uint64_t hits;
+            
+            /// allocations which went to malloc
+            uint64_t misses;
+            
+            /// blocks in free list now
+            size_t cached;
+        };
+        
+        /**
+         * Free list of fixed size blocks, safe from any thread. Packets are allocated on I/O threads
+         * and freed on cocos thread, so the list is guarded by a mutex; the critical section is a
+         * pointer push or pop.
+         */
+        class FreeList {
+        private:
+            /// free block, link is stored in the block itself
+            struct Block {
+                Block* next;
+            };
+            
+            /// pthread mutex
+            pthread_mutex_t m_mutex;
+            
+            /// block size
+            size_t m_blockSize;
+            
+            /// cap of free blocks
+            size_t m_maxCached;
+            
+            /// free blocks
+            Block* m_head;
+            
+            /// counters
+            PoolStats m_stats;
+            
+        private:
+            FreeList(const FreeList&);
+            FreeList& operator=(const FreeList&);
+            
+        public:
+            FreeList(size_t blockSize, size_t maxCached);
+            ~FreeList();
+            
+            /// get a block, from free list if possible
+            void* allocate();
+            
+            /// give block back, it goes to malloc if free list is full
+            void free(void* p);
+            
+            /// block size
+            size_t getBlockSize() { return m_blockSize; }
+            
+            /// snapshot of counters
+            PoolStats getStats();
+        };
+        
+        /**
+         * Size classed buffers for packet data. A request is rounded up to next power of two size
+         * class and served from that class's free list; requests bigger than largest class use
+         * malloc directly and count as misses.
+         */
+        class BufferPool {
+        private:
+            /// one free list per size class
+            FreeList* m_classes[kCCBufferPoolClassCount];
+            
+            /// allocations bigger than largest class
+            std::atomic<uint64_t> m_oversize;
+            
+        private:
+            BufferPool();
+            BufferPool(const BufferPool&);
+            BufferPool& operator=(const BufferPool&);
+            
+            /// index of size class for len, -1 if too big
+            static int classIndex(size_t len);
+            
+        public:
+            /// shared pool, it is never destroyed
+            static BufferPool* getInstance();
+            
+            /**
+             * get a buffer, content is undefined
+             *
+             * @param len wanted size
+             * @param capacity receives real size of buffer, it must be passed to free
+             * @return buffer or NULL if out of memory
+             */
+            char* allocate(size_t len, size_t& capacity);
+            
+            /**
+             * give a buffer back
+             *
+             * @param buf buffer returned by allocate
+             * @param capacity capacity returned by allocate
+             */
+            void free(char* buf, size_t capacity);
+            
+            /// counters summed over all size classes, oversize allocations count as misses
+            PoolStats getStats();
+        };
+        
+    }
+}
+
+#endif //__BufferPool_h__
@@ -26,51 +26,228 @@
 
 USING_NS_CC;
 
-#define DEFAULT_SIZE 0x1000
-
 namespace funny {
     namespace network {
         
+        namespace {
+            
+            /// encode v at p, p must have kCCVarintMaxBytes bytes, return bytes used
+            inline size_t encodeVarint(uint64_t v, uint8_t* p) {
+                size_t n = 0;
+                while(v >= 0x80) {
+                    p[n++] = (uint8_t)(v | 0x80);
+                    v >>= 7;
+                }
+                p[n++] = (uint8_t)v;
+                return n;
+            }
+            
+            /// decode varint at p, bounds checked against end
+            inline bool decodeVarint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+                uint64_t r = 0;
+                for(int i = 0; i < kCCVarintMaxBytes && p + i < end; i++) {
+                    uint8_t b = p[i];
+                    r |= (uint64_t)(b & 0x7f) << (7 * i);
+                    if(!(b & 0x80)) {
+                        p += i + 1;
+                        v = r;
+                        return true;
+                    }
+                }
+                return false;
+            }
+            
+            /// decode varint at p without bounds check, p must have kCCVarintMaxBytes bytes
+            inline bool decodeVarintFast(const uint8_t*& p, uint64_t& v) {
+                uint64_t b = p[0];
+                uint64_t r = b & 0x7f;
+                if(!(b & 0x80)) { p += 1; v = r; return true; }
+                b = p[1]; r |= (b & 0x7f) << 7;
+                if(!(b & 0x80)) { p += 2; v = r; return true; }
+                b = p[2]; r |= (b & 0x7f) << 14;
+                if(!(b & 0x80)) { p += 3; v = r; return true; }
+                b = p[3]; r |= (b & 0x7f) << 21;
+                if(!(b & 0x80)) { p += 4; v = r; return true; }
+                b = p[4]; r |= (b & 0x7f) << 28;
+                if(!(b & 0x80)) { p += 5; v = r; return true; }
+                for(int i = 5; i < kCCVarintMaxBytes; i++) {
+                    b = p[i];
+                    r |= (b & 0x7f) << (7 * i);
+                    if(!(b & 0x80)) { p += i + 1; v = r; return true; }
+                }
+                return false;
+            }
+            
+            template<typename T, bool ZIGZAG> inline T fromWire(uint64_t v) {
+                return ZIGZAG ? (T)ByteBuffer::zigzagDecode(v) : (T)v;
+            }
+            
+            template<typename T, bool ZIGZAG> inline uint64_t toWire(T v) {
+                return ZIGZAG ? ByteBuffer::zigzagEncode((int64_t)v) : (uint64_t)v;
+            }
+            
+            /// decode up to count values from [p, end), p is moved past decoded values
+            template<typename T, bool ZIGZAG> size_t decodeArray(const uint8_t*& p, const uint8_t* end, T* dst, size_t count) {
+                size_t n = 0;
+                while(n < count) {
+                    // 8 values of one byte each, common for small deltas
+                    if(count - n >= 8 && end - p >= 8) {
+                        uint64_t w;
+                        memcpy(&w, p, 8);
+                        if(!(w & 0x8080808080808080ull)) {
+                            for(int i = 0; i < 8; i++) {
+                                dst[n + i] = fromWire<T, ZIGZAG>(p[i]);
+                            }
+                            p += 8;
+                            n += 8;
+                            continue;
+                        }
+                    }
+                    
+                    uint64_t v;
+                    bool ok = end - p >= kCCVarintMaxBytes ? decodeVarintFast(p, v) : decodeVarint(p, end, v);
+                    if(!ok)
+                        break;
+                    dst[n++] = fromWire<T, ZIGZAG>(v);
+                }
+                return n;
+            }
+        }
+        
         ByteBuffer::ByteBuffer() :
-        m_buffer(NULL),
+        m_buffer(m_inline),
         m_readPos(0),
         m_writePos(0),
-        m_external(false) {
-            reserve(DEFAULT_SIZE);
+        m_bufferSize(kCCByteBufferInlineSize),
+        m_external(false),
+        m_pooled(false) {
         }
         
         ByteBuffer::ByteBuffer(size_t res) :
-        m_buffer(NULL),
+        m_buffer(m_inline),
         m_readPos(0),
         m_writePos(0),
-        m_external(false) {
+        m_bufferSize(kCCByteBufferInlineSize),
+        m_external(false),
+        m_pooled(false) {
             reserve(res);
         }
         
         ByteBuffer::ByteBuffer(const ByteBuffer& b) :
-        m_buffer(NULL),
+        m_buffer(m_inline),
         m_readPos(0),
         m_writePos(0),
-        m_external(false) {
-            reserve(b.m_bufferSize);
-            memcpy(b.m_buffer, m_buffer, b.m_writePos);
+        m_bufferSize(kCCByteBufferInlineSize),
+        m_external(false),
+        m_pooled(false) {
+            reserve(b.m_writePos);
+            memcpy(m_buffer, b.m_buffer, b.m_writePos);
             m_readPos = b.m_readPos;
             m_writePos = b.m_writePos;
         }
         
+        ByteBuffer::ByteBuffer(ByteBuffer&& b) :
+        m_buffer(m_inline),
+        m_readPos(0),
+        m_writePos(0),
+        m_bufferSize(kCCByteBufferInlineSize),
+        m_external(false),
+        m_pooled(false) {
+            moveFrom(b);
+        }
+        
         ByteBuffer::ByteBuffer(const char* buf, size_t bufSize, size_t dataLen) :
         m_buffer((uint8_t*)buf),
         m_readPos(0),
         m_writePos(dataLen),
+        m_bufferSize(bufSize),
         m_external(true),
-        m_bufferSize(bufSize) {
+        m_pooled(false) {
             
         }
         
+        ByteBuffer::ByteBuffer(size_t res, bool pooled) :
+        m_buffer(m_inline),
+        m_readPos(0),
+        m_writePos(0),
+        m_bufferSize(pooled ? 0 : kCCByteBufferInlineSize),
+        m_external(false),
+        m_pooled(pooled) {
+            reserve(res);
+        }
+        
         ByteBuffer::~ByteBuffer() {
-            if(!m_external) {
-                CC_SAFE_FREE(m_buffer);
+            freeHeap();
+        }
+        
+        ByteBuffer& ByteBuffer::operator=(const ByteBuffer& b) {
+            if(this == &b)
+                return *this;
+            
+            // keep own heap block if it is big enough
+            m_readPos = m_writePos = 0;
+            if(m_external)
+                resetStorage();
+            reserve(b.m_writePos);
+            memcpy(m_buffer, b.m_buffer, b.m_writePos);
+            m_readPos = b.m_readPos;
+            m_writePos = b.m_writePos;
+            return *this;
+        }
+        
+        ByteBuffer& ByteBuffer::operator=(ByteBuffer&& b) {
+            if(this != &b) {
+                resetStorage();
+                moveFrom(b);
+            }
+            return *this;
+        }
+        
+        void ByteBuffer::freeHeap() {
+            if(!isHeap())
+                return;
+            if(m_pooled)
+                BufferPool::getInstance()->free((char*)m_buffer, m_bufferSize);
+            else
+                free(m_buffer);
+        }
+        
+        void ByteBuffer::resetStorage() {
+            freeHeap();
+            m_buffer = m_inline;
+            m_bufferSize = m_pooled ? 0 : kCCByteBufferInlineSize;
+            m_external = false;
+            m_readPos = m_writePos = 0;
+        }
+        
+        void ByteBuffer::moveFrom(ByteBuffer& b) {
+            if(b.m_external || b.isHeap()) {
+                // external memory and heap blocks change hands as they are
+                m_buffer = b.m_buffer;
+                m_external = b.m_external;
+            } else {
+                memcpy(m_inline, b.m_inline, b.m_writePos);
             }
+            m_bufferSize = b.m_bufferSize;
+            m_pooled = b.m_pooled;
+            m_readPos = b.m_readPos;
+            m_writePos = b.m_writePos;
+            
+            b.m_buffer = b.m_inline;
+            b.m_bufferSize = b.m_pooled ? 0 : kCCByteBufferInlineSize;
+            b.m_external = false;
+            b.m_readPos = b.m_writePos = 0;
+        }
+        
+        uint8_t* ByteBuffer::releaseBuffer(size_t& capacity) {
+            if(!isHeap())
+                return NULL;
+            
+            uint8_t* buf = m_buffer;
+            capacity = m_bufferSize;
+            m_buffer = m_inline;
+            resetStorage();
+            return buf;
         }
         
         ByteBuffer* ByteBuffer::create() {
@@ -84,14 +261,33 @@ namespace funny {
         }
         
         void ByteBuffer::reserve(size_t res) {
-            if(m_external)
+            if(m_external || res <= m_bufferSize)
                 return;
             
-            if(m_buffer)
-                m_buffer = (uint8_t*)realloc(m_buffer, res);
-            else
-                m_buffer = (uint8_t*)malloc(res);
+            uint8_t* buf;
+            if(m_pooled) {
+                // pool blocks can't realloc, the capacity is rounded up to the size class
+                size_t capacity;
+                buf = (uint8_t*)BufferPool::getInstance()->allocate(res, capacity);
+                if(buf) {
+                    memcpy(buf, m_buffer, m_writePos);
+                    freeHeap();
+                    res = capacity;
+                }
+            } else if(isHeap()) {
+                buf = (uint8_t*)realloc(m_buffer, res);
+            } else {
+                // leaving inline storage, carry written bytes over
+                buf = (uint8_t*)malloc(res);
+                if(buf)
+                    memcpy(buf, m_buffer, m_writePos);
+            }
+            if(!buf) {
+                CCLOGWARN("ByteBuffer: failed to allocate %d bytes", (int)res);
+                return;
+            }
             
+            m_buffer = buf;
             m_bufferSize = res;
         }
         
@@ -149,45 +345,51 @@ namespace funny {
         }
         
         void ByteBuffer::write(const uint8_t* data, size_t size) {
-            size_t new_size = m_writePos + size;
-            if(new_size > m_bufferSize) {
-                if(m_external) {
-                    CCLOGWARN("external mode: buffer size is not enough to write");
-                    return;
-                }
-                new_size = (new_size / DEFAULT_INCREASE_SIZE + 1) * DEFAULT_INCREASE_SIZE;
-                reserve(new_size);
-            }
+            if(!ensureCanWrite(size))
+                return;
             
             memcpy(&m_buffer[m_writePos], data, size);
             m_writePos += size;
         }
         
+        size_t ByteBuffer::readElements(void* dst, size_t elemSize, size_t count, bool swap) {
+            count = MIN(count, available() / elemSize);
+            if(count == 0)
+                return 0;
+            if(swap)
+                ByteOrder::swapArray(dst, &m_buffer[m_readPos], elemSize, count);
+            else
+                memcpy(dst, &m_buffer[m_readPos], elemSize * count);
+            m_readPos += elemSize * count;
+            return count;
+        }
+        
+        void ByteBuffer::writeElements(const void* src, size_t elemSize, size_t count, bool swap) {
+            if(count == 0 || !ensureCanWrite(elemSize * count))
+                return;
+            
+            if(swap)
+                ByteOrder::swapArray(&m_buffer[m_writePos], src, elemSize, count);
+            else
+                memcpy(&m_buffer[m_writePos], src, elemSize * count);
+            m_writePos += elemSize * count;
+        }
+        
         void ByteBuffer::write(const std::string& value) {
             writeCString(value);
         }
         
         void ByteBuffer::writeCString(const std::string& value) {
-            if(m_writePos + value.length() + 1 > m_bufferSize) {
-                if(m_external) {
-                    CCLOGWARN("external mode: buffer size is not enough to write");
-                    return;
-                }
-                ensureCanWrite(value.length() + 1);
-            }
+            if(!ensureCanWrite(value.length() + 1))
+                return;
             
             memcpy(&m_buffer[m_writePos], value.c_str(), value.length() + 1);
             m_writePos += (value.length() + 1);
         }
         
         void ByteBuffer::writePascalString(const std::string& value) {
-            if(m_writePos + value.length() + sizeof(uint16_t) > m_bufferSize) {
-                if(m_external) {
-                    CCLOGWARN("external mode: buffer size is not enough to write");
-                    return;
-                }
-                ensureCanWrite(value.length() + sizeof(uint16_t));
-            }
+            if(!ensureCanWrite(value.length() + sizeof(uint16_t)))
+                return;
             
             write<uint16_t>(value.length());
             memcpy(&m_buffer[m_writePos], value.c_str(), value.length());
@@ -195,13 +397,8 @@ namespace funny {
         }
         
         void ByteBuffer::writeLine(const std::string& value) {
-            if(m_writePos + value.length() + 2 * sizeof(char) > m_bufferSize) {
-                if(m_external) {
-                    CCLOGWARN("external mode: buffer size is not enough to write");
-                    return;
-                }
-                ensureCanWrite(value.length() + 2 * sizeof(char));
-            }
+            if(!ensureCanWrite(value.length() + 2 * sizeof(char)))
+                return;
             
             memcpy(&m_buffer[m_writePos], value.c_str(), value.length());
             m_writePos += value.length();
@@ -209,6 +406,110 @@ namespace funny {
             write<char>('\n');
         }
         
+        bool ByteBuffer::readVarint(uint64_t& v) {
+            const uint8_t* p = m_buffer + m_readPos;
+            if(!decodeVarint(p, m_buffer + m_writePos, v))
+                return false;
+            m_readPos = p - m_buffer;
+            return true;
+        }
+        
+        size_t ByteBuffer::readVarintArray(uint32_t* dst, size_t count) {
+            const uint8_t* p = m_buffer + m_readPos;
+            size_t n = decodeArray<uint32_t, false>(p, m_buffer + m_writePos, dst, count);
+            m_readPos = p - m_buffer;
+            return n;
+        }
+        
+        size_t ByteBuffer::readVarintArray(uint64_t* dst, size_t count) {
+            const uint8_t* p = m_buffer + m_readPos;
+            size_t n = decodeArray<uint64_t, false>(p, m_buffer + m_writePos, dst, count);
+            m_readPos = p - m_buffer;
+            return n;
+        }
+        
+        size_t ByteBuffer::readSignedVarintArray(int32_t* dst, size_t count) {
+            const uint8_t* p = m_buffer + m_readPos;
+            size_t n = decodeArray<int32_t, true>(p, m_buffer + m_writePos, dst, count);
+            m_readPos = p - m_buffer;
+            return n;
+        }
+        
+        size_t ByteBuffer::readSignedVarintArray(int64_t* dst, size_t count) {
+            const uint8_t* p = m_buffer + m_readPos;
+            size_t n = decodeArray<int64_t, true>(p, m_buffer + m_writePos, dst, count);
+            m_readPos = p - m_buffer;
+            return n;
+        }
+        
+        void ByteBuffer::readVarintString(std::string& dest) {
+            dest.clear();
+            size_t start = m_readPos;
+            uint64_t len;
+            if(!readVarint(len))
+                return;
+            if(len > available()) {
+                m_readPos = start;
+                return;
+            }
+            dest.assign((const char*)m_buffer + m_readPos, (size_t)len);
+            m_readPos += (size_t)len;
+        }
+        
+        void ByteBuffer::writeVarint(uint64_t v) {
+            if(m_writePos + kCCVarintMaxBytes > m_bufferSize && !ensureCanWrite(varintSize(v)))
+                return;
+            m_writePos += encodeVarint(v, m_buffer + m_writePos);
+        }
+        
+        template<typename T, bool ZIGZAG> void ByteBuffer::writeVarints(const T* src, size_t count, size_t maxBytes) {
+            // grow once for the worst case, external buffers check each value instead
+            if(m_external || !ensureCanWrite(count * maxBytes)) {
+                for(size_t i = 0; i < count; i++) {
+                    writeVarint(toWire<T, ZIGZAG>(src[i]));
+                }
+                return;
+            }
+            
+            for(size_t i = 0; i < count; i++) {
+                m_writePos += encodeVarint(toWire<T, ZIGZAG>(src[i]), m_buffer + m_writePos);
+            }
+        }
+        
+        void ByteBuffer::writeVarintArray(const uint32_t* src, size_t count) {
+            // 5 bytes hold 32 bits, zigzag encoded ones too
+            writeVarints<uint32_t, false>(src, count, 5);
+        }
+        
+        void ByteBuffer::writeVarintArray(const uint64_t* src, size_t count) {
+            writeVarints<uint64_t, false>(src, count, kCCVarintMaxBytes);
+        }
+        
+        void ByteBuffer::writeSignedVarintArray(const int32_t* src, size_t count) {
+            writeVarints<int32_t, true>(src, count, 5);
+        }
+        
+        void ByteBuffer::writeSignedVarintArray(const int64_t* src, size_t count) {
+            writeVarints<int64_t, true>(src, count, kCCVarintMaxBytes);
+        }
+        
+        void ByteBuffer::writeVarintString(const std::string& value) {
+            if(!ensureCanWrite(varintSize(value.length()) + value.length()))
+                return;
+            m_writePos += encodeVarint(value.length(), m_buffer + m_writePos);
+            memcpy(&m_buffer[m_writePos], value.data(), value.length());
+            m_writePos += value.length();
+        }
+        
+        size_t ByteBuffer::varintSize(uint64_t v) {
+            size_t n = 1;
+            while(v >= 0x80) {
+                v >>= 7;
+                n++;
+            }
+            return n;
+        }
+        
         void ByteBuffer::skip(size_t len) {
             if(m_readPos + len > m_writePos)
                 len = (m_writePos - m_readPos);
@@ -220,12 +521,17 @@ namespace funny {
             m_readPos = MAX(0, m_readPos);
         }
         
-        void ByteBuffer::ensureCanWrite(size_t size) {
-            size_t new_size = m_writePos + size;
-            if(new_size > m_bufferSize) {
-                new_size = (new_size / DEFAULT_INCREASE_SIZE + 1) * DEFAULT_INCREASE_SIZE;
-                reserve(new_size);
+        bool ByteBuffer::ensureCanWrite(size_t size) {
+            size_t need = m_writePos + size;
+            if(need <= m_bufferSize)
+                return true;
+            if(m_external) {
+                CCLOGWARN("external mode: buffer size is not enough to write");
+                return false;
             }
+            
+            reserve(MAX(need, m_bufferSize * 2));
+            return need <= m_bufferSize;
         }
         
     }
@@ -26,7 +26,18 @@
 #ifndef __ByteBuffer_h__
 #define __ByteBuffer_h__
 
-#include "cocos2d.h"
+#include "NetworkConfig.h"
+#include "ByteOrder.h"
+#include "BufferPool.h"
+#include <list>
+#include <map>
+#include <type_traits>
+
+/// bytes a ByteBuffer holds inline before it needs the heap
+#define kCCByteBufferInlineSize 128
+
+/// longest LEB128 encoding of a 64 bits value
+#define kCCVarintMaxBytes 10
 
 namespace funny {
     namespace network {
@@ -34,12 +45,9 @@ namespace funny {
         /**
          * Byte buffer
          */
-        class CC_DLL ByteBuffer : public cocos2d::Ref {
-        private:
-            static const int DEFAULT_INCREASE_SIZE = 200;
-            
+        class CC_DLL ByteBuffer : public Ref {
         protected:
-            /// buffer pointer
+            /// buffer pointer, m_inline, a heap block or external memory
             uint8_t* m_buffer;
             
             /// read position
@@ -54,21 +62,103 @@ namespace funny {
             /// external mode
             bool m_external;
             
+            /// heap blocks come from BufferPool and inline storage is not used
+            bool m_pooled;
+            
+            /// storage of short buffers, so they don't touch the heap
+            uint8_t m_inline[kCCByteBufferInlineSize];
+            
         protected:
-            /// Allocates/reallocates buffer with specified size.
-            void reserve(size_t res);
+            /**
+             * buffer whose heap blocks come from BufferPool, for data handed over to a pooled owner
+             * such as a Packet through releaseBuffer
+             *
+             * @param res initial capacity
+             * @param pooled true to use BufferPool
+             */
+            ByteBuffer(size_t res, bool pooled);
+            
+            /// true if buffer is a heap block owned by us
+            bool isHeap() { return !m_external && m_buffer != m_inline; }
+            
+            /// free own heap block to where it came from
+            void freeHeap();
+            
+            /// drop own heap block, back to the empty inline buffer
+            void resetStorage();
             
             /**
-             * Ensures the buffer is big enough to fit the specified number of bytes.
+             * give up heap block, buffer is empty afterwards
+             *
+             * @param capacity receives size of block
+             * @return block, NULL if data isn't in a heap block
+             */
+            uint8_t* releaseBuffer(size_t& capacity);
+            
+            /// take content of other buffer, other is left empty
+            void moveFrom(ByteBuffer& b);
+            
+            /**
+             * Ensures the buffer is big enough to fit the specified number of bytes. Capacity at
+             * least doubles each time it grows, so writing n bytes costs O(n) overall.
              *
              * @param size number of bytes to fit
+             * @return false if an external buffer is too small
+             */
+            bool ensureCanWrite(size_t size);
+            
+            /// elements which may be copied as plain bytes
+            template<typename T> struct IsBulk {
+                static const bool value = std::is_trivially_copyable<T>::value && !std::is_same<T, bool>::value;
+            };
+            
+            /**
+             * Reads whole elements, as many as available, swapping bytes of each if asked
+             *
+             * @return number of elements read
              */
-            void ensureCanWrite(size_t size);
+            size_t readElements(void* dst, size_t elemSize, size_t count, bool swap);
+            
+            /// writes elements, swapping bytes of each if asked
+            void writeElements(const void* src, size_t elemSize, size_t count, bool swap);
+            
+            /// writes values as varints, maxBytes is longest encoding of one value
+            template<typename T, bool ZIGZAG> void writeVarints(const T* src, size_t count, size_t maxBytes);
+            
+            template<typename T> size_t writeVector(const std::vector<T>& v, std::true_type) {
+                writeArray(v.data(), v.size());
+                return v.size();
+            }
+            
+            template<typename T> size_t writeVector(const std::vector<T>& v, std::false_type) {
+                ensureCanWrite(v.size() * sizeof(T));
+                for(typename std::vector<T>::const_iterator i = v.begin(); i != v.end(); i++) {
+                    write<T>(*i);
+                }
+                return v.size();
+            }
+            
+            template<typename T> size_t readVector(size_t vsize, std::vector<T>& v, std::true_type) {
+                // missing elements stay zero
+                v.assign(vsize, T());
+                readArray(v.data(), vsize);
+                return v.size();
+            }
+            
+            template<typename T> size_t readVector(size_t vsize, std::vector<T>& v, std::false_type) {
+                v.clear();
+                while(vsize--) {
+                    T t = read<T>();
+                    v.push_back(t);
+                }
+                return v.size();
+            }
             
         public:
             ByteBuffer();
             ByteBuffer(size_t res);
             ByteBuffer(const ByteBuffer& b);
+            ByteBuffer(ByteBuffer&& b);
             
             /**
              * it wraps an external buffer insteal of allocating memory
@@ -81,6 +171,12 @@ namespace funny {
             
             virtual ~ByteBuffer();
             
+            /// copies content and positions of other buffer, external data is copied too
+            ByteBuffer& operator=(const ByteBuffer& b);
+            
+            /// takes content of other buffer without copying heap memory
+            ByteBuffer& operator=(ByteBuffer&& b);
+            
             /// Creates a ByteBuffer with the default size
             static ByteBuffer* create();
             
@@ -90,6 +186,17 @@ namespace funny {
             /// Resets read/write indexes
             void clear() { m_readPos = m_writePos = 0; }
             
+            /**
+             * Makes sure buffer can hold res bytes in total, call it before writing a message of
+             * known size to allocate once. It never shrinks, no effect in external mode.
+             *
+             * @param res total bytes wanted
+             */
+            void reserve(size_t res);
+            
+            /// buffer memory size
+            size_t capacity() { return m_bufferSize; }
+            
             /// Returns the buffer pointer
             const uint8_t* getBuffer() { return m_buffer; }
             
@@ -97,18 +204,49 @@ namespace funny {
             size_t available() { return m_writePos - m_readPos; }
             
             /**
-             * Reads sizeof(T) bytes from the buffer
+             * Reads sizeof(T) bytes from the buffer in host byte order, any alignment
              *
              * @return the bytes read
              */
             template<typename T> T read() {
                 if(m_readPos + sizeof(T) > m_writePos)
                     return (T)0;
-                T ret = *(T*)&m_buffer[m_readPos];
+                T ret;
+                memcpy(&ret, &m_buffer[m_readPos], sizeof(T));
                 m_readPos += sizeof(T);
                 return ret;
             }
             
+            /// Reads a value stored most significant byte first
+            template<typename T> T readBE() { return ByteOrder::big(read<T>()); }
+            
+            /// Reads a value stored least significant byte first
+            template<typename T> T readLE() { return ByteOrder::little(read<T>()); }
+            
+            /**
+             * Reads an array of plain values in host byte order with one copy
+             *
+             * @param dst receives the values
+             * @param count number of values wanted
+             * @return number of values read, less than count if buffer runs out
+             */
+            template<typename T> size_t readArray(T* dst, size_t count) {
+                static_assert(IsBulk<T>::value, "readArray needs trivially copyable elements");
+                return readElements(dst, sizeof(T), count, false);
+            }
+            
+            /// Reads an array of big endian values
+            template<typename T> size_t readArrayBE(T* dst, size_t count) {
+                static_assert(IsBulk<T>::value, "readArrayBE needs trivially copyable elements");
+                return readElements(dst, sizeof(T), count, !kCCHostBigEndian);
+            }
+            
+            /// Reads an array of little endian values
+            template<typename T> size_t readArrayLE(T* dst, size_t count) {
+                static_assert(IsBulk<T>::value, "readArrayLE needs trivially copyable elements");
+                return readElements(dst, sizeof(T), count, kCCHostBigEndian);
+            }
+            
             /// skip bytes, move read position forward
             void skip(size_t len);
             
@@ -141,21 +279,80 @@ namespace funny {
             void readLine(std::string& dest);
             
             /**
-             * Writes sizeof(T) bytes to the buffer, while checking for overflows.
+             * Reads a LEB128 varint, 7 bits per byte, low bits first
+             *
+             * @param v receives the value
+             * @return false if buffer ends inside the value or it is longer than kCCVarintMaxBytes,
+             * read position is not moved then
+             */
+            bool readVarint(uint64_t& v);
+            
+            /// Reads a varint, 0 if it can't be read
+            uint64_t readVarint() { uint64_t v = 0; return readVarint(v) ? v : 0; }
+            
+            /// Reads a zigzag encoded signed varint, 0 if it can't be read
+            int64_t readSignedVarint() { return zigzagDecode(readVarint()); }
+            
+            /**
+             * Reads an array of varints. Runs of one byte values are decoded 8 at a time and values
+             * far enough from the buffer end skip bounds checks.
+             *
+             * @param dst receives the values, values too big for uint32_t are truncated
+             * @param count number of values wanted
+             * @return number of values read, stops early at buffer end or at a bad value
+             */
+            size_t readVarintArray(uint32_t* dst, size_t count);
+            size_t readVarintArray(uint64_t* dst, size_t count);
+            
+            /// Reads an array of zigzag encoded signed varints
+            size_t readSignedVarintArray(int32_t* dst, size_t count);
+            size_t readSignedVarintArray(int64_t* dst, size_t count);
+            
+            /// read a string prefixed by its length as a varint, dest is empty if it is truncated
+            void readVarintString(std::string& dest);
+            
+            /**
+             * Writes sizeof(T) bytes to the buffer in host byte order, while checking for overflows.
              *
              * @param T data The data to be written
              */
             template<typename T> void write(const T& data) {
-                size_t new_size = m_writePos + sizeof(T);
-                if(new_size > m_bufferSize) {
-                    new_size = (new_size / DEFAULT_INCREASE_SIZE + 1) * DEFAULT_INCREASE_SIZE;
-                    reserve(new_size);
-                }
+                if(m_writePos + sizeof(T) > m_bufferSize && !ensureCanWrite(sizeof(T)))
+                    return;
                 
-                *(T*)&m_buffer[m_writePos] = data;
+                memcpy(&m_buffer[m_writePos], &data, sizeof(T));
                 m_writePos += sizeof(T);
             }
             
+            /// Writes a value most significant byte first
+            template<typename T> void writeBE(T data) { write<T>(ByteOrder::big(data)); }
+            
+            /// Writes a value least significant byte first
+            template<typename T> void writeLE(T data) { write<T>(ByteOrder::little(data)); }
+            
+            /**
+             * Writes an array of plain values in host byte order with one copy
+             *
+             * @param src values
+             * @param count number of values
+             */
+            template<typename T> void writeArray(const T* src, size_t count) {
+                static_assert(IsBulk<T>::value, "writeArray needs trivially copyable elements");
+                writeElements(src, sizeof(T), count, false);
+            }
+            
+            /// Writes an array of values in big endian order
+            template<typename T> void writeArrayBE(const T* src, size_t count) {
+                static_assert(IsBulk<T>::value, "writeArrayBE needs trivially copyable elements");
+                writeElements(src, sizeof(T), count, !kCCHostBigEndian);
+            }
+            
+            /// Writes an array of values in little endian order
+            template<typename T> void writeArrayLE(const T* src, size_t count) {
+                static_assert(IsBulk<T>::value, "writeArrayLE needs trivially copyable elements");
+                writeElements(src, sizeof(T), count, kCCHostBigEndian);
+            }
+            
             /** writes x bytes to the buffer, while checking for overflows
              * @param ptr the data to be written
              * @param size byte count
@@ -170,10 +367,42 @@ namespace funny {
             
             /**
              * write a string into buffer in pascal format, i.e., the first two bytes is string length and
-             * string won't be appended a zero byte
+             * string won't be appended a zero byte. Longer strings than 65535 bytes need
+             * writeVarintString.
              */
             void writePascalString(const std::string& value);
             
+            /// write a string prefixed by its length as a varint, short strings take one byte of length
+            void writeVarintString(const std::string& value);
+            
+            /// Writes an unsigned value as LEB128 varint, values below 128 take one byte
+            void writeVarint(uint64_t v);
+            
+            /// Writes a signed value zigzag encoded, so small negative values stay short too
+            void writeSignedVarint(int64_t v) { writeVarint(zigzagEncode(v)); }
+            
+            /**
+             * Writes an array of varints, buffer grows once for the worst case
+             *
+             * @param src values
+             * @param count number of values
+             */
+            void writeVarintArray(const uint32_t* src, size_t count);
+            void writeVarintArray(const uint64_t* src, size_t count);
+            
+            /// Writes an array of signed values zigzag encoded
+            void writeSignedVarintArray(const int32_t* src, size_t count);
+            void writeSignedVarintArray(const int64_t* src, size_t count);
+            
+            /// maps 0, -1, 1, -2, ... to 0, 1, 2, 3, ...
+            static uint64_t zigzagEncode(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+            
+            /// reverse of zigzagEncode
+            static int64_t zigzagDecode(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+            
+            /// bytes writeVarint uses for a value
+            static size_t varintSize(uint64_t v);
+            
             /**
              * write a string and new line to buffer
              *
@@ -187,29 +416,39 @@ namespace funny {
             /// move read position
             void setReadPos(size_t p) { if(p <= m_writePos) m_readPos = p; }
             
+            /// get write position
+            size_t getWritePos() { return m_writePos; }
+            
+            /**
+             * make room to write up to size bytes in place, e.g. for a formatter
+             *
+             * @return where to write them, NULL if buffer can't grow
+             */
+            uint8_t* prepareWrite(size_t size) {
+                if(m_writePos + size <= m_bufferSize || ensureCanWrite(size))
+                    return m_buffer + m_writePos;
+                return NULL;
+            }
+            
+            /// mark n bytes written at prepareWrite() as written
+            void commit(size_t n) { m_writePos += n; }
+            
             /// set write position, that will change available size
             void setWritePos(size_t p) { if(p <= m_bufferSize) m_writePos = p; }
             
-            /// write a std::vector
+            /// write a std::vector, plain elements are copied in one go
             template<typename T> size_t writeVector(const std::vector<T>& v) {
-                for(typename std::vector<T>::const_iterator i = v.begin(); i != v.end(); i++) {
-                    write<T>(*i);
-                }
-                return v.size();
+                return writeVector(v, std::integral_constant<bool, IsBulk<T>::value>());
             }
             
-            /// read a std::vector
+            /// read a std::vector, plain elements are copied in one go
             template<typename T> size_t readVector(size_t vsize, std::vector<T>& v) {
-                v.clear();
-                while(vsize--) {
-                    T t = read<T>();
-                    v.push_back(t);
-                }
-                return v.size();
+                return readVector(vsize, v, std::integral_constant<bool, IsBulk<T>::value>());
             }
             
             /// write a std::list
             template<typename T> size_t writeList(const std::list<T>& v) {
+                ensureCanWrite(v.size() * sizeof(T));
                 for(typename std::list<T>::const_iterator i = v.begin(); i != v.end(); i++) {
                     write<T>(*i);
                 }
@@ -228,6 +467,7 @@ namespace funny {
             
             /// write a std::map
             template <typename K, typename V> size_t writeMap(const std::map<K, V>& m) {
+                ensureCanWrite(m.size() * (sizeof(K) + sizeof(V)));
                 for(typename std::map<K, V>::const_iterator i = m.begin(); i != m.end(); i++) {
                     write<K>(i->first);
                     write<V>(i->second);
@@ -241,7 +481,7 @@ namespace funny {
                 while(msize--) {
                     K k = read<K>();
                     V v = read<V>();
-                    m.insert(make_pair(k, v));
+                    m.insert(std::make_pair(k, v));
                 }
                 return m.size();
             }
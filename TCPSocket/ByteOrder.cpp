@@ -0,0 +1,174 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+#include "ByteOrder.h"
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define CC_BYTEORDER_SSSE3
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CC_BYTEORDER_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CC_BYTEORDER_NEON
+#endif
+
+namespace funny {
+    namespace network {
+        
+        namespace {
+            
+            /// scalar tail, also the whole job without simd
+            template<typename U> void swapScalar(uint8_t* dst, const uint8_t* src, size_t count) {
+                for(size_t i = 0; i < count; i++) {
+                    U u;
+                    memcpy(&u, src + i * sizeof(U), sizeof(U));
+                    u = ByteOrder::swap(u);
+                    memcpy(dst + i * sizeof(U), &u, sizeof(U));
+                }
+            }
+
+#if defined(CC_BYTEORDER_SSSE3)
+            
+            /// one pshufb per 16 bytes, mask picks bytes of each element in reverse order
+            template<typename U> size_t swapSimd(uint8_t* dst, const uint8_t* src, size_t count) {
+                char m[16];
+                for(int i = 0; i < 16; i++) {
+                    m[i] = (char)((i / sizeof(U)) * sizeof(U) + sizeof(U) - 1 - i % sizeof(U));
+                }
+                __m128i mask = _mm_loadu_si128((const __m128i*)m);
+                size_t blocks = count * sizeof(U) / 16;
+                for(size_t i = 0; i < blocks; i++) {
+                    __m128i x = _mm_loadu_si128((const __m128i*)(src + i * 16));
+                    _mm_storeu_si128((__m128i*)(dst + i * 16), _mm_shuffle_epi8(x, mask));
+                }
+                return blocks * 16 / sizeof(U);
+            }
+
+#elif defined(CC_BYTEORDER_SSE2)
+            
+            /// swap bytes of each 16 bit lane
+            inline __m128i swapLanes16(__m128i x) {
+                return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+            }
+            
+            /// reorder 16 bit lanes inside each element, then swap bytes of each lane
+            template<typename U> inline __m128i swapBlock(__m128i x);
+            
+            template<> inline __m128i swapBlock<uint16_t>(__m128i x) {
+                return swapLanes16(x);
+            }
+            
+            template<> inline __m128i swapBlock<uint32_t>(__m128i x) {
+                x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+                x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+                return swapLanes16(x);
+            }
+            
+            template<> inline __m128i swapBlock<uint64_t>(__m128i x) {
+                x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+                x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+                return swapLanes16(x);
+            }
+            
+            template<typename U> size_t swapSimd(uint8_t* dst, const uint8_t* src, size_t count) {
+                size_t blocks = count * sizeof(U) / 16;
+                for(size_t i = 0; i < blocks; i++) {
+                    __m128i x = _mm_loadu_si128((const __m128i*)(src + i * 16));
+                    _mm_storeu_si128((__m128i*)(dst + i * 16), swapBlock<U>(x));
+                }
+                return blocks * 16 / sizeof(U);
+            }
+
+#elif defined(CC_BYTEORDER_NEON)
+            
+            template<typename U> inline uint8x16_t swapBlock(uint8x16_t x);
+            
+            template<> inline uint8x16_t swapBlock<uint16_t>(uint8x16_t x) {
+                return vrev16q_u8(x);
+            }
+            
+            template<> inline uint8x16_t swapBlock<uint32_t>(uint8x16_t x) {
+                return vrev32q_u8(x);
+            }
+            
+            template<> inline uint8x16_t swapBlock<uint64_t>(uint8x16_t x) {
+                return vrev64q_u8(x);
+            }
+            
+            template<typename U> size_t swapSimd(uint8_t* dst, const uint8_t* src, size_t count) {
+                size_t blocks = count * sizeof(U) / 16;
+                for(size_t i = 0; i < blocks; i++) {
+                    vst1q_u8(dst + i * 16, swapBlock<U>(vld1q_u8(src + i * 16)));
+                }
+                return blocks * 16 / sizeof(U);
+            }
+
+#else
+            
+            template<typename U> size_t swapSimd(uint8_t* dst, const uint8_t* src, size_t count) {
+                return 0;
+            }
+
+#endif
+            
+            template<typename U> void swapElements(uint8_t* dst, const uint8_t* src, size_t count) {
+                size_t done = swapSimd<U>(dst, src, count);
+                swapScalar<U>(dst + done * sizeof(U), src + done * sizeof(U), count - done);
+            }
+        }
+        
+        void ByteOrder::swapArray(void* dst, const void* src, size_t elemSize, size_t count) {
+            uint8_t* d = (uint8_t*)dst;
+            const uint8_t* s = (const uint8_t*)src;
+            switch(elemSize) {
+                case 2:
+                    swapElements<uint16_t>(d, s, count);
+                    break;
+                case 4:
+                    swapElements<uint32_t>(d, s, count);
+                    break;
+                case 8:
+                    swapElements<uint64_t>(d, s, count);
+                    break;
+                default:
+                    if(d != s)
+                        memmove(d, s, elemSize * count);
+                    break;
+            }
+        }
+        
+        const char* ByteOrder::getKernelName() {
+#if defined(CC_BYTEORDER_SSSE3)
+            return "ssse3";
+#elif defined(CC_BYTEORDER_SSE2)
+            return "sse2";
+#elif defined(CC_BYTEORDER_NEON)
+            return "neon";
+#else
+            return "scalar";
+#endif
+        }
+        
+    }
+}
@@ -0,0 +1,102 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef __ByteOrder_h__
+#define __ByteOrder_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/// 1 if host stores integers most significant byte first
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define kCCHostBigEndian 1
+#else
+#define kCCHostBigEndian 0
+#endif
+
+namespace funny {
+    namespace network {
+        
+        /// unsigned integer type of N bytes
+        template<size_t N> struct UIntOfSize;
+        template<> struct UIntOfSize<1> { typedef uint8_t type; };
+        template<> struct UIntOfSize<2> { typedef uint16_t type; };
+        template<> struct UIntOfSize<4> { typedef uint32_t type; };
+        template<> struct UIntOfSize<8> { typedef uint64_t type; };
+        
+        /**
+         * Byte swapping of single values and arrays. Array kernels use SSSE3, SSE2 or NEON when
+         * the compiler targets them, scalar code otherwise.
+         */
+        class ByteOrder {
+        public:
+            static uint8_t swap(uint8_t v) { return v; }
+            
+            static uint16_t swap(uint16_t v) {
+                return (uint16_t)((v << 8) | (v >> 8));
+            }
+            
+            static uint32_t swap(uint32_t v) {
+                return ((v & 0x000000ffu) << 24) | ((v & 0x0000ff00u) << 8) |
+                ((v & 0x00ff0000u) >> 8) | ((v & 0xff000000u) >> 24);
+            }
+            
+            static uint64_t swap(uint64_t v) {
+                return ((uint64_t)swap((uint32_t)v) << 32) | swap((uint32_t)(v >> 32));
+            }
+            
+            /// reverse bytes of a 1, 2, 4 or 8 bytes value, floats included
+            template<typename T> static T swapValue(T v) {
+                typename UIntOfSize<sizeof(T)>::type u;
+                memcpy(&u, &v, sizeof(T));
+                u = swap(u);
+                memcpy(&v, &u, sizeof(T));
+                return v;
+            }
+            
+            /// convert between host order and big endian
+            template<typename T> static T big(T v) { return kCCHostBigEndian ? v : swapValue(v); }
+            
+            /// convert between host order and little endian
+            template<typename T> static T little(T v) { return kCCHostBigEndian ? swapValue(v) : v; }
+            
+            /**
+             * reverse bytes of every element of an array, dst may be src but must not partially
+             * overlap it
+             *
+             * @param dst output
+             * @param src input
+             * @param elemSize element size, 2, 4 or 8; other sizes are copied as they are
+             * @param count number of elements
+             */
+            static void swapArray(void* dst, const void* src, size_t elemSize, size_t count);
+            
+            /// name of the array kernel compiled in, "ssse3", "sse2", "neon" or "scalar"
+            static const char* getKernelName();
+        };
+        
+    }
+}
+
+#endif //__ByteOrder_h__
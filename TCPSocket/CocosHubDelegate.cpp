@@ -0,0 +1,82 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+#include "CocosHubDelegate.h"
+#include "TCPSocketHub.h"
+
+USING_NS_CC;
+
+namespace funny {
+    namespace network {
+        
+        CocosHubDelegate::CocosHubDelegate() :
+        m_packetEvent(NULL) {
+        }
+        
+        CocosHubDelegate::~CocosHubDelegate() {
+            CC_SAFE_RELEASE(m_packetEvent);
+        }
+        
+        void CocosHubDelegate::post(const std::string& name, Ref* obj) {
+            EventCustomObject *e = new EventCustomObject(name, obj);
+            Director::getInstance()->getEventDispatcher()->dispatchEvent(e);
+            e->release();
+        }
+        
+        void CocosHubDelegate::onSocketConnected(TCPSocketHub* hub, TCPSocket* socket) {
+            post(kCCNotificationTCPSocketConnected, socket);
+        }
+        
+        void CocosHubDelegate::onPacketReceived(TCPSocketHub* hub, Packet* packet) {
+            // one event object serves all packets unless a listener kept it
+            if(m_packetEvent && m_packetEvent->getReferenceCount() > 1) {
+                m_packetEvent->release();
+                m_packetEvent = NULL;
+            }
+            if(m_packetEvent) {
+                m_packetEvent->reuse(packet);
+            } else {
+                m_packetEvent = new EventCustomObject(kCCNotificationPacketReceived, packet);
+            }
+            Director::getInstance()->getEventDispatcher()->dispatchEvent(m_packetEvent);
+            
+            // don't keep packet alive until next one
+            if(m_packetEvent->getReferenceCount() == 1) {
+                m_packetEvent->setUserObject(NULL);
+            }
+        }
+        
+        void CocosHubDelegate::onPacketsReceived(TCPSocketHub* hub, PacketBatch* batch) {
+            post(kCCNotificationPacketsReceived, batch);
+        }
+        
+        void CocosHubDelegate::onSocketWritabilityChanged(TCPSocketHub* hub, TCPSocket* socket, bool writable) {
+            post(writable ? kCCNotificationTCPSocketWritable : kCCNotificationTCPSocketUnwritable, socket);
+        }
+        
+        void CocosHubDelegate::onSocketDisconnected(TCPSocketHub* hub, TCPSocket* socket) {
+            post(kCCNotificationTCPSocketDisconnected, socket);
+        }
+        
+    }
+}
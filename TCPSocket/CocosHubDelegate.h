@@ -0,0 +1,61 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef __CocosHubDelegate_h__
+#define __CocosHubDelegate_h__
+
+#include "cocos2d.h"
+#include "HubDelegate.h"
+#include "EventCustomObject.h"
+
+namespace funny {
+    namespace network {
+        
+        /**
+         * Posts hub events to cocos2d EventDispatcher as kCCNotification* custom events whose user
+         * object is the socket, packet or batch. Every hub of a cocos build uses one by default.
+         */
+        class CocosHubDelegate : public HubDelegate {
+        private:
+            /// event reused for every received packet
+            EventCustomObject* m_packetEvent;
+            
+        private:
+            /// post event with object
+            void post(const std::string& name, Ref* obj);
+            
+        public:
+            CocosHubDelegate();
+            virtual ~CocosHubDelegate();
+            
+            virtual void onSocketConnected(TCPSocketHub* hub, TCPSocket* socket);
+            virtual void onPacketReceived(TCPSocketHub* hub, Packet* packet);
+            virtual void onPacketsReceived(TCPSocketHub* hub, PacketBatch* batch);
+            virtual void onSocketWritabilityChanged(TCPSocketHub* hub, TCPSocket* socket, bool writable);
+            virtual void onSocketDisconnected(TCPSocketHub* hub, TCPSocket* socket);
+        };
+        
+    }
+}
+
+#endif //__CocosHubDelegate_h__
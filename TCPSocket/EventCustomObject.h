@@ -24,11 +24,12 @@
 #define __TCPSocket__EventCustomObject__
 
 #include "cocos2d.h"
+#include "NetworkConfig.h"
 
 class EventCustomObject : public cocos2d::EventCustom {
     
 public:
-    EventCustomObject(const std::string& name, cocos2d::Ref *obj) : EventCustom(name){
+    EventCustomObject(const std::string& name, funny::network::Ref *obj) : EventCustom(name){
         _userObject = nullptr;
         setUserObject(obj);
     }
@@ -37,7 +38,15 @@ public:
         CC_SAFE_RELEASE_NULL(_userObject);
     }
     
-    CC_SYNTHESIZE_RETAIN(cocos2d::Ref *, _userObject, UserObject);
+    /// prepare event to be dispatched again with another object
+    void reuse(funny::network::Ref *obj){
+        _isStopped = false;
+        _currentTarget = nullptr;
+        setUserObject(obj);
+    }
+    
+    /// network object, retained through its atomic count
+    CC_SYNTHESIZE_RETAIN(funny::network::Ref *, _userObject, UserObject);
 };
 
 #endif /* defined(__TCPSocket__EventCustomObject__) */
@@ -0,0 +1,62 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef __HubDelegate_h__
+#define __HubDelegate_h__
+
+namespace funny {
+    namespace network {
+        
+        class TCPSocketHub;
+        class TCPSocket;
+        class Packet;
+        class PacketBatch;
+        
+        /**
+         * Receiver of hub events. Methods are called by TCPSocketHub::update on its calling thread,
+         * arguments are valid during the call, retain them to keep them.
+         */
+        class HubDelegate {
+        public:
+            virtual ~HubDelegate() {}
+            
+            /// socket is connected
+            virtual void onSocketConnected(TCPSocketHub* /*hub*/, TCPSocket* /*socket*/) {}
+            
+            /// a packet is received, not called in batch dispatch
+            virtual void onPacketReceived(TCPSocketHub* /*hub*/, Packet* /*packet*/) {}
+            
+            /// packets received since last update, only called in batch dispatch
+            virtual void onPacketsReceived(TCPSocketHub* /*hub*/, PacketBatch* /*batch*/) {}
+            
+            /// send queue of socket went above high watermark (false) or back to low watermark (true)
+            virtual void onSocketWritabilityChanged(TCPSocketHub* /*hub*/, TCPSocket* /*socket*/, bool /*writable*/) {}
+            
+            /// socket is disconnected, hub removes it after this call
+            virtual void onSocketDisconnected(TCPSocketHub* /*hub*/, TCPSocket* /*socket*/) {}
+        };
+        
+    }
+}
+
+#endif //__HubDelegate_h__
@@ -0,0 +1,683 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+#include "JsonWriter.h"
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CC_JSON_SSE2
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define CC_JSON_NEON
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+USING_NS_CC;
+
+namespace funny {
+    namespace network {
+        
+        namespace {
+            
+            /// 0 if byte is written as it is, else character after backslash, 'u' for \u00XX
+            struct EscapeTable {
+                uint8_t e[256];
+                
+                EscapeTable() {
+                    memset(e, 0, sizeof(e));
+                    for(int c = 0; c < 0x20; c++) {
+                        e[c] = 'u';
+                    }
+                    e[(int)'\b'] = 'b';
+                    e[(int)'\f'] = 'f';
+                    e[(int)'\n'] = 'n';
+                    e[(int)'\r'] = 'r';
+                    e[(int)'\t'] = 't';
+                    e[(int)'"'] = '"';
+                    e[(int)'\\'] = '\\';
+                }
+            };
+            
+            const EscapeTable kEscape;
+            
+            const char kDigits[] =
+            "0001020304050607080910111213141516171819"
+            "2021222324252627282930313233343536373839"
+            "4041424344454647484950515253545556575859"
+            "6061626364656667686970717273747576777879"
+            "8081828384858687888990919293949596979899";
+            
+            const char kHex[] = "0123456789abcdef";
+            
+            /// format v backwards ending at end, return start
+            inline char* formatUnsigned(unsigned long long v, char* end) {
+                char* p = end;
+                while(v >= 100) {
+                    unsigned idx = (unsigned)(v % 100) * 2;
+                    v /= 100;
+                    *--p = kDigits[idx + 1];
+                    *--p = kDigits[idx];
+                }
+                if(v < 10) {
+                    *--p = (char)('0' + v);
+                } else {
+                    *--p = kDigits[v * 2 + 1];
+                    *--p = kDigits[v * 2];
+                }
+                return p;
+            }
+            
+            inline uint8_t* escape(uint8_t* d, uint8_t c, uint8_t e) {
+                *d++ = '\\';
+                *d++ = e;
+                if(e == 'u') {
+                    *d++ = '0';
+                    *d++ = '0';
+                    *d++ = kHex[c >> 4];
+                    *d++ = kHex[c & 0xf];
+                }
+                return d;
+            }
+            
+            inline int firstBit(int mask) {
+#if defined(_MSC_VER)
+                unsigned long i;
+                _BitScanForward(&i, mask);
+                return (int)i;
+#else
+                return __builtin_ctz(mask);
+#endif
+            }
+            
+            /// binary floating point with 64 bit significand, value is f * 2^e
+            struct DiyFp {
+                uint64_t f;
+                int e;
+                
+                DiyFp(uint64_t f_, int e_) : f(f_), e(e_) {}
+                
+                DiyFp operator-(const DiyFp& o) const { return DiyFp(f - o.f, e); }
+                
+                /// product rounded to upper 64 bits
+                DiyFp operator*(const DiyFp& o) const {
+                    const uint64_t m32 = 0xFFFFFFFFu;
+                    uint64_t a = f >> 32, b = f & m32, c = o.f >> 32, d = o.f & m32;
+                    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+                    uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32) + (1U << 31);
+                    return DiyFp(ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), e + o.e + 64);
+                }
+                
+                DiyFp normalize() const {
+                    int s = 0;
+#if defined(__GNUC__)
+                    s = __builtin_clzll(f);
+#else
+                    while(!(f << s >> 63))
+                        s++;
+#endif
+                    return DiyFp(f << s, e - s);
+                }
+            };
+            
+            /**
+             * normalized 10^k for k = -348, -340, ..., 340, computed once with big integers instead
+             * of a table of 87 literals
+             */
+            struct CachedPowers {
+                uint64_t f[87];
+                int e[87];
+                
+                typedef std::vector<uint32_t> Big;
+                
+                static size_t bitLength(const Big& b) {
+                    size_t n = b.size();
+                    while(n > 0 && b[n - 1] == 0)
+                        n--;
+                    if(n == 0)
+                        return 0;
+                    size_t bits = (n - 1) * 32;
+                    for(uint32_t top = b[n - 1]; top; top >>= 1)
+                        bits++;
+                    return bits;
+                }
+                
+                static int bit(const Big& b, size_t i) {
+                    return (b[i / 32] >> (i % 32)) & 1;
+                }
+                
+                /// upper 64 bits of b rounded to nearest, value is f * 2^(return value)
+                static int top64(const Big& b, uint64_t& f) {
+                    size_t len = bitLength(b);
+                    f = 0;
+                    for(size_t i = 0; i < 64; i++) {
+                        f = (f << 1) | (uint64_t)(len > i ? bit(b, len - 1 - i) : 0);
+                    }
+                    int e = (int)len - 64;
+                    if(len > 64 && bit(b, len - 65)) {
+                        f++;
+                        if(f == 0) {
+                            f = 1ULL << 63;
+                            e++;
+                        }
+                    }
+                    return e;
+                }
+                
+                CachedPowers() {
+                    for(int i = 0; i < 87; i++) {
+                        int k = -348 + i * 8;
+                        Big b;
+                        if(k >= 0) {
+                            // 10^k exactly
+                            b.push_back(1);
+                            for(int j = 0; j < k; j++) {
+                                uint64_t carry = 0;
+                                for(size_t w = 0; w < b.size(); w++) {
+                                    uint64_t t = (uint64_t)b[w] * 10 + carry;
+                                    b[w] = (uint32_t)t;
+                                    carry = t >> 32;
+                                }
+                                if(carry)
+                                    b.push_back((uint32_t)carry);
+                            }
+                            e[i] = top64(b, f[i]);
+                        } else {
+                            // 2^n / 10^-k keeping 128 bits more than needed
+                            int n = 192 - k * 4;
+                            b.assign(n / 32 + 1, 0);
+                            b[n / 32] = 1u << (n % 32);
+                            for(int j = 0; j < -k; j++) {
+                                uint64_t rem = 0;
+                                for(size_t w = b.size(); w-- > 0;) {
+                                    uint64_t t = (rem << 32) | b[w];
+                                    b[w] = (uint32_t)(t / 10);
+                                    rem = t % 10;
+                                }
+                            }
+                            e[i] = top64(b, f[i]) - n;
+                        }
+                    }
+                }
+                
+                /// power 10^-K which brings a number with binary exponent e into [2^-60, 2^-32]
+                DiyFp get(int exponent, int& K) const {
+                    double dk = (-61 - exponent) * 0.30102999566398114 + 347;
+                    int k = (int)dk;
+                    if(dk - k > 0.0)
+                        k++;
+                    unsigned index = (unsigned)((k >> 3) + 1);
+                    K = -(-348 + (int)(index << 3));
+                    return DiyFp(f[index], e[index]);
+                }
+            };
+            
+            const CachedPowers kCachedPowers;
+            
+            const uint32_t kPow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+            
+            /// integers up to this are exact in a double
+            const double kMaxExact = 9007199254740992.0;
+            
+            /// room for any number written by writeReal, sign and exponent included
+            const size_t kFormatSize = 32;
+            
+            inline void grisuRound(char* buffer, int len, uint64_t delta, uint64_t rest, uint64_t tenKappa, uint64_t wpw) {
+                while(rest < wpw && delta - rest >= tenKappa &&
+                      (rest + tenKappa < wpw || wpw - rest > rest + tenKappa - wpw)) {
+                    buffer[len - 1]--;
+                    rest += tenKappa;
+                }
+            }
+            
+            /**
+             * Grisu2 of Florian Loitsch: shortest digits of a number between minus and plus, close
+             * to v, in nearly all cases the shortest which reads back as v and always one which does
+             *
+             * @param v value, positive
+             * @param minus lower boundary, exponent same as plus
+             * @param plus upper boundary, normalized
+             * @param buffer digits without dot
+             * @param K decimal exponent, value is digits * 10^K
+             * @return digit count
+             */
+            int grisu(const DiyFp& v, DiyFp minus, DiyFp plus, char* buffer, int& K) {
+                const DiyFp c = kCachedPowers.get(plus.e, K);
+                const DiyFp w = v.normalize() * c;
+                DiyFp wp = plus * c;
+                DiyFp wm = minus * c;
+                wm.f++;
+                wp.f--;
+                
+                uint64_t delta = wp.f - wm.f;
+                const DiyFp one(1ULL << -wp.e, wp.e);
+                const DiyFp wpw = wp - w;
+                uint32_t p1 = (uint32_t)(wp.f >> -one.e);
+                uint64_t p2 = wp.f & (one.f - 1);
+                int kappa = 1;
+                while(kappa < 10 && p1 >= kPow10[kappa])
+                    kappa++;
+                
+                // integer part
+                int len = 0;
+                while(kappa > 0) {
+                    uint32_t d = p1 / kPow10[kappa - 1];
+                    p1 %= kPow10[kappa - 1];
+                    if(d || len)
+                        buffer[len++] = (char)('0' + d);
+                    kappa--;
+                    uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+                    if(rest <= delta) {
+                        K += kappa;
+                        grisuRound(buffer, len, delta, rest, (uint64_t)kPow10[kappa] << -one.e, wpw.f);
+                        return len;
+                    }
+                }
+                
+                // fraction
+                for(;;) {
+                    p2 *= 10;
+                    delta *= 10;
+                    char d = (char)(p2 >> -one.e);
+                    if(d || len)
+                        buffer[len++] = (char)('0' + d);
+                    p2 &= one.f - 1;
+                    kappa--;
+                    if(p2 < delta) {
+                        K += kappa;
+                        int index = -kappa;
+                        grisuRound(buffer, len, delta, p2, one.f, wpw.f * (index < 10 ? kPow10[index] : 0));
+                        return len;
+                    }
+                }
+            }
+            
+            char* writeExponent(int k, char* p) {
+                *p++ = 'e';
+                if(k < 0) {
+                    *p++ = '-';
+                    k = -k;
+                }
+                char buf[8];
+                char* end = buf + sizeof(buf);
+                char* start = formatUnsigned((unsigned)k, end);
+                memcpy(p, start, end - start);
+                return p + (end - start);
+            }
+            
+            /// place dot or exponent into digits * 10^k, integers keep ".0" so readers see a real
+            char* prettify(char* buffer, int len, int k) {
+                int kk = len + k;
+                if(k >= 0 && kk <= 21) {
+                    // 1234e7 -> 12340000000.0
+                    for(int i = len; i < kk; i++)
+                        buffer[i] = '0';
+                    buffer[kk] = '.';
+                    buffer[kk + 1] = '0';
+                    return buffer + kk + 2;
+                } else if(kk > 0 && kk <= 21) {
+                    // 1234e-2 -> 12.34
+                    memmove(buffer + kk + 1, buffer + kk, len - kk);
+                    buffer[kk] = '.';
+                    return buffer + len + 1;
+                } else if(kk > -6 && kk <= 0) {
+                    // 1234e-6 -> 0.001234
+                    int offset = 2 - kk;
+                    memmove(buffer + offset, buffer, len);
+                    buffer[0] = '0';
+                    buffer[1] = '.';
+                    for(int i = 2; i < offset; i++)
+                        buffer[i] = '0';
+                    return buffer + len + offset;
+                } else if(len == 1) {
+                    // 1e30
+                    return writeExponent(kk - 1, buffer + 1);
+                } else {
+                    // 1234e30 -> 1.234e33
+                    memmove(buffer + 2, buffer + 1, len - 1);
+                    buffer[1] = '.';
+                    return writeExponent(kk - 1, buffer + len + 1);
+                }
+            }
+            
+            /**
+             * write finite v as json number
+             *
+             * @param v value
+             * @param f significand with hidden bit
+             * @param e binary exponent, v is f * 2^e
+             * @param lowerCloser f is a power of two so the next smaller number is closer
+             * @param buffer kFormatSize bytes
+             * @return end of text
+             */
+            char* writeReal(double v, uint64_t f, int e, bool lowerCloser, char* buffer) {
+                char* p = buffer;
+                if(v < 0) {
+                    *p++ = '-';
+                    v = -v;
+                }
+                
+                // integers skip grisu
+                if(v < kMaxExact && v == (double)(uint64_t)v) {
+                    char digits[24];
+                    char* end = digits + sizeof(digits);
+                    char* start = formatUnsigned((uint64_t)v, end);
+                    memcpy(p, start, end - start);
+                    p += end - start;
+                    *p++ = '.';
+                    *p++ = '0';
+                    return p;
+                }
+                
+                DiyFp plus = DiyFp((f << 1) + 1, e - 1).normalize();
+                DiyFp minus = lowerCloser ? DiyFp((f << 2) - 1, e - 2) : DiyFp((f << 1) - 1, e - 1);
+                minus.f <<= minus.e - plus.e;
+                minus.e = plus.e;
+                int K;
+                int len = grisu(DiyFp(f, e), minus, plus, p, K);
+                return prettify(p, len, K);
+            }
+        }
+        
+        JsonWriter::JsonWriter(ByteBuffer& out) :
+        m_out(out),
+        m_afterKey(false),
+        m_mark(NULL) {
+        }
+        
+        uint8_t* JsonWriter::element(size_t size) {
+            uint8_t* p = m_out.prepareWrite(size + 1);
+            m_mark = p;
+            if(!p)
+                return NULL;
+            
+            if(m_afterKey) {
+                m_afterKey = false;
+            } else if(!m_first.empty()) {
+                if(m_first.back())
+                    m_first.back() = false;
+                else
+                    *p++ = ',';
+            }
+            return p;
+        }
+        
+        uint8_t* JsonWriter::writeString(uint8_t* d, const char* s, size_t len) {
+            const uint8_t* src = (const uint8_t*)s;
+            *d++ = '"';
+            size_t i = 0;
+#if defined(CC_JSON_SSE2)
+            const __m128i quote = _mm_set1_epi8('"');
+            const __m128i backslash = _mm_set1_epi8('\\');
+            const __m128i control = _mm_set1_epi8(0x1f);
+            while(i + 16 <= len) {
+                __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+                __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash));
+                hit = _mm_or_si128(hit, _mm_cmpeq_epi8(_mm_max_epu8(x, control), control));
+                int mask = _mm_movemask_epi8(hit);
+                if(!mask) {
+                    _mm_storeu_si128((__m128i*)d, x);
+                    d += 16;
+                    i += 16;
+                    continue;
+                }
+                
+                // copy up to first special byte, escape it and scan again from there
+                int n = firstBit(mask);
+                memcpy(d, src + i, n);
+                d += n;
+                i += n;
+                d = escape(d, src[i], kEscape.e[src[i]]);
+                i++;
+            }
+#elif defined(CC_JSON_NEON)
+            const uint8x16_t quote = vdupq_n_u8('"');
+            const uint8x16_t backslash = vdupq_n_u8('\\');
+            const uint8x16_t space = vdupq_n_u8(0x20);
+            while(i + 16 <= len) {
+                uint8x16_t x = vld1q_u8(src + i);
+                uint8x16_t hit = vorrq_u8(vceqq_u8(x, quote), vceqq_u8(x, backslash));
+                hit = vorrq_u8(hit, vcltq_u8(x, space));
+                if(vmaxvq_u8(hit) == 0) {
+                    vst1q_u8(d, x);
+                    d += 16;
+                    i += 16;
+                    continue;
+                }
+                for(size_t end = i + 16; i < end; i++) {
+                    uint8_t e = kEscape.e[src[i]];
+                    if(e)
+                        d = escape(d, src[i], e);
+                    else
+                        *d++ = src[i];
+                }
+            }
+#endif
+            for(; i < len; i++) {
+                uint8_t e = kEscape.e[src[i]];
+                if(e)
+                    d = escape(d, src[i], e);
+                else
+                    *d++ = src[i];
+            }
+            *d++ = '"';
+            return d;
+        }
+        
+        void JsonWriter::startObject() {
+            uint8_t* p = element(1);
+            if(p) {
+                *p++ = '{';
+                done(p);
+            }
+            m_first.push_back(true);
+        }
+        
+        void JsonWriter::endObject() {
+            m_out.write((const uint8_t*)"}", 1);
+            if(!m_first.empty())
+                m_first.pop_back();
+        }
+        
+        void JsonWriter::startArray() {
+            uint8_t* p = element(1);
+            if(p) {
+                *p++ = '[';
+                done(p);
+            }
+            m_first.push_back(true);
+        }
+        
+        void JsonWriter::endArray() {
+            m_out.write((const uint8_t*)"]", 1);
+            if(!m_first.empty())
+                m_first.pop_back();
+        }
+        
+        void JsonWriter::key(const char* s, size_t len) {
+            // worst case every byte becomes \u00XX
+            uint8_t* p = element(len * 6 + 3);
+            if(p) {
+                p = writeString(p, s, len);
+                *p++ = ':';
+                done(p);
+            }
+            m_afterKey = true;
+        }
+        
+        void JsonWriter::value(long long v) {
+            uint8_t* p = element(20);
+            if(!p)
+                return;
+            char buf[24];
+            char* end = buf + sizeof(buf);
+            unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+            char* start = formatUnsigned(u, end);
+            if(v < 0)
+                *--start = '-';
+            memcpy(p, start, end - start);
+            done(p + (end - start));
+        }
+        
+        void JsonWriter::value(unsigned long long v) {
+            uint8_t* p = element(20);
+            if(!p)
+                return;
+            char buf[24];
+            char* end = buf + sizeof(buf);
+            char* start = formatUnsigned(v, end);
+            memcpy(p, start, end - start);
+            done(p + (end - start));
+        }
+        
+        void JsonWriter::value(float v) {
+            if(!isfinite(v)) {
+                null();
+                return;
+            }
+            uint8_t* p = element(kFormatSize);
+            if(!p)
+                return;
+            
+            // boundaries of float so digits stop as soon as they read back as same float
+            uint32_t bits;
+            memcpy(&bits, &v, sizeof(bits));
+            uint32_t exponent = (bits >> 23) & 0xFF;
+            uint64_t f = bits & 0x7FFFFF;
+            int e = -149;
+            if(exponent) {
+                f += 1 << 23;
+                e = (int)exponent - 150;
+            }
+            done((uint8_t*)writeReal(v, f, e, f == (1 << 23) && exponent > 1, (char*)p));
+        }
+        
+        void JsonWriter::value(double v) {
+            if(!isfinite(v)) {
+                null();
+                return;
+            }
+            uint8_t* p = element(kFormatSize);
+            if(!p)
+                return;
+            
+            uint64_t bits;
+            memcpy(&bits, &v, sizeof(bits));
+            uint32_t exponent = (uint32_t)(bits >> 52) & 0x7FF;
+            uint64_t f = bits & 0xFFFFFFFFFFFFFULL;
+            int e = -1074;
+            if(exponent) {
+                f += 1ULL << 52;
+                e = (int)exponent - 1075;
+            }
+            done((uint8_t*)writeReal(v, f, e, f == (1ULL << 52) && exponent > 1, (char*)p));
+        }
+        
+        void JsonWriter::value(bool v) {
+            uint8_t* p = element(5);
+            if(!p)
+                return;
+            if(v) {
+                memcpy(p, "true", 4);
+                done(p + 4);
+            } else {
+                memcpy(p, "false", 5);
+                done(p + 5);
+            }
+        }
+        
+        void JsonWriter::value(const char* s, size_t len) {
+            uint8_t* p = element(len * 6 + 2);
+            if(p)
+                done(writeString(p, s, len));
+        }
+        
+        void JsonWriter::null() {
+            uint8_t* p = element(4);
+            if(p) {
+                memcpy(p, "null", 4);
+                done(p + 4);
+            }
+        }
+
+#ifndef TCPSOCKET_HEADLESS
+        void JsonWriter::value(const Value& v) {
+            switch(v.getType()) {
+                case Value::Type::BYTE:
+                    value((int)v.asByte());
+                    break;
+                case Value::Type::INTEGER:
+                    value(v.asInt());
+                    break;
+                case Value::Type::FLOAT:
+                    value(v.asFloat());
+                    break;
+                case Value::Type::DOUBLE:
+                    value(v.asDouble());
+                    break;
+                case Value::Type::BOOLEAN:
+                    value(v.asBool());
+                    break;
+                case Value::Type::STRING:
+                    value(v.asString());
+                    break;
+                case Value::Type::VECTOR:
+                    startArray();
+                    for(auto& e : v.asValueVector()) {
+                        value(e);
+                    }
+                    endArray();
+                    break;
+                case Value::Type::MAP:
+                    startObject();
+                    for(auto& e : v.asValueMap()) {
+                        key(e.first);
+                        value(e.second);
+                    }
+                    endObject();
+                    break;
+                case Value::Type::INT_KEY_MAP:
+                    startObject();
+                    for(auto& e : v.asIntKeyMap()) {
+                        char buf[24];
+                        char* end = buf + sizeof(buf);
+                        unsigned long long u = e.first < 0 ? 0ULL - (unsigned long long)(long long)e.first : (unsigned long long)e.first;
+                        char* p = formatUnsigned(u, end);
+                        if(e.first < 0)
+                            *--p = '-';
+                        key(p, end - p);
+                        value(e.second);
+                    }
+                    endObject();
+                    break;
+                default:
+                    null();
+                    break;
+            }
+        }
+#endif
+        
+    }
+}
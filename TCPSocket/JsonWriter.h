@@ -0,0 +1,132 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef __JsonWriter_h__
+#define __JsonWriter_h__
+
+#include "ByteBuffer.h"
+#include <string>
+#include <vector>
+
+namespace funny {
+    namespace network {
+        
+        /**
+         * Streaming json writer appending to a ByteBuffer, e.g. a PacketBuilder so the text goes
+         * straight into a packet buffer. Output has no whitespace. Commas are written by the
+         * writer, caller only opens and closes containers and gives keys and values in order.
+         *
+         * Strings are scanned 16 bytes at a time with SSE2 or NEON for characters which need
+         * escaping, integers are formatted two digits at a time and floats and doubles with Grisu2,
+         * shortest digits reading back as the same value, without printf. Integral reals keep a
+         * ".0" so readers parse them as reals again. NaN and infinity are written as null. Each element reserves
+         * room for its worst case first, e.g. six bytes per string byte, so a fixed size buffer
+         * needs that much left.
+         *
+         * @code
+         * JsonWriter w(builder);
+         * w.startObject();
+         * w.key("id");
+         * w.value(7);
+         * w.key("pos");
+         * w.startArray();
+         * w.value(1.5);
+         * w.value(-2.25);
+         * w.endArray();
+         * w.endObject();
+         * @endcode
+         */
+        class CC_DLL JsonWriter {
+        protected:
+            /// output
+            ByteBuffer& m_out;
+            
+            /// one entry per open container, true until its first element is written
+            std::vector<bool> m_first;
+            
+            /// a key was written, next value needs no comma
+            bool m_afterKey;
+            
+            /// output position when current element was started
+            uint8_t* m_mark;
+            
+        protected:
+            /**
+             * make room for an element of at most size bytes and write the comma before it unless
+             * it is first in its container
+             *
+             * @return where to write element, NULL if buffer can't grow
+             */
+            uint8_t* element(size_t size);
+            
+            /// mark element written up to end
+            void done(uint8_t* end) { m_out.commit(end - m_mark); }
+            
+            /// quoted and escaped string at d, d has room for len * 6 + 2 bytes
+            static uint8_t* writeString(uint8_t* d, const char* s, size_t len);
+            
+        public:
+            JsonWriter(ByteBuffer& out);
+            
+            void startObject();
+            void endObject();
+            void startArray();
+            void endArray();
+            
+            /// key of next value, only inside an object
+            void key(const char* s, size_t len);
+            void key(const std::string& s) { key(s.data(), s.length()); }
+            void key(const char* s) { key(s, strlen(s)); }
+            
+            void value(int v) { value((long long)v); }
+            void value(long v) { value((long long)v); }
+            void value(long long v);
+            void value(unsigned int v) { value((unsigned long long)v); }
+            void value(unsigned long v) { value((unsigned long long)v); }
+            void value(unsigned long long v);
+            
+            /// shortest decimal which reads back as same float
+            void value(float v);
+            
+            /// shortest decimal which reads back as same double
+            void value(double v);
+            
+            void value(bool v);
+            void value(const char* s, size_t len);
+            void value(const std::string& s) { value(s.data(), s.length()); }
+            void value(const char* s) { value(s, strlen(s)); }
+            void null();
+
+#ifndef TCPSOCKET_HEADLESS
+            /// whole value tree, int key maps get string keys
+            void value(const cocos2d::Value& v);
+#endif
+            
+            /// depth of open containers, 0 when the document is complete
+            size_t getDepth() { return m_first.size(); }
+        };
+        
+    }
+}
+
+#endif //__JsonWriter_h__
@@ -0,0 +1,121 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+#ifndef __MPSCQueue_h__
+#define __MPSCQueue_h__
+
+#include <atomic>
+#include <stddef.h>
+
+namespace funny {
+    namespace network {
+        
+        /**
+         * Unbounded lock-free queue, many threads may push while one thread pops.
+         *
+         * It is a linked list with a stub node (D. Vyukov's design): push swaps the head pointer
+         * and links the old head, so producers never wait on each other or on the consumer. Pop
+         * only touches the tail owned by consumer. Both are O(1).
+         *
+         * A push is visible to pop once its link is stored; a producer that swapped head but has
+         * not linked yet makes pop return false for a moment, so producer must signal consumer
+         * after push returns.
+         */
+        template<typename T> class MPSCQueue {
+        private:
+            struct Node {
+                std::atomic<Node*> next;
+                T value;
+            };
+            
+            /// last pushed node, producers side
+            std::atomic<Node*> m_head;
+            
+            /// stub or last popped node, consumer side
+            Node* m_tail;
+            
+            /// element count, it may lag behind concurrent push/pop
+            std::atomic<size_t> m_size;
+            
+        private:
+            MPSCQueue(const MPSCQueue&);
+            MPSCQueue& operator=(const MPSCQueue&);
+            
+        public:
+            MPSCQueue() :
+            m_size(0) {
+                Node* stub = new Node();
+                stub->next.store(NULL, std::memory_order_relaxed);
+                m_head.store(stub, std::memory_order_relaxed);
+                m_tail = stub;
+            }
+            
+            ~MPSCQueue() {
+                T v;
+                while(pop(v));
+                delete m_tail;
+            }
+            
+            /// add to queue, safe from any thread
+            void push(const T& v) {
+                Node* n = new Node();
+                n->value = v;
+                n->next.store(NULL, std::memory_order_relaxed);
+                m_size.fetch_add(1, std::memory_order_relaxed);
+                Node* prev = m_head.exchange(n, std::memory_order_acq_rel);
+                prev->next.store(n, std::memory_order_release);
+            }
+            
+            /**
+             * take oldest element, consumer thread only
+             *
+             * @param v receives element
+             * @return false if queue is empty
+             */
+            bool pop(T& v) {
+                Node* tail = m_tail;
+                Node* next = tail->next.load(std::memory_order_acquire);
+                if(!next) {
+                    return false;
+                }
+                v = next->value;
+                m_tail = next;
+                delete tail;
+                m_size.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+            
+            /// true if nothing can be popped now, consumer thread only
+            bool empty() {
+                return m_tail->next.load(std::memory_order_acquire) == NULL;
+            }
+            
+            /// approximate element count, safe from any thread
+            size_t size() {
+                return m_size.load(std::memory_order_relaxed);
+            }
+        };
+        
+    }
+}
+
+#endif //__MPSCQueue_h__
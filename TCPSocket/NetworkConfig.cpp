@@ -0,0 +1,67 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+#include "NetworkConfig.h"
+
+#ifdef TCPSOCKET_HEADLESS
+
+namespace funny {
+    namespace network {
+        
+        /// objects waiting for drainAutoreleasePool, one list per thread
+        static thread_local std::vector<Ref*> s_autoreleasePool;
+        
+        Ref* Ref::autorelease() {
+            s_autoreleasePool.push_back(this);
+            return this;
+        }
+        
+        void drainAutoreleasePool() {
+            // release may autorelease more objects, they wait for next drain
+            std::vector<Ref*> objects;
+            objects.swap(s_autoreleasePool);
+            for(auto obj : objects) {
+                obj->release();
+            }
+        }
+        
+    }
+}
+
+#else
+
+namespace funny {
+    namespace network {
+        
+        Ref* Ref::autorelease() {
+            // autorelease pool of cocos would drop a reference through the plain cocos2d::Ref count
+            cocos2d::Director::getInstance()->getScheduler()->performFunctionInCocosThread([this]() {
+                release();
+            });
+            return this;
+        }
+        
+    }
+}
+
+#endif // TCPSOCKET_HEADLESS
@@ -0,0 +1,250 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef __NetworkConfig_h__
+#define __NetworkConfig_h__
+
+/**
+ * Base types of network classes. By default they are cocos2d's own. With TCPSOCKET_HEADLESS
+ * defined the library does not use cocos2d at all: Ref, Vector and the few cocos macros used
+ * here are defined below, hub events go to a HubDelegate and the owner calls TCPSocketHub::update
+ * from its own loop.
+ */
+
+#ifdef TCPSOCKET_HEADLESS
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#define CC_DLL
+#define USING_NS_CC
+
+#ifdef TCPSOCKET_DEBUG
+#define CCLOG(format, ...) fprintf(stderr, format "\n", ##__VA_ARGS__)
+#else
+#define CCLOG(...) do {} while (0)
+#endif
+#define CCLOGWARN(format, ...) fprintf(stderr, format "\n", ##__VA_ARGS__)
+
+#define CCASSERT(cond, msg) assert(cond)
+
+#ifndef MIN
+#define MIN(x, y) (((x) > (y)) ? (y) : (x))
+#endif
+#ifndef MAX
+#define MAX(x, y) (((x) < (y)) ? (y) : (x))
+#endif
+
+#define CC_SAFE_FREE(p) do { if(p) { free(p); (p) = NULL; } } while(0)
+#define CC_SAFE_RELEASE(p) do { if(p) { (p)->release(); } } while(0)
+#define CC_SAFE_RELEASE_NULL(p) do { if(p) { (p)->release(); (p) = NULL; } } while(0)
+#define CC_SAFE_RETAIN(p) do { if(p) { (p)->retain(); } } while(0)
+
+#define CC_SYNTHESIZE(varType, varName, funName)\
+protected: varType varName;\
+public: virtual varType get##funName(void) const { return varName; }\
+public: virtual void set##funName(varType var){ varName = var; }
+
+#define CC_SYNTHESIZE_READONLY(varType, varName, funName)\
+protected: varType varName;\
+public: virtual varType get##funName(void) const { return varName; }
+
+#define CC_SYNTHESIZE_PASS_BY_REF(varType, varName, funName)\
+protected: varType varName;\
+public: virtual const varType& get##funName(void) const { return varName; }\
+public: virtual void set##funName(const varType& var){ varName = var; }
+
+#define CC_SYNTHESIZE_READONLY_PASS_BY_REF(varType, varName, funName)\
+protected: varType varName;\
+public: virtual const varType& get##funName(void) const { return varName; }
+
+namespace funny {
+    namespace network {
+        
+        /**
+         * Reference counted object like cocos2d::Ref. Count is atomic, objects are shared between
+         * I/O threads and the thread calling hub update.
+         */
+        class Ref {
+        protected:
+            /// references
+            std::atomic<unsigned int> _referenceCount;
+            
+        protected:
+            Ref() : _referenceCount(1) {}
+            
+        public:
+            virtual ~Ref() {}
+            
+            /// add a reference
+            void retain() { _referenceCount.fetch_add(1, std::memory_order_relaxed); }
+            
+            /// drop a reference, object is deleted by last one
+            void release() {
+                if(_referenceCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    delete this;
+            }
+            
+            /// release object when autorelease pool of calling thread is drained
+            Ref* autorelease();
+            
+            /// number of references
+            unsigned int getReferenceCount() const { return _referenceCount.load(std::memory_order_relaxed); }
+        };
+        
+        /// release objects autoreleased on calling thread, headless hub update calls it at its end
+        void drainAutoreleasePool();
+        
+        /**
+         * Array retaining its elements, the part of cocos2d::Vector used by network classes
+         */
+        template<class T> class Vector {
+        private:
+            std::vector<T> _data;
+            
+        public:
+            typedef typename std::vector<T>::iterator iterator;
+            typedef typename std::vector<T>::const_iterator const_iterator;
+            
+            Vector() {}
+            Vector(const Vector& other) : _data(other._data) {
+                for(auto obj : _data)
+                    obj->retain();
+            }
+            ~Vector() { clear(); }
+            
+            Vector& operator=(const Vector& other) {
+                if(this != &other) {
+                    for(auto obj : other._data)
+                        obj->retain();
+                    clear();
+                    _data = other._data;
+                }
+                return *this;
+            }
+            
+            iterator begin() { return _data.begin(); }
+            iterator end() { return _data.end(); }
+            const_iterator begin() const { return _data.begin(); }
+            const_iterator end() const { return _data.end(); }
+            
+            ssize_t size() const { return (ssize_t)_data.size(); }
+            bool empty() const { return _data.empty(); }
+            void reserve(ssize_t n) { _data.reserve(n); }
+            
+            T at(ssize_t index) const { return _data[index]; }
+            T front() const { return _data.front(); }
+            T back() const { return _data.back(); }
+            bool contains(T obj) const { return std::find(_data.begin(), _data.end(), obj) != _data.end(); }
+            
+            void pushBack(T obj) {
+                obj->retain();
+                _data.push_back(obj);
+            }
+            
+            void popBack() {
+                T last = _data.back();
+                _data.pop_back();
+                last->release();
+            }
+            
+            void eraseObject(T obj, bool removeAll = false) {
+                for(auto it = _data.begin(); it != _data.end();) {
+                    if(*it == obj) {
+                        it = _data.erase(it);
+                        obj->release();
+                        if(!removeAll)
+                            break;
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+            
+            void swap(ssize_t index1, ssize_t index2) { std::swap(_data[index1], _data[index2]); }
+            
+            void clear() {
+                std::vector<T> old;
+                old.swap(_data);
+                for(auto obj : old)
+                    obj->release();
+            }
+        };
+        
+    }
+}
+
+#else
+
+#include "cocos2d.h"
+#include <atomic>
+
+namespace funny {
+    namespace network {
+        
+        /**
+         * cocos2d::Ref with an atomic count of its own. Network objects are retained and released
+         * on I/O threads, dispatcher threads and cocos thread, the count of cocos2d::Ref is not
+         * atomic. retain and release hide the cocos2d::Ref ones, so call them through a network
+         * type or this Ref, never through a cocos2d::Ref pointer.
+         */
+        class CC_DLL Ref : public cocos2d::Ref {
+        protected:
+            /// references
+            std::atomic<unsigned int> _atomicReferenceCount;
+            
+        protected:
+            Ref() : _atomicReferenceCount(1) {}
+            
+        public:
+            /// add a reference
+            void retain() { _atomicReferenceCount.fetch_add(1, std::memory_order_relaxed); }
+            
+            /// drop a reference, object is deleted by last one
+            void release() {
+                if(_atomicReferenceCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    delete this;
+            }
+            
+            /// release object on cocos thread at next scheduler update, callable from any thread
+            Ref* autorelease();
+            
+            /// number of references
+            unsigned int getReferenceCount() const { return _atomicReferenceCount.load(std::memory_order_relaxed); }
+        };
+        
+        template<class T> using Vector = cocos2d::Vector<T>;
+        
+    }
+}
+
+#endif // TCPSOCKET_HEADLESS
+
+#endif //__NetworkConfig_h__
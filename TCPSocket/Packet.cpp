@@ -25,91 +25,145 @@
 
 #include "Packet.h"
 #include "ByteBuffer.h"
-#include "JSONUtils.h"
+#include <new>
+
+#ifndef TCPSOCKET_HEADLESS
+#include "PacketBuilder.h"
+#include "JsonWriter.h"
+#endif
 
 USING_NS_CC;
 
 namespace funny {
     namespace network {
         
+        /// free list shared by all packets, never destroyed because packets may outlive statics
+        static FreeList* packetFreeList() {
+            static FreeList* s_list = new FreeList(sizeof(Packet), kCCPacketPoolMaxCached);
+            return s_list;
+        }
+        
+        void* Packet::operator new(size_t size) {
+            if(size != sizeof(Packet)) {
+                return ::operator new(size);
+            }
+            void* p = packetFreeList()->allocate();
+            if(!p) {
+                throw std::bad_alloc();
+            }
+            return p;
+        }
+        
+        void Packet::operator delete(void* p, size_t size) {
+            if(size != sizeof(Packet)) {
+                ::operator delete(p);
+            } else {
+                packetFreeList()->free(p);
+            }
+        }
+        
+        PoolStats Packet::getObjectPoolStats() {
+            return packetFreeList()->getStats();
+        }
+        
+        PoolStats Packet::getBufferPoolStats() {
+            return BufferPool::getInstance()->getStats();
+        }
         
         Packet::Packet() :
         m_buffer(NULL),
+        m_bufferCapacity(0),
+        m_chunk(NULL),
+        m_decoded(NULL),
         m_packetLength(0),
-        m_raw(false) {
+        m_raw(false),
+        m_exclusive(false) {
             memset(&m_header, 0, sizeof(Header));
         }
         
         Packet::~Packet() {
-            CC_SAFE_FREE(m_buffer);
+            freeBuffer();
+            CC_SAFE_RELEASE(m_decoded);
         }
-        
+
+#ifndef TCPSOCKET_HEADLESS
         bool Packet::initWithJson(const std::string& magic, int command, const cocos2d::Value& json, int protocolVersion, int serverVersion, int algorithm) {
-            // check magic
-            if(magic.length() < 4)
+            // header, then json written straight after it in the same pooled buffer
+            PacketBuilder builder;
+            if(!builder.begin(magic, command, protocolVersion, serverVersion, algorithm))
                 return false;
             
-            // magic
-            m_header.magic[0] = magic.at(0);
-            m_header.magic[1] = magic.at(1);
-            m_header.magic[2] = magic.at(2);
-            m_header.magic[3] = magic.at(3);
-            
-            // protocol version
-            m_header.protocolVersion = protocolVersion;
-            
-            // server version
-            m_header.serverVersion = serverVersion;
-            
-            // command id
-            m_header.command = command;
-            
-            // no encrypt
-            m_header.encryptAlgorithm = algorithm;
-            
-            // body
-            std::string bodyStr = JSONUtils::getInstance()->JSONStringFromValue(json);
-            char* plain = (char*)bodyStr.c_str();
-            
-            m_header.length = (int)bodyStr.length();
-            allocate(bodyStr.length() + kPacketHeaderLength + 1);
-            memcpy(m_buffer + kPacketHeaderLength, plain, bodyStr.length());
-            m_packetLength = bodyStr.length() + kPacketHeaderLength;
-            
-            // write header
-            writeHeader();
-            
-            // init
-            m_raw = false;
-            
-            return true;
+            JsonWriter writer(builder);
+            writer.value(json);
+            return builder.finish(this);
         }
+#endif
         
-        bool Packet::initWithStandardBuf(const char* buf, size_t len) {
+        bool Packet::parseHeader(const char* buf, size_t len, Header& header) {
             // quick check
             if(len < kPacketHeaderLength) {
                 return false;
             }
             
-            // header
             ByteBuffer bb(buf, len, len);
-            m_header.magic[0] = bb.read<char>();
-            m_header.magic[1] = bb.read<char>();
-            m_header.magic[2] = bb.read<char>();
-            m_header.magic[3] = bb.read<char>();
-            m_header.protocolVersion = (int32_t)(bb.read<int>());
-            m_header.serverVersion = (int32_t)(bb.read<int>());
-            m_header.command = (int32_t)(bb.read<int>());
-            m_header.encryptAlgorithm = (int32_t)(bb.read<int>());
-            m_header.length = (int32_t)(bb.read<int>());
+            header.magic[0] = bb.read<char>();
+            header.magic[1] = bb.read<char>();
+            header.magic[2] = bb.read<char>();
+            header.magic[3] = bb.read<char>();
+            header.protocolVersion = (int32_t)(bb.read<int>());
+            header.serverVersion = (int32_t)(bb.read<int>());
+            header.command = (int32_t)(bb.read<int>());
+            header.encryptAlgorithm = (int32_t)(bb.read<int>());
+            header.length = (int32_t)(bb.read<int>());
+            return true;
+        }
+        
+        void Packet::encodeHeader(const Header& header, char* buf) {
+            int32_t fields[5] = {
+                header.protocolVersion,
+                header.serverVersion,
+                header.command,
+                header.encryptAlgorithm,
+                header.length
+            };
+            memcpy(buf, header.magic, 4);
+            memcpy(buf + 4, fields, sizeof(fields));
+        }
+        
+        int Packet::packAlgorithm(int encrypt, int codec, int dictionaryId) {
+            int e = encrypt < 0 ? 0xFFFF : (encrypt & 0xFFFF);
+            if(codec == kCCCodecNone)
+                return e == 0xFFFF ? -1 : e;
+            return (codec << 24) | ((dictionaryId & 0xFF) << 16) | e;
+        }
+        
+        bool Packet::initWithStandardBuf(const char* buf, size_t len) {
+            // header
+            Header header;
+            if(!parseHeader(buf, len, header)) {
+                return false;
+            }
             
             // body
-            if(bb.available() >= m_header.length) {
-                allocate(m_header.length + kPacketHeaderLength + 1);
-                bb.read((uint8_t*)m_buffer + kPacketHeaderLength, m_header.length);
-            } else {
+            if(header.length < 0 || len - kPacketHeaderLength < (size_t)header.length) {
                 return false;
             }
+            return initWithHeader(header, buf + kPacketHeaderLength);
+        }
+        
+        bool Packet::initWithHeader(const Header& header, const char* body) {
+            if(header.length < 0) {
+                return false;
+            }
+            
+            m_header = header;
+            allocate(m_header.length + kPacketHeaderLength + 1);
+            if(!m_buffer) {
+                return false;
+            }
+            if(body) {
+                memcpy(m_buffer + kPacketHeaderLength, body, m_header.length);
+            }
             
             // init other
             m_raw = false;
@@ -124,6 +178,7 @@ namespace funny {
         bool Packet::initWithRawBuf(const char* buf, size_t len, int algorithm) {
             
             m_header.length = (int)len;
+            m_header.encryptAlgorithm = algorithm;
             allocate(len + 1);
             memcpy(m_buffer, buf, len);
             
@@ -134,29 +189,67 @@ namespace funny {
             return true;
         }
         
-        void Packet::writeHeader() {
-            ByteBuffer bb(m_buffer, m_packetLength, 0);
+        bool Packet::initWithSlice(RecvChunk* chunk, const Header& header, const char* frame) {
+            if(header.length < 0) {
+                return false;
+            }
             
-            // magic
-            bb.write<char>(m_header.magic[0]);
-            bb.write<char>(m_header.magic[1]);
-            bb.write<char>(m_header.magic[2]);
-            bb.write<char>(m_header.magic[3]);
+            // frame in chunk already has the header bytes writeHeader would produce
+            freeBuffer();
+            chunk->retain();
+            m_chunk = chunk;
+            m_buffer = (char*)frame;
+            m_header = header;
+            m_raw = false;
+            m_packetLength = m_header.length + kPacketHeaderLength;
             
-            // protocol version
-            bb.write<int>(int32_t(m_header.protocolVersion));
+            return true;
+        }
+        
+        bool Packet::initWithRawSlice(RecvChunk* chunk, const char* buf, size_t len) {
+            freeBuffer();
+            chunk->retain();
+            m_chunk = chunk;
+            m_buffer = (char*)buf;
+            m_header.length = (int)len;
+            m_raw = true;
+            m_packetLength = m_header.length;
             
-            // server version
-            bb.write<int>(int32_t(m_header.serverVersion));
+            return true;
+        }
+        
+        bool Packet::initWithBuffer(char* buffer, size_t capacity, const Header& header) {
+            if(!buffer || header.length < 0 || capacity < (size_t)header.length + kPacketHeaderLength + 1) {
+                return false;
+            }
             
-            // command id
-            bb.write<int>(int32_t(m_header.command));
+            freeBuffer();
+            m_buffer = buffer;
+            m_bufferCapacity = capacity;
+            m_header = header;
+            m_raw = false;
+            m_packetLength = m_header.length + kPacketHeaderLength;
+            m_buffer[m_packetLength] = 0;
             
-            // no encrypt
-            bb.write<int>(int32_t(m_header.encryptAlgorithm));
+            return true;
+        }
+        
+        void Packet::detach() {
+            if(!m_chunk) {
+                return;
+            }
             
-            // body length
-            bb.write<int>(int32_t(m_header.length));
+            RecvChunk* chunk = m_chunk;
+            const char* data = m_buffer;
+            m_chunk = NULL;
+            m_buffer = NULL;
+            allocate(m_packetLength + 1);
+            memcpy(m_buffer, data, m_packetLength);
+            chunk->release();
+        }
+        
+        void Packet::writeHeader() {
+            encodeHeader(m_header, m_buffer);
         }
         
         const char* Packet::getBody() {
@@ -167,8 +260,41 @@ namespace funny {
         }
         
         void Packet::allocate(size_t len) {
-            if(!m_buffer)
-                m_buffer = (char*)calloc(len, sizeof(char));
+            if(!m_buffer) {
+                m_buffer = BufferPool::getInstance()->allocate(len, m_bufferCapacity);
+                
+                // content is written by caller, only the trailing zero is ours
+                if(m_buffer)
+                    m_buffer[len - 1] = 0;
+            }
+        }
+        
+        void Packet::freeBuffer() {
+            if(m_chunk) {
+                m_chunk->release();
+                m_chunk = NULL;
+            } else if(m_bufferCapacity > 0) {
+                BufferPool::getInstance()->free(m_buffer, m_bufferCapacity);
+            } else {
+                CC_SAFE_FREE(m_buffer);
+            }
+            m_buffer = NULL;
+            m_bufferCapacity = 0;
+        }
+        
+        void Packet::setDecoded(Ref* decoded) {
+            if(decoded != m_decoded) {
+                CC_SAFE_RETAIN(decoded);
+                CC_SAFE_RELEASE(m_decoded);
+                m_decoded = decoded;
+            }
+        }
+        
+        void Packet::setBuffer(char* buffer) {
+            if(buffer != m_buffer) {
+                freeBuffer();
+                m_buffer = buffer;
+            }
         }
     }
 }
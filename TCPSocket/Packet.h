@@ -25,10 +25,20 @@
 #ifndef __Packet__
 #define __Packet__
 
-#include "cocos2d.h"
+#include "NetworkConfig.h"
+#include "BufferPool.h"
+#include "RecvChunk.h"
 
 #define kPacketHeaderLength 24
 
+/// offset of length field in header, it is the last field
+#define kPacketHeaderLengthOffset 20
+
+/// codec ids stored in encryptAlgorithm field of header, see Packet::packAlgorithm
+#define kCCCodecNone 0
+#define kCCCodecLZ 1
+#define kCCCodecZlib 2
+
 namespace funny {
     namespace network {
         
@@ -36,7 +46,7 @@ namespace funny {
          * A general packet definition, it will have a header. However, it provides
          * methods to create a raw packet which has no header.
          */
-        class CC_DLL Packet : public cocos2d::Ref {
+        class CC_DLL Packet : public Ref {
         public:
             typedef struct {
                 char magic[4];
@@ -50,6 +60,16 @@ namespace funny {
         public:
             Packet();
             
+            /// packet objects come from a free list, subclasses with other size use global new
+            static void* operator new(size_t size);
+            static void operator delete(void* p, size_t size);
+            
+            /// counters of packet object free list
+            static PoolStats getObjectPoolStats();
+            
+            /// counters of packet buffer pool
+            static PoolStats getBufferPoolStats();
+            
             /**
              * Override autorelease method to avoid developers to call it.
              * If this function was called, it would trigger assert in debug mode
@@ -64,14 +84,82 @@ namespace funny {
             }
             
         public:
+            /**
+             * read header at start of buffer
+             *
+             * @param buf buffer holding a standard packet
+             * @param len available bytes in buffer
+             * @param header receives header
+             * @return false if buffer is shorter than header
+             */
+            static bool parseHeader(const char* buf, size_t len, Header& header);
+            
+            /// write header into first kPacketHeaderLength bytes of buf
+            static void encodeHeader(const Header& header, char* buf);
+            
+            /**
+             * value of encryptAlgorithm field. Bits 0-15 hold encrypt algorithm, a compressed body
+             * adds dictionary id in bits 16-23 and codec in bits 24-27, so -1 and small algorithm
+             * ids written by older peers still mean an uncompressed body
+             *
+             * @param encrypt encrypt algorithm 0..65534, -1 for none
+             * @param codec kCCCodecNone, kCCCodecLZ, ...
+             * @param dictionaryId dictionary of codec, 0 for none
+             */
+            static int packAlgorithm(int encrypt, int codec, int dictionaryId);
+            
+            /// encrypt algorithm in encryptAlgorithm field, -1 for none
+            static int getEncryptAlgorithm(int algorithm) { return (algorithm & 0xFFFF) == 0xFFFF ? -1 : (algorithm & 0xFFFF); }
+            
+            /// codec in encryptAlgorithm field, kCCCodecNone if body is not compressed
+            static int getCodec(int algorithm) { return ((algorithm >> 24) & 0xF) == 0xF ? kCCCodecNone : ((algorithm >> 24) & 0xF); }
+            
+            /// dictionary id in encryptAlgorithm field, 0 for none
+            static int getDictionaryId(int algorithm) { return getCodec(algorithm) == kCCCodecNone ? 0 : ((algorithm >> 16) & 0xFF); }
+            
             virtual bool initWithStandardBuf(const char* buf, size_t len);
+            
+            /// init standard packet from a parsed header and body holding header.length bytes, NULL body
+            /// leaves body uninitialized for caller to fill through getBuffer
+            virtual bool initWithHeader(const Header& header, const char* body);
             virtual bool initWithRawBuf(const char* buf, size_t len, int algorithm=-1);
+            
+            /**
+             * init standard packet as a view of a frame inside a receive chunk, nothing is copied.
+             * Data of a slice is not zero terminated.
+             *
+             * @param chunk chunk holding frame, packet keeps a reference
+             * @param header parsed header of frame
+             * @param frame start of frame, header included
+             */
+            virtual bool initWithSlice(RecvChunk* chunk, const Header& header, const char* frame);
+            
+            /// init raw packet as a view of bytes inside a receive chunk
+            virtual bool initWithRawSlice(RecvChunk* chunk, const char* buf, size_t len);
+            
+            /**
+             * init standard packet by taking over a buffer which already holds the encoded header
+             * and body, nothing is copied
+             *
+             * @param buffer buffer from BufferPool, packet frees it on success; byte after body must
+             * be writable
+             * @param capacity capacity returned by BufferPool
+             * @param header header encoded in buffer
+             */
+            virtual bool initWithBuffer(char* buffer, size_t capacity, const Header& header);
+
+#ifndef TCPSOCKET_HEADLESS
+            /// init standard packet with json body written by JsonWriter straight into the packet buffer
             virtual bool initWithJson(const std::string& magic, int command, const cocos2d::Value& json, int protocolVersion, int serverVersion, int algorithm=-1);
+#endif
             
         protected:
-            // allocate buffer
+            // allocate buffer from pool
             void allocate(size_t len);
             
+            // return buffer to pool
+            void freeBuffer();
+            
             // write header
             void writeHeader();
             
@@ -84,10 +172,48 @@ namespace funny {
             // get body pointer
             const char* getBody();
             
+            /// true if data lives in a receive chunk shared with other packets
+            bool isSlice() { return m_chunk != NULL; }
+            
+            /**
+             * copy data of a slice into a buffer owned by packet. A slice keeps its whole receive
+             * chunk alive, call it before storing packet for long or writing to its buffer.
+             */
+            void detach();
+            
             CC_SYNTHESIZE_PASS_BY_REF(Header, m_header, Header);
-            CC_SYNTHESIZE(char*, m_buffer, Buffer);
+            CC_SYNTHESIZE_READONLY(char*, m_buffer, Buffer);
+            
+            /// replace buffer, packet takes ownership and frees it with free()
+            void setBuffer(char* buffer);
+            
+            /// real size of buffer, 0 if it was set by setBuffer or packet is a slice
+            CC_SYNTHESIZE_READONLY(size_t, m_bufferCapacity, BufferCapacity);
+            
+            /**
+             * true if only the send path holds the packet, set when it is handed off to
+             * TCPSocket::sendPacket or made by a pipeline stage. Stages may write it in place.
+             */
+            bool isExclusive() { return m_exclusive; }
+            void setExclusive(bool exclusive) { m_exclusive = exclusive; }
+            
+            /// object made from body by packet decoder of hub, NULL if there is none
+            Ref* getDecoded() { return m_decoded; }
+            
+            /// attach decoded object, it is retained and released with packet
+            void setDecoded(Ref* decoded);
+            
+        protected:
+            /// receive chunk holding buffer of a slice
+            RecvChunk* m_chunk;
+            
+            /// decoded body, retained
+            Ref* m_decoded;
             CC_SYNTHESIZE_READONLY(size_t, m_packetLength, PacketLength);
             CC_SYNTHESIZE_READONLY(bool, m_raw, Raw);
+            
+            /// see isExclusive
+            bool m_exclusive;
         };
     }
 }
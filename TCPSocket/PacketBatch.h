@@ -0,0 +1,65 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef __PacketBatch_h__
+#define __PacketBatch_h__
+
+#include "NetworkConfig.h"
+#include "Packet.h"
+#include <vector>
+
+namespace funny {
+    namespace network {
+        
+        /**
+         * Packets received by a hub between two updates, in arrival order. It is the object of
+         * batch packet event, each packet is retained by batch.
+         */
+        class CC_DLL PacketBatch : public Ref {
+            friend class TCPSocketHub;
+            
+        private:
+            /// retained packets
+            std::vector<Packet*> m_packets;
+            
+        public:
+            virtual ~PacketBatch() {
+                for(auto p : m_packets) {
+                    p->release();
+                }
+            }
+            
+            /// number of packets
+            size_t size() { return m_packets.size(); }
+            
+            /// packet at index
+            Packet* at(size_t i) { return m_packets[i]; }
+            
+            /// all packets
+            const std::vector<Packet*>& getPackets() { return m_packets; }
+        };
+        
+    }
+}
+
+#endif //__PacketBatch_h__
@@ -0,0 +1,96 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+#include "PacketBuilder.h"
+
+USING_NS_CC;
+
+namespace funny {
+    namespace network {
+        
+        PacketBuilder::PacketBuilder() :
+        ByteBuffer(0, true),
+        m_building(false) {
+            memset(&m_header, 0, sizeof(Packet::Header));
+        }
+        
+        bool PacketBuilder::begin(const std::string& magic, int command, int protocolVersion, int serverVersion, int algorithm, size_t bodyHint) {
+            m_building = false;
+            clear();
+            if(magic.length() < 4)
+                return false;
+            
+            // header, body and trailing zero of packet
+            if(!ensureCanWrite(kPacketHeaderLength + bodyHint + 1))
+                return false;
+            
+            memcpy(m_header.magic, magic.data(), 4);
+            m_header.protocolVersion = protocolVersion;
+            m_header.serverVersion = serverVersion;
+            m_header.command = command;
+            m_header.encryptAlgorithm = algorithm;
+            m_header.length = 0;
+            Packet::encodeHeader(m_header, (char*)m_buffer);
+            m_writePos = kPacketHeaderLength;
+            m_building = true;
+            return true;
+        }
+        
+        Packet* PacketBuilder::finish() {
+            if(!m_building)
+                return NULL;
+            
+            Packet* p = new Packet();
+            if(!finish(p)) {
+                p->release();
+                return NULL;
+            }
+            return p;
+        }
+        
+        bool PacketBuilder::finish(Packet* packet) {
+            if(!m_building)
+                return false;
+            m_building = false;
+            
+            // room for trailing zero
+            if(!ensureCanWrite(1)) {
+                clear();
+                return false;
+            }
+            
+            int32_t length = (int32_t)(m_writePos - kPacketHeaderLength);
+            m_header.length = length;
+            memcpy(m_buffer + kPacketHeaderLengthOffset, &length, sizeof(length));
+            
+            size_t capacity;
+            char* buf = (char*)releaseBuffer(capacity);
+            if(!packet->initWithBuffer(buf, capacity, m_header)) {
+                if(buf)
+                    BufferPool::getInstance()->free(buf, capacity);
+                return false;
+            }
+            return true;
+        }
+        
+    }
+}
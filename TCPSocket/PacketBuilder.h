@@ -0,0 +1,94 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef __PacketBuilder_h__
+#define __PacketBuilder_h__
+
+#include "ByteBuffer.h"
+#include "Packet.h"
+
+namespace funny {
+    namespace network {
+        
+        /**
+         * Builds a standard packet in place. begin reserves the header in a BufferPool block, the
+         * body is written with the write methods of ByteBuffer straight after it and finish patches
+         * the length field and hands the block to a new Packet. A builder may be reused, each packet
+         * then costs one pool allocation and no copy.
+         *
+         * @code
+         * PacketBuilder b;
+         * b.begin("GAME", command, 1, 1);
+         * b.writeVarint(playerId);
+         * b.writeArrayLE(positions, count);
+         * Packet* p = b.finish();
+         * socket->sendPacket(p, true);
+         * @endcode
+         */
+        class CC_DLL PacketBuilder : public ByteBuffer {
+        protected:
+            /// header of packet being built, length is set by finish
+            Packet::Header m_header;
+            
+            /// true between begin and finish
+            bool m_building;
+            
+        public:
+            PacketBuilder();
+            
+            /**
+             * start a packet, a packet started before and not finished is dropped
+             *
+             * @param magic 4 bytes magic
+             * @param command command id
+             * @param protocolVersion protocol version
+             * @param serverVersion server version
+             * @param algorithm encrypt algorithm
+             * @param bodyHint expected body size, buffer is reserved for it
+             * @return false if magic is shorter than 4 bytes or out of memory
+             */
+            bool begin(const std::string& magic, int command, int protocolVersion, int serverVersion, int algorithm=-1, size_t bodyHint=0);
+            
+            /// body bytes written so far
+            size_t getBodyLength() { return m_building ? m_writePos - kPacketHeaderLength : 0; }
+            
+            /**
+             * set length in header and move buffer into a new packet, builder is empty afterwards
+             *
+             * @return packet with a reference for caller, NULL if begin wasn't called or out of memory
+             */
+            Packet* finish();
+            
+            /**
+             * same as finish() but hands the buffer to an existing packet, e.g. one being initialized
+             *
+             * @param packet packet to take the buffer, its old buffer is freed
+             * @return false if begin wasn't called or out of memory
+             */
+            bool finish(Packet* packet);
+        };
+        
+    }
+}
+
+#endif //__PacketBuilder_h__
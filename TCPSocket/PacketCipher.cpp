@@ -0,0 +1,278 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+#include "PacketCipher.h"
+#include "ByteOrder.h"
+
+#if !kCCHostBigEndian
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CC_CHACHA_SSE2
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define CC_CHACHA_SSSE3
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CC_CHACHA_NEON
+#endif
+#endif
+
+USING_NS_CC;
+
+/// one block of key stream
+#define kChaChaBlockSize 64
+
+namespace funny {
+    namespace network {
+        
+        namespace {
+            
+            inline uint32_t rotl(uint32_t v, int n) {
+                return (v << n) | (v >> (32 - n));
+            }
+            
+            inline uint32_t readLE32(const uint8_t* p) {
+                return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+            }
+
+#define CHACHA_QR(a, b, c, d) \
+            a += b; d ^= a; d = rotl(d, 16); \
+            c += d; b ^= c; b = rotl(b, 12); \
+            a += b; d ^= a; d = rotl(d, 8); \
+            c += d; b ^= c; b = rotl(b, 7);
+            
+            /// one block of key stream, words are written little endian
+            void chachaBlock(const uint32_t* in, uint8_t* out) {
+                uint32_t x[16];
+                memcpy(x, in, sizeof(x));
+                for(int i = 0; i < 10; i++) {
+                    CHACHA_QR(x[0], x[4], x[8], x[12]);
+                    CHACHA_QR(x[1], x[5], x[9], x[13]);
+                    CHACHA_QR(x[2], x[6], x[10], x[14]);
+                    CHACHA_QR(x[3], x[7], x[11], x[15]);
+                    CHACHA_QR(x[0], x[5], x[10], x[15]);
+                    CHACHA_QR(x[1], x[6], x[11], x[12]);
+                    CHACHA_QR(x[2], x[7], x[8], x[13]);
+                    CHACHA_QR(x[3], x[4], x[9], x[14]);
+                }
+                for(int i = 0; i < 16; i++) {
+                    uint32_t v = x[i] + in[i];
+                    out[i * 4] = (uint8_t)v;
+                    out[i * 4 + 1] = (uint8_t)(v >> 8);
+                    out[i * 4 + 2] = (uint8_t)(v >> 16);
+                    out[i * 4 + 3] = (uint8_t)(v >> 24);
+                }
+            }
+
+#if defined(CC_CHACHA_SSE2)
+            
+            template<int N> inline __m128i rotlv(__m128i v) {
+                return _mm_or_si128(_mm_slli_epi32(v, N), _mm_srli_epi32(v, 32 - N));
+            }
+            
+            /// 16 bit rotation swaps halves of each word
+            template<> inline __m128i rotlv<16>(__m128i v) {
+                return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+            }
+
+#if defined(CC_CHACHA_SSSE3)
+            template<> inline __m128i rotlv<8>(__m128i v) {
+                const __m128i m = _mm_set_epi8(14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+                return _mm_shuffle_epi8(v, m);
+            }
+#endif
+
+#define CHACHA_QRV(a, b, c, d) \
+            a = _mm_add_epi32(a, b); d = rotlv<16>(_mm_xor_si128(d, a)); \
+            c = _mm_add_epi32(c, d); b = rotlv<12>(_mm_xor_si128(b, c)); \
+            a = _mm_add_epi32(a, b); d = rotlv<8>(_mm_xor_si128(d, a)); \
+            c = _mm_add_epi32(c, d); b = rotlv<7>(_mm_xor_si128(b, c));
+            
+            /**
+             * xor four blocks of key stream into 256 bytes. Lane j of x[i] is word i of block j, so
+             * the rounds work on four blocks without shuffles and 4x4 transposes bring each block's
+             * words together at the end
+             */
+            void chachaXor4(const uint32_t* s, uint8_t* data) {
+                __m128i in[16];
+                __m128i x[16];
+                for(int i = 0; i < 16; i++) {
+                    in[i] = _mm_set1_epi32((int)s[i]);
+                }
+                in[12] = _mm_add_epi32(in[12], _mm_set_epi32(3, 2, 1, 0));
+                for(int i = 0; i < 16; i++) {
+                    x[i] = in[i];
+                }
+                for(int i = 0; i < 10; i++) {
+                    CHACHA_QRV(x[0], x[4], x[8], x[12]);
+                    CHACHA_QRV(x[1], x[5], x[9], x[13]);
+                    CHACHA_QRV(x[2], x[6], x[10], x[14]);
+                    CHACHA_QRV(x[3], x[7], x[11], x[15]);
+                    CHACHA_QRV(x[0], x[5], x[10], x[15]);
+                    CHACHA_QRV(x[1], x[6], x[11], x[12]);
+                    CHACHA_QRV(x[2], x[7], x[8], x[13]);
+                    CHACHA_QRV(x[3], x[4], x[9], x[14]);
+                }
+                for(int g = 0; g < 4; g++) {
+                    __m128i a = _mm_add_epi32(x[g * 4], in[g * 4]);
+                    __m128i b = _mm_add_epi32(x[g * 4 + 1], in[g * 4 + 1]);
+                    __m128i c = _mm_add_epi32(x[g * 4 + 2], in[g * 4 + 2]);
+                    __m128i d = _mm_add_epi32(x[g * 4 + 3], in[g * 4 + 3]);
+                    __m128i t0 = _mm_unpacklo_epi32(a, b);
+                    __m128i t1 = _mm_unpacklo_epi32(c, d);
+                    __m128i t2 = _mm_unpackhi_epi32(a, b);
+                    __m128i t3 = _mm_unpackhi_epi32(c, d);
+                    __m128i r[4] = {
+                        _mm_unpacklo_epi64(t0, t1),
+                        _mm_unpackhi_epi64(t0, t1),
+                        _mm_unpacklo_epi64(t2, t3),
+                        _mm_unpackhi_epi64(t2, t3)
+                    };
+                    for(int j = 0; j < 4; j++) {
+                        __m128i* p = (__m128i*)(data + j * kChaChaBlockSize + g * 16);
+                        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), r[j]));
+                    }
+                }
+            }
+
+#elif defined(CC_CHACHA_NEON)
+            
+            template<int N> inline uint32x4_t rotlv(uint32x4_t v) {
+                return vsliq_n_u32(vshrq_n_u32(v, 32 - N), v, N);
+            }
+            
+            template<> inline uint32x4_t rotlv<16>(uint32x4_t v) {
+                return vreinterpretq_u32_u16(vrev32q_u16(vreinterpretq_u16_u32(v)));
+            }
+
+#define CHACHA_QRV(a, b, c, d) \
+            a = vaddq_u32(a, b); d = rotlv<16>(veorq_u32(d, a)); \
+            c = vaddq_u32(c, d); b = rotlv<12>(veorq_u32(b, c)); \
+            a = vaddq_u32(a, b); d = rotlv<8>(veorq_u32(d, a)); \
+            c = vaddq_u32(c, d); b = rotlv<7>(veorq_u32(b, c));
+            
+            /// same as the SSE2 kernel, lane j of x[i] is word i of block j
+            void chachaXor4(const uint32_t* s, uint8_t* data) {
+                static const uint32_t kLanes[4] = { 0, 1, 2, 3 };
+                uint32x4_t in[16];
+                uint32x4_t x[16];
+                for(int i = 0; i < 16; i++) {
+                    in[i] = vdupq_n_u32(s[i]);
+                }
+                in[12] = vaddq_u32(in[12], vld1q_u32(kLanes));
+                for(int i = 0; i < 16; i++) {
+                    x[i] = in[i];
+                }
+                for(int i = 0; i < 10; i++) {
+                    CHACHA_QRV(x[0], x[4], x[8], x[12]);
+                    CHACHA_QRV(x[1], x[5], x[9], x[13]);
+                    CHACHA_QRV(x[2], x[6], x[10], x[14]);
+                    CHACHA_QRV(x[3], x[7], x[11], x[15]);
+                    CHACHA_QRV(x[0], x[5], x[10], x[15]);
+                    CHACHA_QRV(x[1], x[6], x[11], x[12]);
+                    CHACHA_QRV(x[2], x[7], x[8], x[13]);
+                    CHACHA_QRV(x[3], x[4], x[9], x[14]);
+                }
+                for(int g = 0; g < 4; g++) {
+                    uint32x4_t a = vaddq_u32(x[g * 4], in[g * 4]);
+                    uint32x4_t b = vaddq_u32(x[g * 4 + 1], in[g * 4 + 1]);
+                    uint32x4_t c = vaddq_u32(x[g * 4 + 2], in[g * 4 + 2]);
+                    uint32x4_t d = vaddq_u32(x[g * 4 + 3], in[g * 4 + 3]);
+                    uint32x4x2_t ab = vtrnq_u32(a, b);
+                    uint32x4x2_t cd = vtrnq_u32(c, d);
+                    uint32x4_t r[4] = {
+                        vcombine_u32(vget_low_u32(ab.val[0]), vget_low_u32(cd.val[0])),
+                        vcombine_u32(vget_low_u32(ab.val[1]), vget_low_u32(cd.val[1])),
+                        vcombine_u32(vget_high_u32(ab.val[0]), vget_high_u32(cd.val[0])),
+                        vcombine_u32(vget_high_u32(ab.val[1]), vget_high_u32(cd.val[1]))
+                    };
+                    for(int j = 0; j < 4; j++) {
+                        uint8_t* p = data + j * kChaChaBlockSize + g * 16;
+                        vst1q_u8(p, veorq_u8(vld1q_u8(p), vreinterpretq_u8_u32(r[j])));
+                    }
+                }
+            }
+#endif
+        }
+        
+        ChaCha20Cipher::ChaCha20Cipher(const uint8_t* key, int algorithm) :
+        PacketCipher(algorithm) {
+            for(int i = 0; i < 8; i++) {
+                m_key[i] = readLE32(key + i * 4);
+            }
+        }
+        
+        ChaCha20Cipher::~ChaCha20Cipher() {
+            // key shouldn't outlive cipher in freed memory
+            volatile uint32_t* k = m_key;
+            for(int i = 0; i < 8; i++) {
+                k[i] = 0;
+            }
+        }
+        
+        void ChaCha20Cipher::apply(char* data, size_t len, uint32_t stream, uint64_t sequence) {
+            uint32_t nonce[3] = { stream, (uint32_t)sequence, (uint32_t)(sequence >> 32) };
+            xorStream(m_key, nonce, 0, (uint8_t*)data, len);
+        }
+        
+        void ChaCha20Cipher::xorStream(const uint32_t* key, const uint32_t* nonce, uint32_t counter, uint8_t* data, size_t len) {
+            // "expand 32-byte k"
+            uint32_t state[16] = {
+                0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+                key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+                counter, nonce[0], nonce[1], nonce[2]
+            };
+            size_t done = 0;
+#if defined(CC_CHACHA_SSE2) || defined(CC_CHACHA_NEON)
+            while(len - done >= kChaChaBlockSize * 4) {
+                chachaXor4(state, data + done);
+                state[12] += 4;
+                done += kChaChaBlockSize * 4;
+            }
+#endif
+            while(done < len) {
+                uint8_t stream[kChaChaBlockSize];
+                chachaBlock(state, stream);
+                size_t n = MIN((size_t)kChaChaBlockSize, len - done);
+                for(size_t i = 0; i < n; i++) {
+                    data[done + i] ^= stream[i];
+                }
+                state[12]++;
+                done += n;
+            }
+        }
+        
+        const char* ChaCha20Cipher::getKernelName() {
+#if defined(CC_CHACHA_SSSE3)
+            return "ssse3";
+#elif defined(CC_CHACHA_SSE2)
+            return "sse2";
+#elif defined(CC_CHACHA_NEON)
+            return "neon";
+#else
+            return "scalar";
+#endif
+        }
+        
+    }
+}
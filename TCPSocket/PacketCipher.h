@@ -0,0 +1,104 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef __PacketCipher_h__
+#define __PacketCipher_h__
+
+#include "NetworkConfig.h"
+#include <stdint.h>
+
+/// default encrypt algorithm id of ChaCha20Cipher
+#define kCCEncryptChaCha20 20
+
+#define kCCChaCha20KeySize 32
+
+namespace funny {
+    namespace network {
+        
+        /**
+         * Stream cipher for packet bodies, serves one encrypt algorithm id. Same call encrypts and
+         * decrypts, bytes are changed in place. Ciphers are used by several I/O threads at once and
+         * must not keep state between calls, per packet state comes in as a sequence number.
+         */
+        class CC_DLL PacketCipher : public Ref {
+        protected:
+            /// encrypt algorithm id in header
+            int m_algorithm;
+            
+        public:
+            PacketCipher(int algorithm) : m_algorithm(algorithm) {}
+            
+            /// encrypt algorithm id in header
+            int getAlgorithm() { return m_algorithm; }
+            
+            /**
+             * xor key stream of one packet into data
+             *
+             * @param data body
+             * @param len body length
+             * @param stream direction of packet, 0 client to server, 1 server to client
+             * @param sequence number of packet in its direction, no two packets of a key and
+             * direction may use the same number
+             */
+            virtual void apply(char* data, size_t len, uint32_t stream, uint64_t sequence) = 0;
+        };
+        
+        /**
+         * ChaCha20 of RFC 8439 with 256 bit key, nonce is stream and sequence, block counter
+         * starts at 0. SSE2/SSSE3 and NEON kernels make four blocks at once, 256 bytes per round trip
+         * through the state. There is no authentication, a tampered body decrypts to garbage.
+         */
+        class CC_DLL ChaCha20Cipher : public PacketCipher {
+        protected:
+            /// key as little endian words
+            uint32_t m_key[8];
+            
+        public:
+            /**
+             * @param key kCCChaCha20KeySize bytes
+             * @param algorithm encrypt algorithm id served
+             */
+            ChaCha20Cipher(const uint8_t* key, int algorithm = kCCEncryptChaCha20);
+            virtual ~ChaCha20Cipher();
+            
+            virtual void apply(char* data, size_t len, uint32_t stream, uint64_t sequence);
+            
+            /**
+             * xor ChaCha20 key stream into data
+             *
+             * @param key 8 key words
+             * @param nonce 3 nonce words
+             * @param counter block counter of first 64 bytes
+             * @param data data, changed in place
+             * @param len data length
+             */
+            static void xorStream(const uint32_t* key, const uint32_t* nonce, uint32_t counter, uint8_t* data, size_t len);
+            
+            /// kernel used by xorStream, "ssse3", "sse2", "neon" or "scalar"
+            static const char* getKernelName();
+        };
+        
+    }
+}
+
+#endif //__PacketCipher_h__
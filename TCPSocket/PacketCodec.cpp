@@ -0,0 +1,386 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+#include "PacketCodec.h"
+#include "ByteOrder.h"
+
+USING_NS_CC;
+
+/// last match starts this far before end of input at the latest
+#define kLZMatchLimit 12
+
+/// last bytes of input are always literals
+#define kLZLastLiterals 5
+
+#define kLZMinMatch 4
+
+/// inputs shorter than this use a table of 2^kLZSmallHashLog entries
+#define kLZSmallInput 4096
+#define kLZSmallHashLog 10
+
+/// decoder copies in blocks of this size while output and input have room for it
+#define kLZWildCopy 16
+
+namespace funny {
+    namespace network {
+        
+        namespace {
+            
+            inline uint32_t read32(const uint8_t* p) {
+                uint32_t v;
+                memcpy(&v, p, sizeof(v));
+                return v;
+            }
+            
+            inline uint32_t hashLZ(uint32_t sequence, int hashLog) {
+                return (sequence * 2654435761u) >> (32 - hashLog);
+            }
+            
+            /// bytes equal at a and b, at most limit
+            inline size_t matchLength(const uint8_t* a, const uint8_t* b, size_t limit) {
+                size_t n = 0;
+                while(n + 8 <= limit) {
+                    uint64_t x, y;
+                    memcpy(&x, a + n, 8);
+                    memcpy(&y, b + n, 8);
+                    if(x != y) {
+                        uint64_t diff = x ^ y;
+#if defined(__GNUC__) && !kCCHostBigEndian
+                        return n + (__builtin_ctzll(diff) >> 3);
+#else
+                        while(a[n] == b[n])
+                            n++;
+                        return n;
+#endif
+                    }
+                    n += 8;
+                }
+                while(n < limit && a[n] == b[n])
+                    n++;
+                return n;
+            }
+            
+            /// length field continuation: 255 per byte after 15 in token
+            inline uint8_t* writeLength(uint8_t* op, size_t len) {
+                while(len >= 255) {
+                    *op++ = 255;
+                    len -= 255;
+                }
+                *op++ = (uint8_t)len;
+                return op;
+            }
+            
+            /// read continuation of a length field, false if input ends
+            inline bool readLength(const uint8_t*& ip, const uint8_t* end, size_t& len) {
+                uint8_t b;
+                do {
+                    if(ip >= end)
+                        return false;
+                    b = *ip++;
+                    len += b;
+                } while(b == 255);
+                return true;
+            }
+        }
+        
+        LZCodec::LZCodec(const std::string& dictionary, int dictionaryId) :
+        PacketCodec(dictionaryId) {
+            if(dictionary.length() > kCCCodecLZWindow)
+                m_dictionary = dictionary.substr(dictionary.length() - kCCCodecLZWindow);
+            else
+                m_dictionary = dictionary;
+            
+            // later positions win, they are closer to input
+            m_dictionaryTable.assign(1 << kCCCodecLZHashLog, 0);
+            const uint8_t* d = (const uint8_t*)m_dictionary.data();
+            for(size_t i = 0; i + kLZMinMatch <= m_dictionary.length(); i++) {
+                m_dictionaryTable[hashLZ(read32(d + i), kCCCodecLZHashLog)] = (uint32_t)i + 1;
+            }
+        }
+        
+        size_t LZCodec::compress(const char* src, size_t len, char* dst, size_t capacity) {
+            // positions are counted from start of dictionary, input follows it
+            const uint8_t* dict = (const uint8_t*)m_dictionary.data();
+            const uint32_t dictLen = (uint32_t)m_dictionary.length();
+            const uint8_t* in = (const uint8_t*)src;
+            const uint8_t* inEnd = in + len;
+            uint8_t* op = (uint8_t*)dst;
+            uint8_t* opEnd = op + capacity;
+            
+            // short input without dictionary clears a smaller table
+            uint32_t table[1 << kCCCodecLZHashLog];
+            int hashLog = kCCCodecLZHashLog;
+            if(dictLen > 0) {
+                memcpy(table, &m_dictionaryTable[0], sizeof(table));
+            } else {
+                if(len < kLZSmallInput)
+                    hashLog = kLZSmallHashLog;
+                memset(table, 0, sizeof(uint32_t) << hashLog);
+            }
+            
+            const uint8_t* anchor = in;
+            if(len >= kLZMatchLimit + 1) {
+                const uint8_t* ip = in;
+                const uint8_t* matchLimit = inEnd - kLZMatchLimit;
+                const uint8_t* copyLimit = inEnd - kLZLastLiterals;
+                unsigned misses = 0;
+                while(ip < matchLimit) {
+                    // find a 4 byte match, step grows while nothing is found
+                    uint32_t sequence = read32(ip);
+                    uint32_t h = hashLZ(sequence, hashLog);
+                    uint32_t pos = dictLen + (uint32_t)(ip - in);
+                    uint32_t candidate = table[h];
+                    table[h] = pos + 1;
+                    
+                    const uint8_t* ref = NULL;
+                    size_t refLimit = 0;
+                    if(candidate > 0 && pos - (candidate - 1) <= kCCCodecLZWindow) {
+                        uint32_t c = candidate - 1;
+                        if(c >= dictLen) {
+                            ref = in + (c - dictLen);
+                            refLimit = copyLimit - ip;
+                        } else if(c + kLZMinMatch <= dictLen) {
+                            ref = dict + c;
+                            refLimit = MIN((size_t)(dictLen - c), (size_t)(copyLimit - ip));
+                        }
+                    }
+                    if(!ref || read32(ref) != sequence) {
+                        ip += 1 + (misses++ >> 6);
+                        continue;
+                    }
+                    misses = 0;
+                    
+                    // sequence: token, literals, offset, match length
+                    size_t literals = ip - anchor;
+                    size_t match = kLZMinMatch + matchLength(ip + kLZMinMatch, ref + kLZMinMatch, refLimit - kLZMinMatch);
+                    if(op + 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1 > opEnd)
+                        return 0;
+                    uint8_t* token = op++;
+                    if(literals >= 15) {
+                        *token = 15 << 4;
+                        op = writeLength(op, literals - 15);
+                    } else {
+                        *token = (uint8_t)(literals << 4);
+                    }
+                    memcpy(op, anchor, literals);
+                    op += literals;
+                    uint32_t offset = pos - (candidate - 1);
+                    *op++ = (uint8_t)offset;
+                    *op++ = (uint8_t)(offset >> 8);
+                    size_t extra = match - kLZMinMatch;
+                    if(extra >= 15) {
+                        *token |= 15;
+                        op = writeLength(op, extra - 15);
+                    } else {
+                        *token |= (uint8_t)extra;
+                    }
+                    
+                    // position inside match keeps table fresh for next search
+                    ip += match;
+                    anchor = ip;
+                    if(ip < matchLimit) {
+                        table[hashLZ(read32(ip - 2), hashLog)] = dictLen + (uint32_t)(ip - 2 - in) + 1;
+                    }
+                }
+            }
+            
+            // last literals
+            size_t literals = inEnd - anchor;
+            if(op + 1 + literals / 255 + 1 + literals > opEnd)
+                return 0;
+            if(literals >= 15) {
+                *op++ = 15 << 4;
+                op = writeLength(op, literals - 15);
+            } else {
+                *op++ = (uint8_t)(literals << 4);
+            }
+            memcpy(op, anchor, literals);
+            op += literals;
+            return op - (uint8_t*)dst;
+        }
+        
+        bool LZCodec::decompress(const char* src, size_t len, char* dst, size_t originalLength) {
+            const uint8_t* dict = (const uint8_t*)m_dictionary.data();
+            const size_t dictLen = m_dictionary.length();
+            const uint8_t* ip = (const uint8_t*)src;
+            const uint8_t* end = ip + len;
+            uint8_t* out = (uint8_t*)dst;
+            uint8_t* op = out;
+            uint8_t* opEnd = out + originalLength;
+            while(ip < end) {
+                uint8_t token = *ip++;
+                
+                // literals
+                size_t literals = token >> 4;
+                if(literals == 15 && !readLength(ip, end, literals))
+                    return false;
+                if(literals > (size_t)(end - ip) || literals > (size_t)(opEnd - op))
+                    return false;
+                if(literals <= kLZWildCopy && end - ip >= kLZWildCopy && opEnd - op >= kLZWildCopy)
+                    memcpy(op, ip, kLZWildCopy);
+                else
+                    memcpy(op, ip, literals);
+                ip += literals;
+                op += literals;
+                
+                // last sequence has no match
+                if(ip == end)
+                    break;
+                
+                // match
+                if(end - ip < 2)
+                    return false;
+                size_t offset = ip[0] | (ip[1] << 8);
+                ip += 2;
+                size_t match = token & 15;
+                if(match == 15 && !readLength(ip, end, match))
+                    return false;
+                match += kLZMinMatch;
+                if(offset == 0 || match > (size_t)(opEnd - op))
+                    return false;
+                
+                size_t produced = op - out;
+                if(offset > produced) {
+                    // starts in dictionary and may run on into output
+                    size_t back = offset - produced;
+                    if(back > dictLen)
+                        return false;
+                    size_t n = MIN(match, back);
+                    memcpy(op, dict + dictLen - back, n);
+                    op += n;
+                    match -= n;
+                    const uint8_t* ref = out;
+                    while(match-- > 0)
+                        *op++ = *ref++;
+                } else if(offset >= 8 && (size_t)(opEnd - op) >= match + 8) {
+                    // 8 byte blocks may run past match, bytes there are written again later
+                    const uint8_t* ref = op - offset;
+                    uint8_t* matchEnd = op + match;
+                    while(op < matchEnd) {
+                        memcpy(op, ref, 8);
+                        op += 8;
+                        ref += 8;
+                    }
+                    op = matchEnd;
+                } else if(offset >= match) {
+                    memcpy(op, op - offset, match);
+                    op += match;
+                } else {
+                    // overlapping copy repeats last offset bytes
+                    const uint8_t* ref = op - offset;
+                    while(match-- > 0)
+                        *op++ = *ref++;
+                }
+            }
+            return op == opEnd;
+        }
+
+#ifdef TCPSOCKET_ZLIB
+        ZlibCodec::ZlibCodec(const std::string& dictionary, int dictionaryId, int level) :
+        PacketCodec(dictionaryId),
+        m_dictionary(dictionary),
+        m_level(level) {
+            pthread_mutex_init(&m_mutex, NULL);
+        }
+        
+        ZlibCodec::~ZlibCodec() {
+            for(size_t i = 0; i < m_deflaters.size(); i++) {
+                deflateEnd(m_deflaters[i]);
+                delete m_deflaters[i];
+            }
+            for(size_t i = 0; i < m_inflaters.size(); i++) {
+                inflateEnd(m_inflaters[i]);
+                delete m_inflaters[i];
+            }
+            pthread_mutex_destroy(&m_mutex);
+        }
+        
+        z_stream* ZlibCodec::takeStream(bool deflater) {
+            std::vector<z_stream*>& idle = deflater ? m_deflaters : m_inflaters;
+            z_stream* s = NULL;
+            pthread_mutex_lock(&m_mutex);
+            if(!idle.empty()) {
+                s = idle.back();
+                idle.pop_back();
+            }
+            pthread_mutex_unlock(&m_mutex);
+            if(s)
+                return s;
+            
+            // raw streams, packet header already says what the body is
+            s = new z_stream();
+            memset(s, 0, sizeof(z_stream));
+            int err = deflater ? deflateInit2(s, m_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) : inflateInit2(s, -15);
+            if(err != Z_OK) {
+                delete s;
+                return NULL;
+            }
+            return s;
+        }
+        
+        void ZlibCodec::putStream(z_stream* s, bool deflater) {
+            pthread_mutex_lock(&m_mutex);
+            (deflater ? m_deflaters : m_inflaters).push_back(s);
+            pthread_mutex_unlock(&m_mutex);
+        }
+        
+        size_t ZlibCodec::compress(const char* src, size_t len, char* dst, size_t capacity) {
+            z_stream* s = takeStream(true);
+            if(!s)
+                return 0;
+            
+            size_t n = 0;
+            if(m_dictionary.empty() || deflateSetDictionary(s, (const Bytef*)m_dictionary.data(), (uInt)m_dictionary.length()) == Z_OK) {
+                s->next_in = (Bytef*)src;
+                s->avail_in = (uInt)len;
+                s->next_out = (Bytef*)dst;
+                s->avail_out = (uInt)capacity;
+                if(deflate(s, Z_FINISH) == Z_STREAM_END)
+                    n = s->total_out;
+            }
+            deflateReset(s);
+            putStream(s, true);
+            return n;
+        }
+        
+        bool ZlibCodec::decompress(const char* src, size_t len, char* dst, size_t originalLength) {
+            z_stream* s = takeStream(false);
+            if(!s)
+                return false;
+            
+            // raw inflate takes dictionary before first call
+            bool ok = false;
+            if(m_dictionary.empty() || inflateSetDictionary(s, (const Bytef*)m_dictionary.data(), (uInt)m_dictionary.length()) == Z_OK) {
+                s->next_in = (Bytef*)src;
+                s->avail_in = (uInt)len;
+                s->next_out = (Bytef*)dst;
+                s->avail_out = (uInt)originalLength;
+                ok = inflate(s, Z_FINISH) == Z_STREAM_END && s->total_out == originalLength && s->avail_in == 0;
+            }
+            inflateReset(s);
+            putStream(s, false);
+            return ok;
+        }
+#endif
+        
+    }
+}
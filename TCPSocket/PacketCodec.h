@@ -0,0 +1,170 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef __PacketCodec_h__
+#define __PacketCodec_h__
+
+#include "Packet.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/// LZ codec hash table has 2^12 entries
+#define kCCCodecLZHashLog 12
+
+/// LZ matches reach 64K back, longer dictionaries are cut to their last 64K
+#define kCCCodecLZWindow 65535
+
+/// cocos2d-x links zlib on every platform, headless builds define TCPSOCKET_ZLIB when they do
+#if !defined(TCPSOCKET_HEADLESS) && !defined(TCPSOCKET_ZLIB)
+#define TCPSOCKET_ZLIB
+#endif
+
+#ifdef TCPSOCKET_ZLIB
+#include <zlib.h>
+#endif
+
+namespace funny {
+    namespace network {
+        
+        /**
+         * Block compressor for packet bodies. A codec compresses each body on its own, optionally
+         * against a dictionary both peers know, e.g. a typical json body, so short repetitive
+         * bodies compress well too. Codecs are used by several I/O threads at once and must not
+         * keep state between calls.
+         */
+        class CC_DLL PacketCodec : public Ref {
+        protected:
+            /// dictionary id written to header, 0 if there is no dictionary
+            int m_dictionaryId;
+            
+        public:
+            PacketCodec(int dictionaryId) : m_dictionaryId(dictionaryId) {}
+            
+            /// id written to header, kCCCodecLZ ...
+            virtual int getId() = 0;
+            
+            /// dictionary id written to header, 1..254 or 0 for none
+            int getDictionaryId() { return m_dictionaryId; }
+            
+            /// compressed size of len bytes in the worst case
+            virtual size_t getMaxCompressedSize(size_t len) = 0;
+            
+            /**
+             * compress a block
+             *
+             * @param src data
+             * @param len data length
+             * @param dst output
+             * @param capacity room at dst
+             * @return compressed length, 0 if it doesn't fit in capacity
+             */
+            virtual size_t compress(const char* src, size_t len, char* dst, size_t capacity) = 0;
+            
+            /**
+             * decompress a block made by compress
+             *
+             * @param src compressed data
+             * @param len compressed length
+             * @param dst output
+             * @param originalLength length of original data, dst must have room for it
+             * @return false if data is corrupt or isn't originalLength bytes
+             */
+            virtual bool decompress(const char* src, size_t len, char* dst, size_t originalLength) = 0;
+        };
+        
+        /**
+         * Fast codec in the LZ4 block format: greedy matching over a hash table of 4-byte
+         * sequences, no entropy coding. Compresses at several hundred MB/s and decompresses at
+         * more than 1 GB/s. The dictionary is hashed once when codec is created, each call starts
+         * from a copy of that table.
+         */
+        class CC_DLL LZCodec : public PacketCodec {
+        protected:
+            /// last kCCCodecLZWindow bytes of dictionary
+            std::string m_dictionary;
+            
+            /// positions + 1 of dictionary sequences by hash, 0 is empty
+            std::vector<uint32_t> m_dictionaryTable;
+            
+        public:
+            /**
+             * @param dictionary data matches may refer to, empty for none
+             * @param dictionaryId id of dictionary, both peers must use same id for same data
+             */
+            LZCodec(const std::string& dictionary = std::string(), int dictionaryId = 0);
+            
+            virtual int getId() { return kCCCodecLZ; }
+            virtual size_t getMaxCompressedSize(size_t len) { return len + len / 255 + 16; }
+            virtual size_t compress(const char* src, size_t len, char* dst, size_t capacity);
+            virtual bool decompress(const char* src, size_t len, char* dst, size_t originalLength);
+        };
+
+#ifdef TCPSOCKET_ZLIB
+        /**
+         * Raw deflate, slower than LZCodec but compresses better. Dictionary is given to zlib as
+         * preset dictionary. z_streams are reused, each thread takes one from a locked list.
+         */
+        class CC_DLL ZlibCodec : public PacketCodec {
+        protected:
+            /// preset dictionary
+            std::string m_dictionary;
+            
+            /// deflate level
+            int m_level;
+            
+            /// idle streams
+            std::vector<z_stream*> m_deflaters;
+            std::vector<z_stream*> m_inflaters;
+            
+            /// pthread mutex
+            pthread_mutex_t m_mutex;
+            
+        protected:
+            /// take an idle stream or make one, NULL if zlib is out of memory
+            z_stream* takeStream(bool deflater);
+            
+            /// give stream back to idle list
+            void putStream(z_stream* s, bool deflater);
+            
+        public:
+            /**
+             * @param dictionary preset dictionary, empty for none
+             * @param dictionaryId id of dictionary
+             * @param level deflate level, 1 fastest .. 9 smallest
+             */
+            ZlibCodec(const std::string& dictionary = std::string(), int dictionaryId = 0, int level = Z_DEFAULT_COMPRESSION);
+            virtual ~ZlibCodec();
+            
+            virtual int getId() { return kCCCodecZlib; }
+            virtual size_t getMaxCompressedSize(size_t len) { return deflateBound(NULL, (uLong)len); }
+            virtual size_t compress(const char* src, size_t len, char* dst, size_t capacity);
+            virtual bool decompress(const char* src, size_t len, char* dst, size_t originalLength);
+        };
+#endif
+        
+    }
+}
+
+#endif //__PacketCodec_h__
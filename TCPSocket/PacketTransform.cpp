@@ -0,0 +1,212 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+#include "PacketTransform.h"
+#include "PacketBuilder.h"
+
+USING_NS_CC;
+
+namespace funny {
+    namespace network {
+        
+        PacketPipeline::~PacketPipeline() {
+            for(size_t i = 0; i < m_stages.size(); i++) {
+                m_stages[i]->release();
+            }
+        }
+        
+        void PacketPipeline::addStage(PacketTransform* stage) {
+            stage->retain();
+            m_stages.push_back(stage);
+        }
+        
+        Packet* PacketPipeline::encode(Packet* p) {
+            for(size_t i = 0; i < m_stages.size() && p; i++) {
+                Packet* out = m_stages[i]->encode(p);
+                if(out != p)
+                    p->release();
+                p = out;
+            }
+            return p;
+        }
+        
+        Packet* PacketPipeline::decode(Packet* p) {
+            for(size_t i = m_stages.size(); i > 0 && p; i--) {
+                Packet* out = m_stages[i - 1]->decode(p);
+                if(out != p)
+                    p->release();
+                p = out;
+            }
+            return p;
+        }
+        
+        CompressTransform::CompressTransform() :
+        m_threshold(kCCCompressDefaultThreshold),
+        m_maxBodyLength(kCCCompressDefaultMaxBodyLength) {
+        }
+        
+        CompressTransform::~CompressTransform() {
+            for(size_t i = 0; i < m_codecs.size(); i++) {
+                m_codecs[i]->release();
+            }
+        }
+        
+        void CompressTransform::addCodec(PacketCodec* codec) {
+            codec->retain();
+            m_codecs.push_back(codec);
+        }
+        
+        PacketCodec* CompressTransform::getCodec(int id, int dictionaryId) {
+            for(size_t i = 0; i < m_codecs.size(); i++) {
+                if(m_codecs[i]->getId() == id && m_codecs[i]->getDictionaryId() == dictionaryId)
+                    return m_codecs[i];
+            }
+            return NULL;
+        }
+        
+        Packet* CompressTransform::encode(Packet* p) {
+            const Packet::Header& h = p->getHeader();
+            if(m_codecs.empty() || p->getRaw() || h.length < m_threshold ||
+               Packet::getCodec(h.encryptAlgorithm) != kCCCodecNone) {
+                return p;
+            }
+            
+            // compressed body goes straight into the new packet buffer
+            PacketCodec* codec = m_codecs[0];
+            size_t bound = codec->getMaxCompressedSize(h.length);
+            int algorithm = Packet::packAlgorithm(Packet::getEncryptAlgorithm(h.encryptAlgorithm), codec->getId(), codec->getDictionaryId());
+            PacketBuilder builder;
+            if(!builder.begin(std::string(h.magic, 4), h.command, h.protocolVersion, h.serverVersion, algorithm, 4 + bound))
+                return p;
+            builder.writeLE<uint32_t>((uint32_t)h.length);
+            char* dst = (char*)builder.prepareWrite(bound);
+            size_t n = dst ? codec->compress(p->getBody(), h.length, dst, bound) : 0;
+            if(n == 0 || 4 + n >= (size_t)h.length)
+                return p;
+            builder.commit(n);
+            
+            Packet* out = builder.finish();
+            if(!out)
+                return p;
+            out->setExclusive(true);
+            return out;
+        }
+        
+        Packet* CompressTransform::decode(Packet* p) {
+            const Packet::Header& h = p->getHeader();
+            int id = Packet::getCodec(h.encryptAlgorithm);
+            if(p->getRaw() || id == kCCCodecNone) {
+                return p;
+            }
+            
+            PacketCodec* codec = getCodec(id, Packet::getDictionaryId(h.encryptAlgorithm));
+            if(!codec) {
+                CCLOG("CompressTransform: no codec %d with dictionary %d", id, Packet::getDictionaryId(h.encryptAlgorithm));
+                return NULL;
+            }
+            uint32_t length;
+            if(h.length < 4) {
+                return NULL;
+            }
+            memcpy(&length, p->getBody(), 4);
+            length = ByteOrder::little(length);
+            if(length > (uint32_t)m_maxBodyLength) {
+                CCLOG("CompressTransform: compressed body of %u bytes is too long", length);
+                return NULL;
+            }
+            
+            // header as it was before compression
+            Packet::Header plain = h;
+            plain.encryptAlgorithm = Packet::packAlgorithm(Packet::getEncryptAlgorithm(h.encryptAlgorithm), kCCCodecNone, 0);
+            plain.length = (int)length;
+            Packet* out = new Packet();
+            if(!out->initWithHeader(plain, NULL) ||
+               !codec->decompress(p->getBody() + 4, h.length - 4, out->getBuffer() + kPacketHeaderLength, length)) {
+                CCLOG("CompressTransform: corrupt body of command %d", h.command);
+                out->release();
+                return NULL;
+            }
+            return out;
+        }
+        
+        CipherTransform::CipherTransform(bool client) :
+        m_client(client),
+        m_sendSequence(0),
+        m_receiveSequence(0) {
+        }
+        
+        CipherTransform::~CipherTransform() {
+            for(size_t i = 0; i < m_ciphers.size(); i++) {
+                m_ciphers[i]->release();
+            }
+        }
+        
+        void CipherTransform::addCipher(PacketCipher* cipher) {
+            cipher->retain();
+            m_ciphers.push_back(cipher);
+        }
+        
+        PacketCipher* CipherTransform::getCipher(int algorithm) {
+            for(size_t i = 0; i < m_ciphers.size(); i++) {
+                if(m_ciphers[i]->getAlgorithm() == algorithm)
+                    return m_ciphers[i];
+            }
+            return NULL;
+        }
+        
+        Packet* CipherTransform::encode(Packet* p) {
+            const Packet::Header& h = p->getHeader();
+            int algorithm = Packet::getEncryptAlgorithm(h.encryptAlgorithm);
+            PacketCipher* cipher = algorithm < 0 || p->getRaw() ? NULL : getCipher(algorithm);
+            if(!cipher) {
+                return p;
+            }
+            
+            // caller may still read a packet it didn't hand off, encrypt a copy
+            Packet* out = p;
+            if(!p->isExclusive()) {
+                out = new Packet();
+                if(!out->initWithHeader(h, p->getBody())) {
+                    out->release();
+                    return NULL;
+                }
+                out->setExclusive(true);
+            }
+            cipher->apply(out->getBuffer() + kPacketHeaderLength, h.length, m_client ? 0 : 1, m_sendSequence++);
+            return out;
+        }
+        
+        Packet* CipherTransform::decode(Packet* p) {
+            const Packet::Header& h = p->getHeader();
+            int algorithm = Packet::getEncryptAlgorithm(h.encryptAlgorithm);
+            PacketCipher* cipher = algorithm < 0 || p->getRaw() ? NULL : getCipher(algorithm);
+            if(!cipher) {
+                return p;
+            }
+            
+            // frame of an incoming slice belongs to this packet alone, decrypt where it lies
+            cipher->apply(p->getBuffer() + kPacketHeaderLength, h.length, m_client ? 1 : 0, m_receiveSequence++);
+            return p;
+        }
+        
+    }
+}
@@ -0,0 +1,174 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef __PacketTransform_h__
+#define __PacketTransform_h__
+
+#include "Packet.h"
+#include "PacketCodec.h"
+#include "PacketCipher.h"
+#include <vector>
+
+/// bodies shorter than this are sent uncompressed
+#define kCCCompressDefaultThreshold 256
+
+/// largest body a compressed packet may expand to
+#define kCCCompressDefaultMaxBodyLength (16 * 1024 * 1024)
+
+namespace funny {
+    namespace network {
+        
+        /**
+         * Stage of a PacketPipeline which changes packets on their way to and from the wire, e.g.
+         * compression. Stages run on I/O threads, one stage may serve several sockets at once.
+         * Both methods take the packet and return it changed in place, a new packet with one
+         * reference for caller which replaces it, or NULL to drop it.
+         */
+        class CC_DLL PacketTransform : public Ref {
+        public:
+            /// outgoing packet, called just before it is written
+            virtual Packet* encode(Packet* p) = 0;
+            
+            /// incoming packet, called before it is handed to hub
+            virtual Packet* decode(Packet* p) = 0;
+        };
+        
+        /**
+         * Ordered stages of a socket. Outgoing packets pass the stages in the order they were
+         * added and incoming packets pass them in reverse, so adding compression before
+         * encryption compresses plain bodies and decrypts before decompressing. Add stages before
+         * the pipeline is given to a socket.
+         */
+        class CC_DLL PacketPipeline : public Ref {
+        protected:
+            /// stages, retained
+            std::vector<PacketTransform*> m_stages;
+            
+        public:
+            virtual ~PacketPipeline();
+            
+            /// append stage, it is retained
+            void addStage(PacketTransform* stage);
+            
+            /// run outgoing stages, takes the reference of p and returns packet to send or NULL
+            Packet* encode(Packet* p);
+            
+            /// run incoming stages, takes the reference of p and returns packet to deliver or NULL
+            Packet* decode(Packet* p);
+        };
+        
+        /**
+         * Compresses bodies above a size threshold with a PacketCodec and records codec and
+         * dictionary id in the header, incoming bodies are decompressed by whichever added codec
+         * matches their header. Bodies which don't get smaller are sent as they are. Raw packets
+         * are not touched.
+         *
+         * For a dictionary per connection give each socket its own pipeline with a codec made
+         * from that dictionary; the peer must have the same dictionary under the same id.
+         * Compressed body is the little endian uint32 original length followed by codec data.
+         *
+         * @code
+         * CompressTransform* compress = new CompressTransform();
+         * LZCodec* codec = new LZCodec(sampleJson, 1);
+         * compress->addCodec(codec);
+         * codec->release();
+         * PacketPipeline* pipeline = new PacketPipeline();
+         * pipeline->addStage(compress);
+         * compress->release();
+         * hub->setPacketPipeline(pipeline);
+         * pipeline->release();
+         * @endcode
+         */
+        class CC_DLL CompressTransform : public PacketTransform {
+        protected:
+            /// codecs, retained, first one compresses outgoing bodies
+            std::vector<PacketCodec*> m_codecs;
+            
+        public:
+            CompressTransform();
+            virtual ~CompressTransform();
+            
+            /// add codec, first codec added is used for outgoing packets. Add codecs before use
+            void addCodec(PacketCodec* codec);
+            
+            /// codec of id and dictionary id, NULL if none was added
+            PacketCodec* getCodec(int id, int dictionaryId);
+            
+            virtual Packet* encode(Packet* p);
+            virtual Packet* decode(Packet* p);
+            
+            /// bodies shorter than this are sent uncompressed
+            CC_SYNTHESIZE(int, m_threshold, Threshold);
+            
+            /// incoming packets claiming a longer original body are dropped
+            CC_SYNTHESIZE(int, m_maxBodyLength, MaxBodyLength);
+        };
+        
+        /**
+         * Encrypts bodies of packets whose header names the encrypt algorithm of an added cipher,
+         * e.g. initWithJson(..., kCCEncryptChaCha20), and decrypts incoming bodies the same way.
+         * Incoming bodies are decrypted in place. Outgoing bodies are encrypted in place only when
+         * the packet is exclusive, i.e. it was handed off with sendPacket(p, true) or made by an
+         * earlier stage such as CompressTransform; any other packet, e.g. one sent to a group, is
+         * copied first because its owner may still read it. Header keeps its algorithm so handlers
+         * can tell the body came encrypted. Packets with another algorithm and raw packets pass
+         * unchanged.
+         *
+         * Each packet is keyed by direction and its number in that direction, so the stage counts
+         * packets of one connection: give every socket its own pipeline and transform, made with
+         * the session key. Add it after CompressTransform so compressed bodies get encrypted.
+         * There is no authentication, pair it with a MAC if the peer isn't trusted.
+         */
+        class CC_DLL CipherTransform : public PacketTransform {
+        protected:
+            /// ciphers, retained
+            std::vector<PacketCipher*> m_ciphers;
+            
+            /// true on client side, picks key stream of each direction
+            bool m_client;
+            
+            /// number of next outgoing encrypted packet
+            uint64_t m_sendSequence;
+            
+            /// number of next incoming encrypted packet
+            uint64_t m_receiveSequence;
+            
+        public:
+            /// @param client true on client side, server side passes false
+            CipherTransform(bool client = true);
+            virtual ~CipherTransform();
+            
+            /// add cipher for its algorithm id. Add ciphers before use
+            void addCipher(PacketCipher* cipher);
+            
+            /// cipher of encrypt algorithm, NULL if none was added
+            PacketCipher* getCipher(int algorithm);
+            
+            virtual Packet* encode(Packet* p);
+            virtual Packet* decode(Packet* p);
+        };
+        
+    }
+}
+
+#endif //__PacketTransform_h__
@@ -0,0 +1,89 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+#include "PacketValue.h"
+#include "json/document.h"
+
+USING_NS_CC;
+
+namespace funny {
+    namespace network {
+        
+        namespace {
+            
+            Value toValue(const rapidjson::Value& v) {
+                if(v.IsObject()) {
+                    ValueMap map;
+                    for(auto m = v.MemberBegin(); m != v.MemberEnd(); ++m) {
+                        map[m->name.GetString()] = toValue(m->value);
+                    }
+                    return Value(map);
+                } else if(v.IsArray()) {
+                    ValueVector vec;
+                    vec.reserve(v.Size());
+                    for(rapidjson::SizeType i = 0; i < v.Size(); i++) {
+                        vec.push_back(toValue(v[i]));
+                    }
+                    return Value(vec);
+                } else if(v.IsString()) {
+                    return Value(std::string(v.GetString(), v.GetStringLength()));
+                } else if(v.IsBool()) {
+                    return Value(v.GetBool());
+                } else if(v.IsInt()) {
+                    return Value(v.GetInt());
+                } else if(v.IsNumber()) {
+                    return Value(v.GetDouble());
+                }
+                return Value::Null;
+            }
+        }
+        
+        Ref* PacketValue::decodeJson(Packet* packet) {
+            if(packet->getRaw() || packet->getBodyLength() <= 0) {
+                return NULL;
+            }
+            
+            // rapidjson wants a zero terminated string, slices don't have one
+            std::string copy;
+            const char* json = packet->getBody();
+            if(packet->isSlice()) {
+                copy.assign(json, packet->getBodyLength());
+                json = copy.c_str();
+            }
+            
+            rapidjson::Document doc;
+            doc.Parse<0>(json);
+            if(doc.HasParseError()) {
+                return NULL;
+            }
+            
+            PacketValue* v = new PacketValue();
+            v->m_value = toValue(doc);
+            return v;
+        }
+        
+        PacketValue* PacketValue::fromPacket(Packet* packet) {
+            return dynamic_cast<PacketValue*>(packet->getDecoded());
+        }
+        
+    }
+}
@@ -0,0 +1,69 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef __PacketValue_h__
+#define __PacketValue_h__
+
+#include "cocos2d.h"
+#include "Packet.h"
+
+namespace funny {
+    namespace network {
+        
+        /**
+         * cocos2d::Value parsed from json body of a packet, made off cocos thread by a hub packet
+         * decoder. Cocos builds only.
+         *
+         * @code
+         * hub->setPacketDecoder(PacketValue::decodeJson, 2);
+         * ...
+         * PacketValue* v = PacketValue::fromPacket(packet);
+         * if(v)
+         *     onState(v->getValue().asValueMap());
+         * @endcode
+         */
+        class CC_DLL PacketValue : public Ref {
+        protected:
+            /// parsed body
+            cocos2d::Value m_value;
+            
+        public:
+            /// parsed body, Value::Null if body was not json
+            const cocos2d::Value& getValue() { return m_value; }
+            
+            /**
+             * hub packet decoder, parses json body of a standard packet with rapidjson
+             *
+             * @param packet received packet
+             * @return new PacketValue with one reference, NULL for raw packets or invalid json
+             */
+            static Ref* decodeJson(Packet* packet);
+            
+            /// value attached to packet by decodeJson, NULL if there is none
+            static PacketValue* fromPacket(Packet* packet);
+        };
+        
+    }
+}
+
+#endif //__PacketValue_h__
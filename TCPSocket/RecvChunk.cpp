@@ -0,0 +1,87 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+#include "RecvChunk.h"
+#include "BufferPool.h"
+
+#include <new>
+#include <string.h>
+
+namespace funny {
+    namespace network {
+        
+        RecvChunk::RecvChunk() :
+        m_refCount(1),
+        m_data(NULL),
+        m_capacity(0),
+        m_readPos(0),
+        m_writePos(0) {
+        }
+        
+        RecvChunk::~RecvChunk() {
+            BufferPool::getInstance()->free(m_data, m_capacity);
+        }
+        
+        RecvChunk* RecvChunk::create(size_t capacity) {
+            RecvChunk* c = new (std::nothrow) RecvChunk();
+            if(!c) {
+                return NULL;
+            }
+            c->m_data = BufferPool::getInstance()->allocate(capacity, c->m_capacity);
+            if(!c->m_data) {
+                delete c;
+                return NULL;
+            }
+            return c;
+        }
+        
+        void RecvChunk::retain() {
+            m_refCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        
+        void RecvChunk::release() {
+            if(m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete this;
+            }
+        }
+        
+        void RecvChunk::consume(size_t n) {
+            m_readPos += n;
+            
+            // nobody looks at consumed bytes, reuse whole chunk
+            if(m_readPos == m_writePos && !isShared()) {
+                m_readPos = m_writePos = 0;
+            }
+        }
+        
+        void RecvChunk::compact() {
+            size_t n = readable();
+            if(m_readPos > 0) {
+                memmove(m_data, m_data + m_readPos, n);
+            }
+            m_readPos = 0;
+            m_writePos = n;
+        }
+        
+    }
+}
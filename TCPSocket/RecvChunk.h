@@ -0,0 +1,110 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+#ifndef __RecvChunk_h__
+#define __RecvChunk_h__
+
+#include <atomic>
+#include <stddef.h>
+
+namespace funny {
+    namespace network {
+        
+        /**
+         * Reference counted block of received bytes. In zero copy mode a socket reads into a chunk
+         * and every complete frame becomes a packet pointing into it, each packet holds a reference.
+         * The chunk goes back to buffer pool when socket and all packets have released it.
+         *
+         * Reference count is atomic because packets are released on cocos thread while socket
+         * owns the chunk on its I/O thread.
+         */
+        class RecvChunk {
+        private:
+            /// references
+            std::atomic<int> m_refCount;
+            
+            /// memory from buffer pool
+            char* m_data;
+            
+            /// size of m_data
+            size_t m_capacity;
+            
+            /// first unread byte
+            size_t m_readPos;
+            
+            /// end of received bytes
+            size_t m_writePos;
+            
+        private:
+            RecvChunk();
+            ~RecvChunk();
+            RecvChunk(const RecvChunk&);
+            RecvChunk& operator=(const RecvChunk&);
+            
+        public:
+            /**
+             * create chunk with reference count 1
+             *
+             * @param capacity size in bytes
+             * @return chunk or NULL if out of memory
+             */
+            static RecvChunk* create(size_t capacity);
+            
+            /// add a reference
+            void retain();
+            
+            /// drop a reference, chunk is freed by last one
+            void release();
+            
+            /// true if packets still point into chunk, only the owning socket may rely on false
+            bool isShared() { return m_refCount.load(std::memory_order_acquire) > 1; }
+            
+            /// start of unread bytes
+            char* readPtr() { return m_data + m_readPos; }
+            
+            /// number of unread bytes
+            size_t readable() { return m_writePos - m_readPos; }
+            
+            /// drop bytes from read side, they may still be referenced by packets
+            void consume(size_t n);
+            
+            /// size of chunk memory
+            size_t capacity() { return m_capacity; }
+            
+            /// free bytes after write position
+            size_t writable() { return m_capacity - m_writePos; }
+            
+            /// where next bytes should be written
+            char* writePtr() { return m_data + m_writePos; }
+            
+            /// mark bytes written at writePtr() as readable
+            void commit(size_t n) { m_writePos += n; }
+            
+            /// move unread bytes to front, only valid if chunk is not shared
+            void compact();
+        };
+        
+    }
+}
+
+#endif //__RecvChunk_h__
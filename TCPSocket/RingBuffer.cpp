@@ -0,0 +1,175 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+#include "RingBuffer.h"
+#include "BufferPool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+namespace funny {
+    namespace network {
+        
+        RingBuffer::RingBuffer() :
+        m_base(NULL),
+        m_capacity(0),
+        m_readPos(0),
+        m_writePos(0),
+        m_mirrored(false) {
+        }
+        
+        RingBuffer::~RingBuffer() {
+            destroy();
+        }
+        
+        bool RingBuffer::init(size_t capacity, bool mirrored) {
+            destroy();
+            
+            if(!mirrored || !mapMirror(capacity)) {
+                m_base = BufferPool::getInstance()->allocate(capacity, m_capacity);
+                if(!m_base) {
+                    m_capacity = 0;
+                    return false;
+                }
+                m_mirrored = false;
+            }
+            m_readPos = m_writePos = 0;
+            return true;
+        }
+        
+        bool RingBuffer::resize(size_t capacity) {
+            size_t n = readable();
+            if(capacity < n) {
+                return false;
+            }
+            if(!m_base) {
+                return init(capacity, false);
+            }
+            
+            RingBuffer tmp;
+            if(!tmp.init(capacity, m_mirrored)) {
+                return false;
+            }
+            memcpy(tmp.m_base, readPtr(), n);
+            tmp.m_writePos = n;
+            
+            // swap, tmp frees old memory
+            char* base = m_base;
+            size_t cap = m_capacity;
+            bool mirror = m_mirrored;
+            m_base = tmp.m_base;
+            m_capacity = tmp.m_capacity;
+            m_mirrored = tmp.m_mirrored;
+            m_readPos = 0;
+            m_writePos = n;
+            tmp.m_base = base;
+            tmp.m_capacity = cap;
+            tmp.m_mirrored = mirror;
+            return true;
+        }
+        
+        bool RingBuffer::mapMirror(size_t capacity) {
+#if defined(__linux__) && defined(SYS_memfd_create)
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            capacity = (capacity + page - 1) / page * page;
+            
+            // not every libc has a wrapper, android below api 30 for example
+            int fd = (int)syscall(SYS_memfd_create, "TCPSocketRing", 0);
+            if(fd == -1) {
+                return false;
+            }
+            if(ftruncate(fd, capacity) != 0) {
+                close(fd);
+                return false;
+            }
+            
+            // reserve address range, then map the file twice into it
+            char* base = (char*)mmap(NULL, capacity * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(base == MAP_FAILED) {
+                close(fd);
+                return false;
+            }
+            if(mmap(base, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+               mmap(base + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+                munmap(base, capacity * 2);
+                close(fd);
+                return false;
+            }
+            close(fd);
+            
+            m_base = base;
+            m_capacity = capacity;
+            m_mirrored = true;
+            return true;
+#else
+            return false;
+#endif
+        }
+        
+        void RingBuffer::destroy() {
+            if(m_base) {
+                if(m_mirrored) {
+                    munmap(m_base, m_capacity * 2);
+                } else {
+                    BufferPool::getInstance()->free(m_base, m_capacity);
+                }
+            }
+            m_base = NULL;
+            m_capacity = 0;
+            m_readPos = m_writePos = 0;
+            m_mirrored = false;
+        }
+        
+        void RingBuffer::consume(size_t n) {
+            m_readPos += n;
+            if(m_readPos == m_writePos) {
+                // empty, restart at front so flat buffer never needs to compact
+                m_readPos = m_writePos = 0;
+            } else if(m_mirrored && m_readPos >= m_capacity) {
+                m_readPos -= m_capacity;
+                m_writePos -= m_capacity;
+            }
+        }
+        
+        size_t RingBuffer::prepareWrite() {
+            if(m_mirrored) {
+                return m_capacity - readable();
+            }
+            
+            // flat buffer, move unread bytes to front only when tail is used up
+            if(m_writePos == m_capacity && m_readPos > 0) {
+                size_t n = readable();
+                memmove(m_base, m_base + m_readPos, n);
+                m_readPos = 0;
+                m_writePos = n;
+            }
+            return m_capacity - m_writePos;
+        }
+        
+    }
+}
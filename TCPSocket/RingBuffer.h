@@ -0,0 +1,127 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+#ifndef __RingBuffer_h__
+#define __RingBuffer_h__
+
+#include <stddef.h>
+
+namespace funny {
+    namespace network {
+        
+        /**
+         * Byte ring used as socket read buffer. Readable and writable regions are always
+         * contiguous so a frame can be parsed in place and consuming it is a pointer bump.
+         *
+         * A mirrored buffer maps the same memory twice back to back (memfd + mmap, Linux only), so
+         * a region that wraps past the end continues in the second mapping. A flat buffer comes from
+         * BufferPool and moves unread bytes to the front only when the tail is used up; it is also
+         * the fallback where mirroring is not possible.
+         */
+        class RingBuffer {
+        private:
+            /// start of mapping or heap buffer
+            char* m_base;
+            
+            /// usable size
+            size_t m_capacity;
+            
+            /// read offset, less than capacity
+            size_t m_readPos;
+            
+            /// write offset, read offset plus readable bytes, less than 2 * capacity if mirrored
+            size_t m_writePos;
+            
+            /// true if memory is double mapped
+            bool m_mirrored;
+            
+        private:
+            RingBuffer(const RingBuffer&);
+            RingBuffer& operator=(const RingBuffer&);
+            
+            /// try to create double mapping of given size
+            bool mapMirror(size_t capacity);
+            
+        public:
+            RingBuffer();
+            ~RingBuffer();
+            
+            /**
+             * allocate memory, previous content is dropped
+             *
+             * @param capacity size in bytes, rounded up to page size when mirrored and to size class
+             * when flat
+             * @param mirrored true means double map memory if possible
+             * @return false if memory can't be allocated
+             */
+            bool init(size_t capacity, bool mirrored = true);
+            
+            /**
+             * move unread bytes to a buffer of another size, same kind as current one
+             *
+             * @param capacity new size, not less than readable bytes
+             * @return false if memory can't be allocated, buffer is unchanged then
+             */
+            bool resize(size_t capacity);
+            
+            /// free memory
+            void destroy();
+            
+            /// true if init succeeded and destroy is not called
+            bool isValid() { return m_base != NULL; }
+            
+            /// buffer size
+            size_t capacity() { return m_capacity; }
+            
+            /// true if buffer is double mapped
+            bool isMirrored() { return m_mirrored; }
+            
+            /// contiguous bytes which can be written at writePtr() without compacting
+            size_t writable() { return m_mirrored ? m_capacity - readable() : m_capacity - m_writePos; }
+            
+            /// start of unread bytes
+            char* readPtr() { return m_base + m_readPos; }
+            
+            /// number of unread bytes
+            size_t readable() { return m_writePos - m_readPos; }
+            
+            /// drop bytes from read side
+            void consume(size_t n);
+            
+            /**
+             * make room at write side, flat buffer is compacted here if tail is full
+             *
+             * @return contiguous bytes which can be written at writePtr()
+             */
+            size_t prepareWrite();
+            
+            /// where next bytes should be written
+            char* writePtr() { return m_base + m_writePos; }
+            
+            /// mark bytes written at writePtr() as readable
+            void commit(size_t n) { m_writePos += n; }
+        };
+        
+    }
+}
+
+#endif //__RingBuffer_h__
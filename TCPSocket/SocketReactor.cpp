@@ -0,0 +1,469 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+#include "SocketReactor.h"
+#include "TCPSocket.h"
+#include "TCPSocketHub.h"
+
+#include <unistd.h>
+#include <time.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#define CC_SOCKET_REACTOR_EPOLL 1
+#elif defined(__APPLE__)
+#include <sys/event.h>
+#define CC_SOCKET_REACTOR_KQUEUE 1
+#else
+#error "SocketReactor needs epoll or kqueue"
+#endif
+
+USING_NS_CC;
+
+namespace funny {
+    namespace network {
+        
+        SocketReactor::SocketReactor() :
+        m_pollFd(-1),
+        m_wakeFd(-1),
+        m_running(false),
+        m_cpu(-1),
+        m_load(0) {
+            pthread_mutex_init(&m_mutex, NULL);
+        }
+        
+        SocketReactor::~SocketReactor() {
+            stop();
+            if(m_wakeFd != -1) {
+                close(m_wakeFd);
+            }
+            if(m_pollFd != -1) {
+                close(m_pollFd);
+            }
+            pthread_mutex_destroy(&m_mutex);
+        }
+        
+        SocketReactor* SocketReactor::create() {
+            SocketReactor* r = new SocketReactor();
+            return (SocketReactor*)r->autorelease();
+        }
+        
+        bool SocketReactor::start(int cpu) {
+            if(m_running) {
+                return true;
+            }
+            m_cpu = cpu;
+
+#if CC_SOCKET_REACTOR_EPOLL
+            if(m_pollFd == -1) {
+                m_pollFd = epoll_create1(EPOLL_CLOEXEC);
+                if(m_pollFd == -1) {
+                    CCLOG("SocketReactor: epoll_create1 failed: %d", errno);
+                    return false;
+                }
+                m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                if(m_wakeFd == -1) {
+                    CCLOG("SocketReactor: eventfd failed: %d", errno);
+                    return false;
+                }
+                
+                // wakeup event carries a NULL socket
+                epoll_event ev;
+                memset(&ev, 0, sizeof(ev));
+                ev.events = EPOLLIN | EPOLLET;
+                ev.data.ptr = NULL;
+                if(epoll_ctl(m_pollFd, EPOLL_CTL_ADD, m_wakeFd, &ev) == -1) {
+                    return false;
+                }
+            }
+#elif CC_SOCKET_REACTOR_KQUEUE
+            if(m_pollFd == -1) {
+                m_pollFd = kqueue();
+                if(m_pollFd == -1) {
+                    CCLOG("SocketReactor: kqueue failed: %d", errno);
+                    return false;
+                }
+                
+                // wakeup event carries a NULL socket
+                struct kevent kev;
+                EV_SET(&kev, 0, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, NULL);
+                if(kevent(m_pollFd, &kev, 1, NULL, 0, NULL) == -1) {
+                    return false;
+                }
+            }
+#endif
+            
+            m_running = true;
+            if(pthread_create(&m_thread, NULL, reactorThreadEntry, (void*)this) != 0) {
+                m_running = false;
+                return false;
+            }
+            
+            CCLOG("SocketReactor: started");
+            return true;
+        }
+        
+        void SocketReactor::stop() {
+            if(!m_running) {
+                return;
+            }
+            
+            // let thread exit, after join we own every socket
+            m_running = false;
+            signal();
+            pthread_join(m_thread, NULL);
+            
+            for(auto s : m_sockets) {
+                unwatch(s);
+                s->closeSocket();
+                s->closeSendQueue();
+                s->releaseInput();
+                s->m_reactor = NULL;
+                s->release();
+            }
+            m_sockets.clear();
+            m_connecting.clear();
+            
+            pthread_mutex_lock(&m_mutex);
+            for(auto s : m_pendingAdds) {
+                s->closeSocket();
+                s->closeSendQueue();
+                s->m_reactor = NULL;
+                s->release();
+            }
+            m_pendingAdds.clear();
+            for(auto s : m_pendingWakeups) {
+                s->m_wakeupPending = false;
+                s->release();
+            }
+            m_pendingWakeups.clear();
+            pthread_mutex_unlock(&m_mutex);
+            m_load = 0;
+            
+            CCLOG("SocketReactor: stopped");
+        }
+        
+        void SocketReactor::add(TCPSocket* s) {
+            // hold it until it is detached from reactor
+            CC_SAFE_RETAIN(s);
+            s->m_reactor = this;
+            m_load++;
+            
+            pthread_mutex_lock(&m_mutex);
+            m_pendingAdds.push_back(s);
+            pthread_mutex_unlock(&m_mutex);
+            
+            signal();
+        }
+        
+        void SocketReactor::wakeup(TCPSocket* s) {
+            // already queued, reactor will see latest state anyway
+            if(s->m_wakeupPending.exchange(true)) {
+                return;
+            }
+            
+            CC_SAFE_RETAIN(s);
+            pthread_mutex_lock(&m_mutex);
+            m_pendingWakeups.push_back(s);
+            pthread_mutex_unlock(&m_mutex);
+            
+            signal();
+        }
+        
+        void* SocketReactor::reactorThreadEntry(void* arg) {
+            SocketReactor* r = (SocketReactor*)arg;
+            r->bindThread();
+            r->loop();
+            return NULL;
+        }
+        
+        void SocketReactor::bindThread() {
+            if(m_cpu < 0) {
+                return;
+            }
+#if defined(__linux__)
+            // sched_setaffinity with pid 0 applies to calling thread, android has no pthread variant
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(m_cpu, &set);
+            if(sched_setaffinity(0, sizeof(set), &set) != 0) {
+                CCLOG("SocketReactor: failed to bind thread to cpu %d: %d", m_cpu, errno);
+            }
+#else
+            CCLOG("SocketReactor: thread binding is not supported on this platform");
+#endif
+        }
+        
+        void SocketReactor::loop() {
+            Event events[kCCSocketReactorMaxEvents];
+            while(m_running) {
+                int timeout = checkConnectTimeouts();
+                int n = waitEvents(events, kCCSocketReactorMaxEvents, timeout);
+                for(int i = 0; i < n; i++) {
+                    if(events[i].socket) {
+                        handleEvent(events[i]);
+                    } else {
+                        drainSignal();
+                    }
+                }
+                processPending();
+            }
+        }
+        
+        int SocketReactor::waitEvents(Event* events, int maxEvents, int timeoutMs) {
+#if CC_SOCKET_REACTOR_EPOLL
+            epoll_event evs[kCCSocketReactorMaxEvents];
+            int n = epoll_wait(m_pollFd, evs, MIN(maxEvents, kCCSocketReactorMaxEvents), timeoutMs);
+            if(n < 0) {
+                return errno == EINTR ? 0 : -1;
+            }
+            for(int i = 0; i < n; i++) {
+                uint32_t f = evs[i].events;
+                events[i].socket = (TCPSocket*)evs[i].data.ptr;
+                events[i].error = (f & EPOLLERR) != 0;
+                events[i].readable = (f & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0;
+                events[i].writable = (f & EPOLLOUT) != 0;
+            }
+            return n;
+#elif CC_SOCKET_REACTOR_KQUEUE
+            struct kevent kevs[kCCSocketReactorMaxEvents];
+            timespec ts;
+            timespec* tsp = NULL;
+            if(timeoutMs >= 0) {
+                ts.tv_sec = timeoutMs / 1000;
+                ts.tv_nsec = (timeoutMs % 1000) * 1000000;
+                tsp = &ts;
+            }
+            int n = kevent(m_pollFd, NULL, 0, kevs, MIN(maxEvents, kCCSocketReactorMaxEvents), tsp);
+            if(n < 0) {
+                return errno == EINTR ? 0 : -1;
+            }
+            for(int i = 0; i < n; i++) {
+                events[i].socket = (TCPSocket*)kevs[i].udata;
+                events[i].error = (kevs[i].flags & EV_ERROR) != 0;
+                events[i].readable = kevs[i].filter == EVFILT_READ || (kevs[i].flags & (EV_EOF | EV_ERROR)) != 0;
+                events[i].writable = kevs[i].filter == EVFILT_WRITE;
+            }
+            return n;
+#endif
+        }
+        
+        bool SocketReactor::watch(TCPSocket* s) {
+#if CC_SOCKET_REACTOR_EPOLL
+            epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.ptr = s;
+            return epoll_ctl(m_pollFd, EPOLL_CTL_ADD, s->m_socket, &ev) == 0;
+#elif CC_SOCKET_REACTOR_KQUEUE
+            struct kevent kev[2];
+            EV_SET(&kev[0], s->m_socket, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, s);
+            EV_SET(&kev[1], s->m_socket, EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, 0, s);
+            return kevent(m_pollFd, kev, 2, NULL, 0, NULL) == 0;
+#endif
+        }
+        
+        void SocketReactor::unwatch(TCPSocket* s) {
+            if(s->m_socket == kCCSocketInvalid) {
+                return;
+            }
+#if CC_SOCKET_REACTOR_EPOLL
+            epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            epoll_ctl(m_pollFd, EPOLL_CTL_DEL, s->m_socket, &ev);
+#elif CC_SOCKET_REACTOR_KQUEUE
+            struct kevent kev[2];
+            EV_SET(&kev[0], s->m_socket, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+            EV_SET(&kev[1], s->m_socket, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+            kevent(m_pollFd, kev, 2, NULL, 0, NULL);
+#endif
+        }
+        
+        void SocketReactor::signal() {
+#if CC_SOCKET_REACTOR_EPOLL
+            if(m_wakeFd != -1) {
+                uint64_t one = 1;
+                ssize_t ret = write(m_wakeFd, &one, sizeof(one));
+                (void)ret;
+            }
+#elif CC_SOCKET_REACTOR_KQUEUE
+            if(m_pollFd != -1) {
+                struct kevent kev;
+                EV_SET(&kev, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+                kevent(m_pollFd, &kev, 1, NULL, 0, NULL);
+            }
+#endif
+        }
+        
+        void SocketReactor::drainSignal() {
+#if CC_SOCKET_REACTOR_EPOLL
+            uint64_t count;
+            while(read(m_wakeFd, &count, sizeof(count)) > 0);
+#endif
+        }
+        
+        void SocketReactor::processPending() {
+            std::vector<TCPSocket*> adds;
+            std::vector<TCPSocket*> wakeups;
+            pthread_mutex_lock(&m_mutex);
+            adds.swap(m_pendingAdds);
+            wakeups.swap(m_pendingWakeups);
+            pthread_mutex_unlock(&m_mutex);
+            
+            // new sockets, start connecting
+            for(auto s : adds) {
+                if(s->m_stop || !s->startConnect() || !watch(s)) {
+                    s->closeSocket();
+                    s->closeSendQueue();
+                    TCPSocketHub* hub = s->m_hub;
+                    if(hub)
+                        hub->onSocketFailedThreadSafe(s);
+                    s->m_reactor = NULL;
+                    s->release();
+                    m_load--;
+                    continue;
+                }
+                m_sockets.insert(s);
+                m_connecting.push_back(s);
+            }
+            
+            // flush queued packets or close stopped sockets
+            for(auto s : wakeups) {
+                // clear flag first so that later sendPacket calls queue a new wakeup
+                s->m_wakeupPending = false;
+                if(m_sockets.count(s)) {
+                    if(s->m_stop) {
+                        detach(s);
+                    } else if(!s->m_connected) {
+                        // nothing is sent before connect, only keep queue within its limits
+                        s->trimSendQueue();
+                    } else if(!s->flushSendQueue() || !s->resumeReading()) {
+                        detach(s);
+                    }
+                }
+                s->release();
+            }
+        }
+        
+        void SocketReactor::handleEvent(const Event& e) {
+            TCPSocket* s = e.socket;
+            
+            // socket may be detached by an earlier event of same batch
+            if(!m_sockets.count(s)) {
+                return;
+            }
+            
+            if(s->m_stop) {
+                detach(s);
+                return;
+            }
+            
+            // connecting socket, writable or error means connect is done
+            if(!s->m_connected) {
+                if(!e.writable && !e.error && !e.readable) {
+                    return;
+                }
+                m_connecting.erase(std::remove(m_connecting.begin(), m_connecting.end(), s), m_connecting.end());
+                if(!s->finishConnect()) {
+                    detach(s);
+                    return;
+                }
+                
+                // flush packets queued before connected
+                if(!s->flushSendQueue()) {
+                    detach(s);
+                    return;
+                }
+            }
+            
+            // edge triggered, socket must be drained until EAGAIN
+            if(e.readable && !s->onReadable()) {
+                detach(s);
+                return;
+            }
+            if(e.writable && !s->flushSendQueue()) {
+                detach(s);
+                return;
+            }
+        }
+        
+        int SocketReactor::checkConnectTimeouts() {
+            if(m_connecting.empty()) {
+                return -1;
+            }
+            
+            int64_t now = SocketReactor::now();
+            int64_t next = -1;
+            std::vector<TCPSocket*> expired;
+            for(auto s : m_connecting) {
+                if(s->m_connectDeadline <= 0) {
+                    continue;
+                }
+                if(s->m_connectDeadline <= now) {
+                    expired.push_back(s);
+                } else if(next < 0 || s->m_connectDeadline - now < next) {
+                    next = s->m_connectDeadline - now;
+                }
+            }
+            for(auto s : expired) {
+                CCLOG("SocketReactor: socket %d connect timeout", s->getSocket());
+                detach(s);
+            }
+            return (int)next;
+        }
+        
+        void SocketReactor::detach(TCPSocket* s) {
+            unwatch(s);
+            m_sockets.erase(s);
+            m_connecting.erase(std::remove(m_connecting.begin(), m_connecting.end(), s), m_connecting.end());
+            
+            bool wasConnected = s->m_connected;
+            s->closeSocket();
+            
+            // later sendPacket calls fail instead of queueing for a closed socket
+            s->closeSendQueue();
+            s->releaseInput();
+            
+            // hub removes socket either way, only a connected one gets a disconnected event
+            TCPSocketHub* hub = s->m_hub;
+            if(wasConnected) {
+                if(hub)
+                    hub->onSocketDisconnectedThreadSafe(s);
+                s->m_connected = false;
+            } else if(hub) {
+                hub->onSocketFailedThreadSafe(s);
+            }
+            
+            s->m_reactor = NULL;
+            s->release();
+            m_load--;
+        }
+        
+        int64_t SocketReactor::now() {
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+        }
+    }
+}
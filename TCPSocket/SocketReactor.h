@@ -0,0 +1,176 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+#ifndef __SocketReactor_h__
+#define __SocketReactor_h__
+
+#include "NetworkConfig.h"
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+#include <unordered_set>
+
+/// max readiness events handled by one wait call
+#define kCCSocketReactorMaxEvents 64
+
+namespace funny {
+    namespace network {
+        
+        class TCPSocket;
+        
+        /**
+         * Event loop shared by all sockets of a hub. It waits for readiness with edge-triggered
+         * epoll (kqueue on Apple platforms) in one thread, so an idle socket costs nothing and
+         * a ready one is served as soon as the kernel reports it.
+         *
+         * All socket I/O happens in the reactor thread. Other threads talk to it through
+         * add() and wakeup(), which only queue work and signal the loop.
+         */
+        class CC_DLL SocketReactor : public Ref {
+        private:
+            /// readiness of one socket, normalized across backends
+            typedef struct {
+                TCPSocket* socket;
+                bool readable;
+                bool writable;
+                bool error;
+            } Event;
+            
+            /// epoll or kqueue handle
+            int m_pollFd;
+            
+            /// eventfd used to interrupt wait, -1 when backend has a native user event
+            int m_wakeFd;
+            
+            /// reactor thread
+            pthread_t m_thread;
+            
+            /// true between start() and stop()
+            std::atomic<bool> m_running;
+            
+            /// cpu the reactor thread is bound to, -1 means not bound
+            int m_cpu;
+            
+            /// number of sockets added and not yet detached
+            std::atomic<int> m_load;
+            
+            /// guards pending lists
+            pthread_mutex_t m_mutex;
+            
+            /// sockets waiting to be registered, retained
+            std::vector<TCPSocket*> m_pendingAdds;
+            
+            /// sockets which have new packets to send or are requested to stop
+            std::vector<TCPSocket*> m_pendingWakeups;
+            
+            /// registered sockets, retained, only touched by reactor thread
+            std::unordered_set<TCPSocket*> m_sockets;
+            
+            /// registered sockets still waiting for connect result
+            std::vector<TCPSocket*> m_connecting;
+            
+        private:
+            static void* reactorThreadEntry(void* arg);
+            
+            /// event loop body
+            void loop();
+            
+            /// wait for readiness, return event count or -1
+            int waitEvents(Event* events, int maxEvents, int timeoutMs);
+            
+            /// register socket fd to poller
+            bool watch(TCPSocket* s);
+            
+            /// remove socket fd from poller
+            void unwatch(TCPSocket* s);
+            
+            /// bind calling thread to m_cpu
+            void bindThread();
+            
+            /// interrupt waitEvents from another thread
+            void signal();
+            
+            /// consume signal in reactor thread
+            void drainSignal();
+            
+            /// register new sockets and serve wakeup requests
+            void processPending();
+            
+            /// serve one readiness event
+            void handleEvent(const Event& e);
+            
+            /// close sockets whose connect timed out, return ms to next deadline or -1
+            int checkConnectTimeouts();
+            
+            /// unregister, close socket and report it to its hub
+            void detach(TCPSocket* s);
+            
+        public:
+            SocketReactor();
+            virtual ~SocketReactor();
+            
+            /// create a reactor, it must be started before use
+            static SocketReactor* create();
+            
+            /**
+             * create poller and start reactor thread
+             *
+             * @param cpu cpu index the thread is bound to, -1 means let scheduler decide
+             * @return true means reactor is running
+             */
+            bool start(int cpu = -1);
+            
+            /**
+             * stop reactor thread and wait until it exits. All sockets still registered are
+             * closed, no disconnected notification is sent for them.
+             */
+            void stop();
+            
+            /**
+             * hand a socket to reactor, it will be connected and served in reactor thread.
+             * Thread safe.
+             */
+            void add(TCPSocket* s);
+            
+            /**
+             * tell reactor that a socket has something to do: packets queued or stop requested.
+             * Thread safe.
+             */
+            void wakeup(TCPSocket* s);
+            
+            /// is reactor thread running
+            bool isRunning() { return m_running; }
+            
+            /// true if called on reactor thread
+            bool isReactorThread() { return m_running && pthread_equal(pthread_self(), m_thread); }
+            
+            /// number of sockets served by this reactor
+            int getLoad() { return m_load; }
+            
+            /// monotonic clock in milliseconds
+            static int64_t now();
+        };
+        
+    }
+}
+
+#endif //__SocketReactor_h__
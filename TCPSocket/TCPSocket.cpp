@@ -26,8 +26,15 @@
 #include "TCPSocket.h"
 #include "Packet.h"
 #include "TCPSocketHub.h"
+#include "SocketReactor.h"
 
 #include <unistd.h>
+#include <time.h>
+#include <sched.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 
 USING_NS_CC;
 
@@ -35,16 +42,47 @@ namespace funny {
     namespace network {
         
         TCPSocket::TCPSocket() :
+        m_chunk(NULL),
+        m_zeroCopy(false),
+        m_hasFrameHeader(false),
+        m_largePacket(NULL),
+        m_largeFilled(0),
+        m_recvBufferSize(0),
+        m_recvPeak(0),
+        m_recvSmallReads(0),
+        m_reactor(NULL),
+        m_connectDeadline(0),
+        m_wakeupPending(false),
+        m_sendBatchCount(0),
+        m_sentBytes(0),
+        m_queuedBytes(0),
+        m_queuedPackets(0),
+        m_writable(true),
+        m_droppedPackets(0),
+        m_sendWaiters(0),
+        m_reportedWritable(true),
+        m_inputBytes(0),
+        m_readPaused(false),
+        m_stop(false),
+        m_senders(0),
+        m_hub(NULL),
+        m_pipeline(NULL),
         m_socket(kCCSocketInvalid),
-        m_connected(false),
-        m_stop(false) {
-            pthread_mutex_init(&m_mutex, NULL);
-            memset(m_inBuf, 0, sizeof(m_inBuf));
+        m_connected(false) {
+            pthread_mutex_init(&m_sendMutex, NULL);
+            pthread_cond_init(&m_sendCond, NULL);
         }
         
         TCPSocket::~TCPSocket() {
             closeSocket();
-            pthread_mutex_destroy(&m_mutex);
+            if(m_chunk) {
+                m_chunk->release();
+            }
+            CC_SAFE_RELEASE(m_largePacket);
+            dropSendQueue();
+            CC_SAFE_RELEASE(m_pipeline);
+            pthread_cond_destroy(&m_sendCond);
+            pthread_mutex_destroy(&m_sendMutex);
         }
         
         TCPSocket* TCPSocket::create(const std::string& hostname, int port, int tag, int blockSec, bool keepAlive) {
@@ -59,145 +97,469 @@ namespace funny {
         
         void TCPSocket::closeSocket() {
             if(m_socket != kCCSocketInvalid) {
+                // no SO_LINGER, close returns at once and kernel sends what is left in background.
+                // It runs on I/O threads and game thread, a lingering close would stall them
                 close(m_socket);
                 CCLOG("TCPSocket: socket closed: %d", m_socket);
                 m_socket = kCCSocketInvalid;
             }
         }
         
-        void TCPSocket::compactInBuf(int consumed) {
-            if(consumed < m_inBufLen) {
-                memmove(m_inBuf, m_inBuf + consumed, m_inBufLen - consumed);
-                m_inBufLen -= consumed;
-            } else {
-                m_inBufLen = 0;
+        bool TCPSocket::sendPacket(Packet* p, bool handOff) {
+            if(!handOff || !p) {
+                return enqueuePacket(p);
+            }
+            
+            // queue reference is the only one left once ours is released
+            p->setExclusive(true);
+            bool ok = enqueuePacket(p);
+            p->release();
+            return ok;
+        }
+        
+        bool TCPSocket::enqueuePacket(Packet* p) {
+            if(!p || m_stop) {
+                return false;
+            }
+            
+            size_t len = p->getPacketLength();
+            if(isSendQueueFull(len)) {
+                switch(m_sendQueueConfig.policy) {
+                    case SendOverflowPolicy::FAIL:
+                        return false;
+                    case SendOverflowPolicy::BLOCK:
+                        if(!waitForSendSpace(len)) {
+                            return false;
+                        }
+                        break;
+                    case SendOverflowPolicy::DROP_OLDEST:
+                        // queue is single consumer, I/O thread trims it after wakeup
+                        break;
+                }
+            }
+            
+            // socket may stop meanwhile, closeSendQueue waits for us so the packet is dropped with
+            // the rest and hub counter stays right
+            m_senders++;
+            if(m_stop) {
+                m_senders--;
+                return false;
+            }
+            
+            // queue holds a reference until packet is sent
+            TCPSocketHub* hub = m_hub;
+            p->retain();
+            size_t queued = m_queuedBytes += len;
+            m_queuedPackets++;
+            if(hub)
+                hub->m_queuedBytes += len;
+            m_sendQueue.push(p);
+            m_senders--;
+            
+            // crossed high watermark, I/O thread reports the way back after this wakeup
+            size_t high = m_sendQueueConfig.highWatermark;
+            if(high > 0 && queued > high && m_writable.exchange(false) && hub) {
+                hub->onSocketWritabilityChangedThreadSafe(this);
+            }
+            
+            SocketReactor* reactor = m_reactor;
+            if(reactor)
+                reactor->wakeup(this);
+            return true;
+        }
+        
+        bool TCPSocket::isSendQueueFull(size_t len) {
+            TCPSocketHub* hub = m_hub;
+            // hub sheds load while it is over its memory limit
+            if(hub && hub->isSheddingLoad()) {
+                return true;
+            }
+            
+            const SendQueueConfig& c = m_sendQueueConfig;
+            size_t packets = m_queuedPackets;
+            if(c.maxPackets > 0 && packets >= c.maxPackets) {
+                return true;
+            }
+            if(c.maxBytes > 0 && packets > 0 && m_queuedBytes + len > c.maxBytes) {
+                return true;
+            }
+            
+            // budget shared by all sockets of hub
+            if(hub && hub->m_maxQueuedBytes > 0) {
+                size_t total = hub->m_queuedBytes;
+                if(total > 0 && total + len > hub->m_maxQueuedBytes) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        
+        bool TCPSocket::waitForSendSpace(size_t len) {
+            // I/O thread would wait for itself
+            SocketReactor* reactor = m_reactor;
+            if(reactor && reactor->isReactorThread()) {
+                return false;
+            }
+            
+            pthread_mutex_lock(&m_sendMutex);
+            m_sendWaiters++;
+            bool ok = true;
+            while(isSendQueueFull(len)) {
+                if(m_stop) {
+                    ok = false;
+                    break;
+                }
+                
+                // room made by other sockets of hub is not signaled, poll for it
+                timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_nsec += kCCSocketSendBlockPollMs * 1000000L;
+                if(ts.tv_nsec >= 1000000000L) {
+                    ts.tv_sec++;
+                    ts.tv_nsec -= 1000000000L;
+                }
+                pthread_cond_timedwait(&m_sendCond, &m_sendMutex, &ts);
             }
+            m_sendWaiters--;
+            pthread_mutex_unlock(&m_sendMutex);
+            return ok;
         }
         
-        void TCPSocket::sendPacket(Packet* p) {
-            pthread_mutex_lock(&m_mutex);
-            m_sendQueue.pushBack(p);
-            pthread_mutex_unlock(&m_mutex);
+        void TCPSocket::wakeSendWaiters() {
+            if(m_sendWaiters > 0) {
+                pthread_mutex_lock(&m_sendMutex);
+                pthread_cond_broadcast(&m_sendCond);
+                pthread_mutex_unlock(&m_sendMutex);
+            }
         }
         
-        void* TCPSocket::tcpThreadEntry(void* arg) {
+        void TCPSocket::trimSendQueue() {
+            TCPSocketHub* hub = m_hub;
+            const SendQueueConfig& c = m_sendQueueConfig;
+            if(c.policy != SendOverflowPolicy::DROP_OLDEST) {
+                return;
+            }
             
-            // get socket
-            TCPSocket* s = (TCPSocket*)arg;
+            // packets in send batch may be partially sent, only queued ones are dropped
+            size_t bytes = 0;
+            size_t count = 0;
+            size_t hubMax = hub ? hub->m_maxQueuedBytes : 0;
+            Packet* p;
+            while(true) {
+                size_t packets = m_queuedPackets - count;
+                bool over = (c.maxPackets > 0 && packets > c.maxPackets) ||
+                            (c.maxBytes > 0 && packets > 1 && m_queuedBytes - bytes > c.maxBytes) ||
+                            (hubMax > 0 && hub->m_queuedBytes - bytes > hubMax);
+                if(!over || !m_sendQueue.pop(p)) {
+                    break;
+                }
+                bytes += p->getPacketLength();
+                count++;
+                p->release();
+            }
+            if(count > 0) {
+                CCLOG("TCPSocket: socket %d dropped %d queued packets", getSocket(), (int)count);
+                m_droppedPackets += count;
+                onPacketsDequeued(bytes, count);
+            }
+        }
+        
+        void TCPSocket::onPacketsDequeued(size_t bytes, size_t count) {
+            TCPSocketHub* hub = m_hub;
+            if(count > 0) {
+                m_queuedBytes -= bytes;
+                m_queuedPackets -= count;
+                if(hub)
+                    hub->m_queuedBytes -= bytes;
+                wakeSendWaiters();
+            }
             
+            // dropped to low watermark
+            if(!m_writable && m_sendQueueConfig.highWatermark > 0 && m_queuedBytes <= m_sendQueueConfig.lowWatermark) {
+                bool expected = false;
+                if(m_writable.compare_exchange_strong(expected, true) && hub) {
+                    hub->onSocketWritabilityChangedThreadSafe(this);
+                }
+            }
+        }
+        
+        Packet* TCPSocket::encodeOutgoing(Packet* p) {
+            TCPSocketHub* hub = m_hub;
+            size_t len = p->getPacketLength();
+            Packet* out = m_pipeline->encode(p);
+            if(!out) {
+                m_droppedPackets++;
+                onPacketsDequeued(len, 1);
+                return NULL;
+            }
+            
+            // queued bytes count what goes on the wire from now on
+            size_t outLen = out->getPacketLength();
+            if(outLen != len) {
+                m_queuedBytes += outLen - len;
+                if(hub)
+                    hub->m_queuedBytes += outLen - len;
+            }
+            return out;
+        }
+        
+        void TCPSocket::setPacketPipeline(PacketPipeline* pipeline) {
+            if(pipeline != m_pipeline) {
+                CC_SAFE_RETAIN(pipeline);
+                CC_SAFE_RELEASE(m_pipeline);
+                m_pipeline = pipeline;
+            }
+        }
+        
+        void TCPSocket::dropSendQueue() {
+            TCPSocketHub* hub = m_hub;
+            size_t bytes = 0;
+            size_t count = 0;
+            for(int i = 0; i < m_sendBatchCount; i++) {
+                bytes += m_sendBatch[i]->getPacketLength();
+                m_sendBatch[i]->release();
+            }
+            count = m_sendBatchCount;
+            m_sendBatchCount = 0;
+            m_sentBytes = 0;
+            
+            Packet* p;
+            while(m_sendQueue.pop(p)) {
+                bytes += p->getPacketLength();
+                count++;
+                p->release();
+            }
+            
+            // no watermark notification, socket is going away
+            if(count > 0) {
+                m_queuedBytes -= bytes;
+                m_queuedPackets -= count;
+                if(hub)
+                    hub->m_queuedBytes -= bytes;
+            }
+            wakeSendWaiters();
+        }
+        
+        void TCPSocket::closeSendQueue() {
+            m_stop = true;
+            while(m_senders > 0) {
+                sched_yield();
+            }
+            dropSendQueue();
+        }
+        
+        void TCPSocket::setStop(bool stop) {
+            m_stop = stop;
+            if(stop) {
+                wakeSendWaiters();
+                SocketReactor* reactor = m_reactor;
+                if(reactor)
+                    reactor->wakeup(this);
+            }
+        }
+        
+        bool TCPSocket::startConnect() {
             // create address
             sockaddr_in addr_in;
             memset((void *)&addr_in, 0, sizeof(addr_in));
             addr_in.sin_family = AF_INET;
-            addr_in.sin_port = htons(s->m_port);
-            addr_in.sin_addr.s_addr = inet_addr(s->m_hostname.c_str());;
-            
-            // connect
-            // if has error, close it
-            // if success, select it with specified timeout
-            if(connect(s->m_socket, (sockaddr*)&addr_in, sizeof(addr_in)) == kCCSocketError && s->hasError()) {
-                s->closeSocket();
-            } else {
-                // delay 500ms when socket closed
-                struct linger so_linger;
-                so_linger.l_onoff = 1;
-                so_linger.l_linger = 500;
-                setsockopt(s->m_socket, SOL_SOCKET, SO_LINGER, (const char*)&so_linger, sizeof(so_linger));
+            addr_in.sin_port = htons(m_port);
+            addr_in.sin_addr.s_addr = inet_addr(m_hostname.c_str());
+            
+            // connect, it is non-blocking so the result comes later as a writable event
+            if(connect(m_socket, (sockaddr*)&addr_in, sizeof(addr_in)) == kCCSocketError && hasError()) {
+                return false;
+            }
+            
+            m_connectDeadline = m_blockSec > 0 ? SocketReactor::now() + m_blockSec * 1000 : 0;
+            return true;
+        }
+        
+        bool TCPSocket::finishConnect() {
+            TCPSocketHub* hub = m_hub;
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if(getsockopt(m_socket, SOL_SOCKET, SO_ERROR, &err, &len) == kCCSocketError || err != 0) {
+                CCLOG("TCPSocket: socket %d connect failed: %d", m_socket, err);
+                return false;
+            }
+            
+            m_connected = true;
+            if(hub)
+                hub->onSocketConnectedThreadSafe(this);
+            return true;
+        }
+        
+        bool TCPSocket::onReadable() {
+            TCPSocketHub* hub = m_hub;
+            while(!m_stop) {
+                // hub is over its memory limit, leave data in kernel until update frees memory
+                if(hub && hub->shouldPauseReading()) {
+                    if(!m_readPaused.exchange(true)) {
+                        hub->m_pausedReaders++;
+                    }
+                    return true;
+                }
+                
+                int inlen = recvFromSock();
+                if(inlen == kCCSocketError) {
+                    return false;
+                }
+                
+                // deliver what we have, it frees space for next read
+                if(!decodeInBuf()) {
+                    return false;
+                }
                 
-                // select it
-                timeval timeout;
-                timeout.tv_sec = s->m_blockSec;
-                timeout.tv_usec = 0;
-                fd_set writeset, exceptset;
-                FD_ZERO(&writeset);
-                FD_ZERO(&exceptset);
-                FD_SET(s->m_socket, &writeset);
-                FD_SET(s->m_socket, &exceptset);
-                int ret = select(FD_SETSIZE, NULL, &writeset, &exceptset, &timeout);
-                if (ret < 0) {
-                    s->closeSocket();
+                if(inlen == 0) {
+                    adaptInput();
+                    break;
+                }
+            }
+            return true;
+        }
+        
+        bool TCPSocket::decodeInBuf() {
+            TCPSocketHub* hub = m_hub;
+            size_t len = inLength();
+            if(len == 0) {
+                return true;
+            }
+            
+            // raw packet is whatever we have
+            if(!hub || hub->getRawPolicy()) {
+                Packet* p = new Packet();
+                if(m_chunk) {
+                    p->initWithRawSlice(m_chunk, inData(), len);
                 } else {
-                    ret = FD_ISSET(s->m_socket, &exceptset);
-                    if(ret) {
-                        s->closeSocket();
-                    } else {
-                        s->m_connected = true;
-                        if(s->m_hub)
-                            s->m_hub->onSocketConnectedThreadSafe(s);
-                    }
+                    p->initWithRawBuf(inData(), len, -1);
                 }
+                inConsume(len);
+                deliverPacket(p);
+                return true;
             }
             
-            // read/write loop
-            Packet* p = NULL;
-            ssize_t sent = 0;
-            while(!s->m_stop && s->m_connected && s->getSocket() != kCCSocketInvalid) {
-                s->recvFromSock();
-                if(s->m_inBufLen > 0) {
-                    Packet* p = NULL;
-                    if(s->m_hub->getRawPolicy()) {
-                        p = new Packet();
-                        p->initWithRawBuf(s->m_inBuf, s->m_inBufLen, -1);
-                    } else {
-                        p = new Packet();
-                        p->initWithStandardBuf(s->m_inBuf, s->m_inBufLen);
+            int maxLength = hub->getMaxPacketLength();
+            while(true) {
+                // header of next frame, parsed once even if body arrives in many reads
+                if(!m_hasFrameHeader) {
+                    if(!Packet::parseHeader(inData(), inLength(), m_frameHeader)) {
+                        break;
+                    }
+                    if(m_frameHeader.length < 0 || m_frameHeader.length > maxLength) {
+                        CCLOG("TCPSocket: socket %d invalid packet length %d", getSocket(), m_frameHeader.length);
+                        return false;
                     }
-                    s->compactInBuf(p->getPacketLength());
-                    CCLOG("TCPSocket: socket %d recieved data with length %ld",
-                          s->getSocket(), p->getPacketLength());
-                    CCLOG("print message raw = %s", p->getBuffer());
-                    if(s->m_hub)
-                        s->m_hub->onPacketReceivedThreadSafe(p);
+                    m_hasFrameHeader = true;
                 }
                 
-                // get packet to be sent
-                if(!p && s->m_sendQueue.size() > 0) {
-                    pthread_mutex_lock(&s->m_mutex);
-                    p = (Packet*)s->m_sendQueue.at(0);
-                    CC_SAFE_RETAIN(p);
-                    s->m_sendQueue.erase(0);
-                    sent = 0;
-                    pthread_mutex_unlock(&s->m_mutex);
+                // frame that can't fit in read buffer gets a buffer of its own
+                size_t frameLen = kPacketHeaderLength + m_frameHeader.length;
+                if(frameLen > m_recvBufferConfig.maxSize) {
+                    return startLargePacket();
                 }
                 
-                // send current packet
-                if(p) {
-                    ssize_t outsize = send(s->m_socket, p->getBuffer() + sent, p->getPacketLength() - sent, 0);
-                    if(outsize > 0) {
-                        CCLOG("TCPSocket: socket %d send packet length %ld",
-                              s->getSocket(), p->getPacketLength());
-                        CCLOG("print raw = %s", p->getBuffer());
-                        // move cursor
-                        sent += outsize;
-                        
-                        // any more?
-                        if (sent >= p->getPacketLength()) {
-                            CC_SAFE_RELEASE(p);
-                            p = NULL;
-                            CCLOG("TCPSocket: packet sent finished");
-                        }
-                    } else {
-                        if (s->hasError()) {
-                            s->closeSocket();
-                        }
-                    }
+                // body
+                if(inLength() < frameLen) {
+                    break;
                 }
+                Packet* p = new Packet();
+                if(m_chunk) {
+                    p->initWithSlice(m_chunk, m_frameHeader, inData());
+                } else {
+                    p->initWithHeader(m_frameHeader, inData() + kPacketHeaderLength);
+                }
+                inConsume(frameLen);
+                m_hasFrameHeader = false;
+                deliverPacket(p);
             }
             
-            // end
-            if(s->m_connected) {
-                if(s->m_hub)
-                    s->m_hub->onSocketDisconnectedThreadSafe(s);
-                s->m_connected = false;
+            // a partial frame stays where it is, its parsed header stays valid
+            return true;
+        }
+        
+        void TCPSocket::deliverPacket(Packet* p) {
+            TCPSocketHub* hub = m_hub;
+            if(m_pipeline && !(p = m_pipeline->decode(p))) {
+                CCLOG("TCPSocket: socket %d dropped a packet its pipeline couldn't decode", getSocket());
+                return;
             }
+            CCLOG("TCPSocket: socket %d recieved data with length %ld",
+                  getSocket(), p->getPacketLength());
+            if(hub)
+                hub->onPacketReceivedThreadSafe(this, p);
+            p->release();
+        }
+        
+        bool TCPSocket::flushSendQueue() {
+            trimSendQueue();
             
-            // release
-            s->autorelease();
-                        
-            // exit
-            pthread_exit(NULL);
+            iovec iov[kCCSocketMaxSendBatch];
+            size_t sentBytes = 0;
+            size_t sentPackets = 0;
+            bool ok = true;
+            while(true) {
+                // top up batch with queued packets
+                Packet* queued;
+                while(m_sendBatchCount < kCCSocketMaxSendBatch && m_sendQueue.pop(queued)) {
+                    if(m_pipeline && !(queued = encodeOutgoing(queued))) {
+                        continue;
+                    }
+                    m_sendBatch[m_sendBatchCount++] = queued;
+                }
+                if(m_sendBatchCount == 0) {
+                    break;
+                }
+                
+                // gather batch, first packet may be partially sent already
+                for(int i = 0; i < m_sendBatchCount; i++) {
+                    Packet* p = m_sendBatch[i];
+                    size_t offset = i == 0 ? m_sentBytes : 0;
+                    iov[i].iov_base = p->getBuffer() + offset;
+                    iov[i].iov_len = p->getPacketLength() - offset;
+                }
+                msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = iov;
+                msg.msg_iovlen = m_sendBatchCount;
+                
+                ssize_t outsize = sendmsg(m_socket, &msg, MSG_NOSIGNAL);
+                if(outsize >= 0) {
+                    CCLOG("TCPSocket: socket %d sent %ld bytes of %d packets",
+                          getSocket(), (long)outsize, m_sendBatchCount);
+                    
+                    // release finished packets, keep cursor in the first unfinished one
+                    size_t left = outsize;
+                    int done = 0;
+                    while(done < m_sendBatchCount) {
+                        size_t remain = m_sendBatch[done]->getPacketLength() - m_sentBytes;
+                        if(left < remain) {
+                            m_sentBytes += left;
+                            break;
+                        }
+                        left -= remain;
+                        sentBytes += m_sendBatch[done]->getPacketLength();
+                        m_sendBatch[done]->release();
+                        m_sentBytes = 0;
+                        done++;
+                    }
+                    if(done > 0) {
+                        sentPackets += done;
+                        m_sendBatchCount -= done;
+                        memmove(m_sendBatch, m_sendBatch + done, m_sendBatchCount * sizeof(Packet*));
+                    } else if(outsize == 0) {
+                        break;
+                    }
+                } else {
+                    // error, or kernel buffer is full and we wait for writable event
+                    ok = !hasError();
+                    break;
+                }
+            }
             
-            return NULL;
+            // one update of shared counters per flush
+            onPacketsDequeued(sentBytes, sentPackets);
+            return ok;
         }
         
         bool TCPSocket::init(const std::string& hostname, int port, int tag, int blockSec, bool keepAlive) {
@@ -231,6 +593,12 @@ namespace funny {
             
             // nonblock
             fcntl(m_socket, F_SETFL, O_NONBLOCK);
+
+#ifdef SO_NOSIGPIPE
+            // peer reset must not kill reactor thread
+            int noSigPipe = 1;
+            setsockopt(m_socket, SOL_SOCKET, SO_NOSIGPIPE, (char*)&noSigPipe, sizeof(noSigPipe));
+#endif
             
             // save info
             m_hostname = hostname;
@@ -238,16 +606,6 @@ namespace funny {
             m_tag = tag;
             m_blockSec = blockSec;
             
-            // reset buffer
-            m_inBufLen = 0;
-            
-            // open a thread to process this socket
-            // should hold it to avoid wrong pointer
-            CC_SAFE_RETAIN(this);
-            pthread_t thread;
-            pthread_create(&thread, NULL, tcpThreadEntry, (void*)this);
-            pthread_detach(thread);
-            
             CCLOG("TCPSocket: create socket successful");
             
             return true;
@@ -255,43 +613,236 @@ namespace funny {
         
         bool TCPSocket::hasError() {
             int err = errno;
-            if(err != EINPROGRESS && err != EAGAIN) {
+            if(err != EINPROGRESS && err != EAGAIN && err != EWOULDBLOCK && err != EINTR) {
                 return true;
             }
             
             return false;
         }
         
-        bool TCPSocket::recvFromSock() {
+        int TCPSocket::recvFromSock() {
             // basic check
-            if (m_inBufLen >= kCCSocketInputBufferDefaultSize || m_socket == kCCSocketInvalid) {
-                return false;
+            if(m_socket == kCCSocketInvalid) {
+                return kCCSocketError;
+            }
+            
+            if(m_largePacket) {
+                return recvLargePacket();
             }
             
-            // max byte can be hold by read buffer and the write position
-            int savelen = kCCSocketInputBufferDefaultSize - m_inBufLen;
+            // buffer is taken from pool on demand and may grow before this read
+            size_t savelen = prepareInput();
+            if(savelen == 0) {
+                CCLOG("TCPSocket: socket %d can't allocate read buffer", m_socket);
+                return kCCSocketError;
+            }
+            char* savepos = m_chunk ? m_chunk->writePtr() : m_inBuf.writePtr();
             
-            // read to buffer end
-            int savepos = m_inBufLen;
-            ssize_t inlen = recv(m_socket, m_inBuf + savepos, savelen, 0);
+            ssize_t inlen = recv(m_socket, savepos, savelen, 0);
             if(inlen > 0) {
-                m_inBufLen += inlen;
-                if (m_inBufLen > kCCSocketInputBufferDefaultSize) {
-                    return false;
+                if(m_chunk) {
+                    m_chunk->commit(inlen);
+                } else {
+                    m_inBuf.commit(inlen);
+                }
+                m_recvPeak = MAX(m_recvPeak, inLength());
+                
+                // read filled all room, peer is sending faster than we read
+                if((size_t)inlen == savelen && m_recvBufferSize < m_recvBufferConfig.maxSize) {
+                    m_recvBufferSize = MIN(m_recvBufferSize * 2, m_recvBufferConfig.maxSize);
                 }
+                return (int)inlen;
             } else if(inlen == 0) {
-                closeSocket();
+                // peer closed
+                return kCCSocketError;
+            } else if(hasError()) {
+                return kCCSocketError;
+            }
+            
+            return 0;
+        }
+        
+        size_t TCPSocket::prepareInput() {
+            const ReceiveBufferConfig& c = m_recvBufferConfig;
+            if(m_recvBufferSize == 0) {
+                m_recvBufferSize = MAX(c.minSize, (size_t)kPacketHeaderLength);
+            }
+            
+            // a partial frame must fit as a whole
+            size_t want = m_recvBufferSize;
+            if(m_hasFrameHeader) {
+                want = MAX(want, kPacketHeaderLength + (size_t)m_frameHeader.length);
+            }
+            
+            size_t old = inCapacity();
+            size_t room;
+            if(m_zeroCopy) {
+                if(!prepareChunk(want)) {
+                    return 0;
+                }
+                room = m_chunk->writable();
+            } else {
+                if(!m_inBuf.isValid()) {
+                    if(!m_inBuf.init(want, c.mirrored)) {
+                        return 0;
+                    }
+                } else if(m_inBuf.capacity() < want && !m_inBuf.resize(want)) {
+                    return 0;
+                }
+                room = m_inBuf.prepareWrite();
+            }
+            if(inCapacity() != old) {
+                updateInputBytes();
+            }
+            return room;
+        }
+        
+        bool TCPSocket::prepareChunk(size_t size) {
+            if(m_chunk && m_chunk->writable() > 0 && m_chunk->capacity() >= size) {
+                return true;
+            }
+            
+            // tail is used up, reuse chunk if no packet points into it
+            if(m_chunk && !m_chunk->isShared() && m_chunk->capacity() >= size) {
+                m_chunk->compact();
+                return true;
+            }
+            
+            // continue partial frame in a fresh chunk
+            RecvChunk* c = RecvChunk::create(size);
+            if(!c) {
                 return false;
+            }
+            if(m_chunk) {
+                memcpy(c->writePtr(), m_chunk->readPtr(), m_chunk->readable());
+                c->commit(m_chunk->readable());
+                m_chunk->release();
+            }
+            m_chunk = c;
+            return true;
+        }
+        
+        void TCPSocket::adaptInput() {
+            size_t cap = inCapacity();
+            if(cap == 0) {
+                return;
+            }
+            const ReceiveBufferConfig& c = m_recvBufferConfig;
+            
+            // halve next buffer after a run of light reads
+            if(m_recvPeak * 4 < cap) {
+                if(++m_recvSmallReads >= kCCSocketInputShrinkReads) {
+                    m_recvBufferSize = MAX(c.minSize, m_recvBufferSize / 2);
+                    m_recvSmallReads = 0;
+                }
             } else {
-                if (hasError()) {
-                    closeSocket();
-                    return false;
+                m_recvSmallReads = 0;
+            }
+            m_recvPeak = 0;
+            
+            // a partial frame keeps its buffer
+            if(inLength() > 0) {
+                return;
+            }
+            if(m_chunk) {
+                // packets hold their own references to chunk
+                if(c.releaseWhenIdle || cap >= m_recvBufferSize * 2) {
+                    m_chunk->release();
+                    m_chunk = NULL;
                 }
+            } else if(c.releaseWhenIdle && !c.mirrored) {
+                m_inBuf.destroy();
+            } else if(cap >= m_recvBufferSize * 2) {
+                m_inBuf.resize(m_recvBufferSize);
+            }
+            if(inCapacity() != cap) {
+                updateInputBytes();
+            }
+        }
+        
+        bool TCPSocket::startLargePacket() {
+            Packet* p = new Packet();
+            if(!p->initWithHeader(m_frameHeader, NULL)) {
+                CCLOG("TCPSocket: socket %d can't allocate packet of %d bytes", getSocket(), m_frameHeader.length);
+                p->release();
+                return false;
             }
             
+            // body bytes which came with header, the rest goes straight into packet
+            size_t filled = MIN(inLength() - kPacketHeaderLength, (size_t)m_frameHeader.length);
+            memcpy(p->getBuffer() + kPacketHeaderLength, inData() + kPacketHeaderLength, filled);
+            inConsume(kPacketHeaderLength + filled);
+            m_hasFrameHeader = false;
+            m_largePacket = p;
+            m_largeFilled = filled;
+            updateInputBytes();
             return true;
         }
         
+        int TCPSocket::recvLargePacket() {
+            size_t bodyLen = m_largePacket->getBodyLength();
+            ssize_t inlen = 0;
+            if(m_largeFilled < bodyLen) {
+                inlen = recv(m_socket, m_largePacket->getBuffer() + kPacketHeaderLength + m_largeFilled, bodyLen - m_largeFilled, 0);
+                if(inlen == 0) {
+                    return kCCSocketError;
+                } else if(inlen < 0) {
+                    return hasError() ? kCCSocketError : 0;
+                }
+                m_largeFilled += inlen;
+            }
+            
+            if(m_largeFilled == bodyLen) {
+                Packet* p = m_largePacket;
+                m_largePacket = NULL;
+                m_largeFilled = 0;
+                updateInputBytes();
+                deliverPacket(p);
+                
+                // more may follow in socket, read it into normal buffer
+                return inlen > 0 ? (int)inlen : 1;
+            }
+            return (int)inlen;
+        }
+        
+        void TCPSocket::updateInputBytes() {
+            TCPSocketHub* hub = m_hub;
+            size_t bytes = m_inBuf.capacity() + (m_chunk ? m_chunk->capacity() : 0) +
+                           (m_largePacket ? m_largePacket->getBufferCapacity() : 0);
+            size_t old = m_inputBytes.exchange(bytes);
+            if(hub) {
+                hub->m_inputBufferBytes += bytes;
+                hub->m_inputBufferBytes -= old;
+            }
+        }
+        
+        void TCPSocket::releaseInput() {
+            TCPSocketHub* hub = m_hub;
+            m_inBuf.destroy();
+            if(m_chunk) {
+                m_chunk->release();
+                m_chunk = NULL;
+            }
+            m_hasFrameHeader = false;
+            CC_SAFE_RELEASE_NULL(m_largePacket);
+            m_largeFilled = 0;
+            updateInputBytes();
+            
+            if(m_readPaused.exchange(false) && hub) {
+                hub->m_pausedReaders--;
+            }
+        }
+        
+        bool TCPSocket::resumeReading() {
+            TCPSocketHub* hub = m_hub;
+            if(!m_readPaused.exchange(false)) {
+                return true;
+            }
+            if(hub)
+                hub->m_pausedReaders--;
+            return onReadable();
+        }
+        
         bool TCPSocket::hasAvailable() {
             // basic check
             if (m_socket == kCCSocketInvalid) {
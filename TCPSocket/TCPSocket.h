@@ -26,21 +26,31 @@
 #ifndef __TCPSocket_h__
 #define __TCPSocket_h__
 
-#include "cocos2d.h"
+#include "NetworkConfig.h"
 #include "ByteBuffer.h"
 #include <sys/socket.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
 #include <pthread.h>
+#include <atomic>
 #include "Packet.h"
+#include "PacketTransform.h"
+#include "MPSCQueue.h"
+#include "RingBuffer.h"
 
 
 #define kCCSocketMaxPacketSize (16 * 1024)
 #define kCCSocketDefaultTimeout 30
 #define kCCSocketInputBufferDefaultSize (64 * 1024)
+#define kCCSocketInputBufferMinSize (4 * 1024)
+#define kCCSocketInputShrinkReads 8
+#define kCCSocketDefaultMaxPacketLength (16 * 1024 * 1024)
 #define kCCSocketOutputBufferDefaultSize (8 * 1024)
+#define kCCSocketMaxSendBatch 64
+#define kCCSocketSendBlockPollMs 50
 #define kCCSocketError -1
 #define kCCSocketInvalid -1
 
@@ -48,32 +58,283 @@ namespace funny {
     namespace network {
         
         class TCPSocketHub;
+        class SocketReactor;
+        
+        /// what sendPacket does when send queue is full
+        enum class SendOverflowPolicy {
+            /// reject new packet, sendPacket returns false
+            FAIL,
+            
+            /// accept new packet, I/O thread drops oldest unsent packets until queue fits again
+            DROP_OLDEST,
+            
+            /// wait until I/O thread makes room, fails if called on I/O thread of the socket
+            BLOCK
+        };
+        
+        /**
+         * size policy of a socket read buffer. Buffer is taken from BufferPool on first read, doubles
+         * when a read fills it, halves after kCCSocketInputShrinkReads reads that used less than a
+         * quarter of it, and goes back to pool when nothing is left in it
+         */
+        struct ReceiveBufferConfig {
+            /// size of first buffer and smallest size it shrinks to
+            size_t minSize;
+            
+            /// largest size it grows to, a standard frame must fit in it
+            size_t maxSize;
+            
+            /// true means buffer is freed whenever a read leaves it empty, an idle socket holds no
+            /// read memory then
+            bool releaseWhenIdle;
+            
+            /// true means use a double mapped ring instead of a pooled buffer, it is never released
+            /// while socket is connected because mapping costs system calls
+            bool mirrored;
+            
+            ReceiveBufferConfig() :
+            minSize(kCCSocketInputBufferMinSize),
+            maxSize(kCCSocketInputBufferDefaultSize),
+            releaseWhenIdle(true),
+            mirrored(false) {
+            }
+        };
+        
+        /// limits of a send queue, 0 means no limit
+        struct SendQueueConfig {
+            /// max bytes of queued packets, a packet is always accepted by an empty queue
+            size_t maxBytes;
+            
+            /// max number of queued packets
+            size_t maxPackets;
+            
+            /// socket becomes unwritable when queued bytes go above it, 0 disables notifications
+            size_t highWatermark;
+            
+            /// unwritable socket becomes writable again when queued bytes drop to it
+            size_t lowWatermark;
+            
+            /// what to do when queue is full
+            SendOverflowPolicy policy;
+            
+            SendQueueConfig() :
+            maxBytes(0),
+            maxPackets(0),
+            highWatermark(0),
+            lowWatermark(0),
+            policy(SendOverflowPolicy::FAIL) {
+            }
+        };
         
         /**
          * TCP socket
          */
-        class CC_DLL TCPSocket : public cocos2d::Ref {
+        class CC_DLL TCPSocket : public Ref {
             friend class TCPSocketHub;
+            friend class SocketReactor;
             
         private:
-            /// read buffer, it is a loop buffer
-            char m_inBuf[kCCSocketInputBufferDefaultSize];
+            /// read buffer, frames are parsed in place and consumed without moving data
+            RingBuffer m_inBuf;
+            
+            /// read buffer in zero copy mode, packets are slices of it
+            RecvChunk* m_chunk;
+            
+            /// true if received packets are slices of m_chunk instead of copies, set by hub
+            bool m_zeroCopy;
+            
+            /// header of the partial frame at start of read buffer, valid if m_hasFrameHeader
+            Packet::Header m_frameHeader;
+            
+            /// true when m_frameHeader is parsed and frame body is still incomplete
+            bool m_hasFrameHeader;
+            
+            /// packet of a frame larger than max read buffer, its body is received straight into it
+            Packet* m_largePacket;
+            
+            /// body bytes of m_largePacket received so far
+            size_t m_largeFilled;
             
-            /// available data in read buffer
-            int m_inBufLen;
+            /// size of next read buffer, between min and max of m_recvBufferConfig, 0 before first read
+            size_t m_recvBufferSize;
+            
+            /// most unread bytes seen during current onReadable
+            size_t m_recvPeak;
+            
+            /// consecutive onReadable calls which used less than a quarter of read buffer
+            int m_recvSmallReads;
             
             /// block time for waiting socket connection
             int m_blockSec;
             
-            /// pthread mutex
-            pthread_mutex_t m_mutex;
+            /// packets waiting to be sent, retained, pushed by any thread and popped by reactor
+            MPSCQueue<Packet*> m_sendQueue;
+            
+            /// reactor serving this socket, NULL if it is not added to a hub. Set by reactor and
+            /// read by any thread which wakes it
+            std::atomic<SocketReactor*> m_reactor;
+            
+            /// monotonic time in ms when connect times out, 0 means no timeout
+            int64_t m_connectDeadline;
+            
+            /// true when socket is queued for a reactor wakeup
+            std::atomic<bool> m_wakeupPending;
+            
+            /// packets taken from send queue and being written with one sendmsg, retained
+            Packet* m_sendBatch[kCCSocketMaxSendBatch];
+            
+            /// packet count in m_sendBatch
+            int m_sendBatchCount;
+            
+            /// bytes of m_sendBatch[0] already sent
+            size_t m_sentBytes;
+            
+            /// bytes and number of packets accepted by sendPacket and not yet sent or dropped
+            std::atomic<size_t> m_queuedBytes;
+            std::atomic<size_t> m_queuedPackets;
+            
+            /// false between crossing high watermark and dropping back to low watermark
+            std::atomic<bool> m_writable;
+            
+            /// packets dropped by overflow policy
+            std::atomic<uint64_t> m_droppedPackets;
+            
+            /// senders waiting in BLOCK policy, they sleep on m_sendCond
+            std::atomic<int> m_sendWaiters;
+            pthread_mutex_t m_sendMutex;
+            pthread_cond_t m_sendCond;
+            
+            /// writability last reported to hub delegate, cocos thread only
+            bool m_reportedWritable;
+            
+            /// bytes of read buffers held by socket, counted by hub memory accountant
+            std::atomic<size_t> m_inputBytes;
+            
+            /// true while reading is stopped because hub is over its memory limit
+            std::atomic<bool> m_readPaused;
+            
+            /// true once socket is stopped, set by reactor when it detaches socket and read by
+            /// senders on any thread
+            std::atomic<bool> m_stop;
+            
+            /// senders between their stop check and push, closeSendQueue waits for them
+            std::atomic<int> m_senders;
+            
+            /// hub reference, set by hub on cocos thread and read by senders on any thread
+            std::atomic<TCPSocketHub*> m_hub;
+            
+            /// stages run on outgoing and incoming packets in I/O thread, retained, may be NULL
+            PacketPipeline* m_pipeline;
             
         private:
-            // we wait here until socket is connected or failed
-            static void* tcpThreadEntry(void* arg);
+            /// start non-blocking connect, called in reactor thread
+            bool startConnect();
+            
+            /// check connect result when socket becomes writable, called in reactor thread
+            bool finishConnect();
+            
+            /// read until socket would block and deliver packets, false means socket should be closed
+            bool onReadable();
+            
+            /// send queued packets in batches until socket would block, false means socket should be closed
+            bool flushSendQueue();
+            
+            /// true if a packet of len bytes does not fit in send queue or hub send budget
+            bool isSendQueueFull(size_t len);
+            
+            /// queue packet with a reference of its own, see sendPacket
+            bool enqueuePacket(Packet* p);
             
-            /// receive data from socket until no more data or buffer full, or error
-            bool recvFromSock();
+            /// wait in BLOCK policy until a packet of len bytes fits, false if socket stops first
+            bool waitForSendSpace(size_t len);
+            
+            /// drop oldest queued packets until queue fits its limits, DROP_OLDEST policy, reactor thread
+            void trimSendQueue();
+            
+            /// account packets leaving send queue, notify watermark and wake blocked senders
+            void onPacketsDequeued(size_t bytes, size_t count);
+            
+            /// run outgoing pipeline on a packet taken from send queue, counters follow its new size
+            Packet* encodeOutgoing(Packet* p);
+            
+            /// release every unsent packet
+            void dropSendQueue();
+            
+            /// stop accepting packets and release unsent ones, called when socket leaves its reactor
+            void closeSendQueue();
+            
+            /// wake senders blocked in BLOCK policy
+            void wakeSendWaiters();
+            
+            /// recount m_inputBytes after a read buffer is created or freed, reactor thread
+            void updateInputBytes();
+            
+            /// free read buffers, called when socket leaves its reactor
+            void releaseInput();
+            
+            /// read again after hub paused reading, false means socket should be closed
+            bool resumeReading();
+            
+            /**
+             * build packets from every complete frame in read buffer and keep the partial tail
+             *
+             * @return false if a frame header is invalid and socket should be closed
+             */
+            bool decodeInBuf();
+            
+            /// start of unread bytes in read buffer of current mode
+            char* inData() { return m_chunk ? m_chunk->readPtr() : m_inBuf.readPtr(); }
+            
+            /// number of unread bytes in read buffer of current mode
+            size_t inLength() { return m_chunk ? m_chunk->readable() : m_inBuf.readable(); }
+            
+            /// drop bytes from read buffer of current mode
+            void inConsume(size_t n) { if(m_chunk) m_chunk->consume(n); else m_inBuf.consume(n); }
+            
+            /**
+             * make sure m_chunk has room to read into. A chunk still referenced by packets is never
+             * written at front again, the partial frame at its end is copied to a fresh chunk.
+             *
+             * @param size wanted chunk size
+             * @return false if out of memory
+             */
+            bool prepareChunk(size_t size);
+            
+            /**
+             * make sure read buffer of current mode exists and has room, growing it to
+             * m_recvBufferSize or to the partial frame
+             *
+             * @return bytes which can be read at once, 0 if buffer can't be allocated
+             */
+            size_t prepareInput();
+            
+            /// capacity of read buffer of current mode, 0 if there is none
+            size_t inCapacity() { return m_chunk ? m_chunk->capacity() : m_inBuf.capacity(); }
+            
+            /// shrink or free read buffer after socket is drained
+            void adaptInput();
+            
+            /**
+             * move frame whose header is at start of read buffer into its own packet, with the part
+             * of body already read. Rest of body is received by recvLargePacket
+             *
+             * @return false if packet can't be allocated
+             */
+            bool startLargePacket();
+            
+            /// receive body of m_largePacket and deliver it when complete, same result as recvFromSock
+            int recvLargePacket();
+            
+            /// hand a received packet to hub and drop our reference
+            void deliverPacket(Packet* p);
+            
+            /**
+             * receive data from socket until buffer full
+             *
+             * @return bytes received, 0 if socket would block or buffer is full, kCCSocketError if
+             * socket is closed or failed
+             */
+            int recvFromSock();
             
             /// has error
             bool hasError();
@@ -81,9 +342,6 @@ namespace funny {
             /// close socket
             void closeSocket();
             
-            /// compact in buf
-            void compactInBuf(int consumed);
-            
         protected:
             /**
              * init socket
@@ -91,7 +349,7 @@ namespace funny {
              * @param hostname host name or ip address, ipv4 only
              * @param port port
              * @param tag tag of socket
-             * @param blockSec block time when create this socket, 0 means not block
+             * @param blockSec connect timeout in seconds, 0 means no timeout
              * @param keepAlive true means keep socket alive
              * @return true means initialization successful
              */
@@ -102,23 +360,35 @@ namespace funny {
             virtual ~TCPSocket();
             
             /**
-             * create socket instance
+             * create socket instance. Socket starts connecting when it is added to a hub, all
+             * its I/O is done by the reactor thread of that hub.
              *
              * @param hostname host name or ip address, ipv4 only
              * @param port port
              * @param tag tag of socket
-             * @param blockSec block time when create this socket, 0 means not block
+             * @param blockSec connect timeout in seconds, 0 means no timeout
              * @param keepAlive true means keep socket alive
              * @return instance or NULL if failed
              */
             static TCPSocket* create(const std::string& hostname, int port, int tag = -1, int blockSec = kCCSocketDefaultTimeout, bool keepAlive = false);
             
             /**
-             * add packet to send queue
+             * add packet to send queue, reactor is woken up to send it. Thread safe.
              *
              * @param p packet
+             * @param handOff true gives caller's reference to socket, which releases it even when
+             * packet is rejected. Caller must not touch p afterwards, so pipeline stages may change
+             * it in place, e.g. CipherTransform encrypts its body without a copy
+             * @return false if socket is stopped or queue is full and policy rejects the packet
+             */
+            bool sendPacket(Packet* p, bool handOff = false);
+            
+            /**
+             * request socket to stop, reactor closes it in its thread. Thread safe.
+             *
+             * @param stop true means stop
              */
-            void sendPacket(Packet* p);
+            void setStop(bool stop);
             
             /**
              * check is there any data can be read
@@ -134,13 +404,14 @@ namespace funny {
             CC_SYNTHESIZE_READONLY(int, m_tag, Tag);
             
             /// hub reference
-            CC_SYNTHESIZE(TCPSocketHub*, m_hub, Hub);
+            TCPSocketHub* getHub() { return m_hub; }
+            void setHub(TCPSocketHub* hub) { m_hub = hub; }
             
             /// connected
             CC_SYNTHESIZE_READONLY(bool, m_connected, Connected);
             
             /// stop
-            CC_SYNTHESIZE(bool, m_stop, Stop);
+            bool getStop() { return m_stop; }
             
             /// server name
             CC_SYNTHESIZE_READONLY_PASS_BY_REF(std::string, m_hostname, Hostname);
@@ -148,8 +419,34 @@ namespace funny {
             /// port
             CC_SYNTHESIZE_READONLY(int, m_port, Port);
             
-            /// send queue
-            CC_SYNTHESIZE_READONLY_PASS_BY_REF(cocos2d::Vector<Packet *>, m_sendQueue, SendQueue);
+            /// number of packets waiting in send queue, approximate when other threads are sending
+            size_t getSendQueueSize() { return m_sendQueue.size(); }
+            
+            /// limits and watermarks of send queue, hub sets its default when socket is added. Set it
+            /// before sending, it is read by sender and I/O threads without lock
+            CC_SYNTHESIZE_PASS_BY_REF(SendQueueConfig, m_sendQueueConfig, SendQueueConfig);
+            
+            /// bytes accepted by sendPacket and not yet sent or dropped
+            size_t getQueuedBytes() { return m_queuedBytes; }
+            
+            /// false while queued bytes are above high watermark, see SendQueueConfig
+            bool isWritable() { return m_writable; }
+            
+            /// number of packets dropped by DROP_OLDEST policy
+            uint64_t getDroppedPacketCount() { return m_droppedPackets; }
+            
+            /// bytes of read buffers and send queue held by socket
+            size_t getMemoryUsage() { return m_inputBytes + m_queuedBytes; }
+            
+            /// read buffer size policy, hub sets its default when socket is added. Set it before socket
+            /// connects, it is read by I/O thread without lock
+            CC_SYNTHESIZE_PASS_BY_REF(ReceiveBufferConfig, m_recvBufferConfig, ReceiveBufferConfig);
+            
+            /// transforms of outgoing and incoming packets, e.g. compression. Hub gives its pipeline
+            /// to sockets added without one. Set it before socket connects, it is read by I/O thread
+            /// without lock
+            PacketPipeline* getPacketPipeline() { return m_pipeline; }
+            void setPacketPipeline(PacketPipeline* pipeline);
         };
         
     }
@@ -25,58 +25,148 @@
 
 #include "TCPSocketHub.h"
 
+#ifndef TCPSOCKET_HEADLESS
+#include "CocosHubDelegate.h"
+#endif
+
+#include <unistd.h>
+#include <algorithm>
+
 USING_NS_CC;
 
 namespace funny {
     namespace network {
         
         
-        TCPSocketHub::TCPSocketHub() :
-        m_rawPolicy(true) {
+        TCPSocketHub::TCPSocketHub(int ioThreadCount, bool pinThreads) :
+        m_queuedBytes(0),
+        m_inputBufferBytes(0),
+        m_inboundBytes(0),
+        m_pausedReaders(0),
+        m_shedPackets(0),
+        m_memoryVictim(NULL),
+        m_packetPipeline(NULL),
+        m_hasHandlers(false),
+        m_dispatcherRunning(false),
+        m_rawPolicy(true),
+        m_maxPacketLength(kCCSocketDefaultMaxPacketLength),
+        m_assignPolicy(AssignPolicy::LEAST_LOAD),
+        m_zeroCopy(false),
+        m_batchDispatch(false),
+        m_maxQueuedBytes(0),
+        m_memoryLimit(0),
+        m_memoryPolicy(MemoryPolicy::STOP_READING),
+        m_delegate(NULL) {
             pthread_mutex_init(&m_mutex, NULL);
+            pthread_mutex_init(&m_dispatcherMutex, NULL);
+            pthread_cond_init(&m_dispatcherCond, NULL);
             
-            // start main loop
+            // start socket event loops
+            int cpuCount = MAX(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+            if(ioThreadCount <= 0) {
+                ioThreadCount = cpuCount;
+            }
+            for(int i = 0; i < ioThreadCount; i++) {
+                SocketReactor* r = new SocketReactor();
+                if(r->start(pinThreads ? i % cpuCount : -1)) {
+                    m_reactors.pushBack(r);
+                } else {
+                    CCLOG("TCPSocketHub: failed to start socket reactor %d", i);
+                }
+                r->release();
+            }
+
+#ifndef TCPSOCKET_HEADLESS
+            // post events to cocos and start main loop
+            m_cocosDelegate = new CocosHubDelegate();
+            m_delegate = m_cocosDelegate;
             auto s = Director::getInstance()->getScheduler();
             s->schedule(schedule_selector(TCPSocketHub::mainLoop), this, 0, false);
+#endif
         }
         
         TCPSocketHub::~TCPSocketHub() {
             // release
+            for(auto r : m_reactors) {
+                r->stop();
+            }
+            m_reactors.clear();
+            stopDispatcher();
+            stopDecodeWorkers();
+#ifndef TCPSOCKET_HEADLESS
+            delete m_cocosDelegate;
+#endif
+            
+            // events never dispatched
+            for(auto s : m_connectedSockets) {
+                s->release();
+            }
+            for(auto s : m_disconnectedSockets) {
+                s->release();
+            }
+            for(auto s : m_failedSockets) {
+                s->release();
+            }
+            for(auto p : m_packets) {
+                p->release();
+            }
+            for(auto s : m_writabilitySockets) {
+                s->release();
+            }
+            CC_SAFE_RELEASE(m_memoryVictim);
+            CC_SAFE_RELEASE(m_packetPipeline);
+            pthread_cond_destroy(&m_dispatcherCond);
+            pthread_mutex_destroy(&m_dispatcherMutex);
             pthread_mutex_destroy(&m_mutex);
         }
         
         TCPSocketHub* TCPSocketHub::create() {
-            TCPSocketHub* h = new TCPSocketHub();
+            return create(1);
+        }
+        
+        TCPSocketHub* TCPSocketHub::create(int ioThreadCount, bool pinThreads) {
+            TCPSocketHub* h = new TCPSocketHub(ioThreadCount, pinThreads);
             return (TCPSocketHub*)h->autorelease();
         }
         
         void TCPSocketHub::stopAll() {
+            // stop I/O threads first, after that sockets are only touched here
+            for(auto r : m_reactors) {
+                r->stop();
+            }
+            stopDispatcher();
+            stopDecodeWorkers();
+            
             // release socket
             for(auto s : m_sockets){
                 if(s->getConnected()) {
                     s->m_connected = false;
                     s->closeSocket();
                     
-                    auto nc = Director::getInstance()->getEventDispatcher();
-                    
-                    EventCustomObject *e = new EventCustomObject(kCCNotificationTCPSocketDisconnected, s);
-                    nc->dispatchEvent(e);
-                    e->release();
+                    if(m_delegate)
+                        m_delegate->onSocketDisconnected(this, s);
                 }
                 
                 s->setStop(true);
                 s->setHub(NULL);
             }
             m_sockets.clear();
-            
+            m_socketIndex.clear();
+            m_tagIndex.clear();
+            m_fdIndex.clear();
+            m_groups.clear();
+
+#ifndef TCPSOCKET_HEADLESS
             // stop update
             auto s = Director::getInstance()->getScheduler();
             s->unschedule(schedule_selector(TCPSocketHub::mainLoop), this);
+#endif
         }
         
-        TCPSocket* TCPSocketHub::createSocket(const std::string& hostname, int port, int tag, int blockSec, bool keepAlive) {
+        TCPSocket* TCPSocketHub::createSocket(const std::string& hostname, int port, int tag, int blockSec, bool keepAlive, PacketPipeline* pipeline) {
             TCPSocket* s = TCPSocket::create(hostname, port, tag, blockSec, keepAlive);
             if(s){
+                s->setPacketPipeline(pipeline);
                 addSocket(s);
             }
             return s;
@@ -84,92 +174,629 @@ namespace funny {
         
         void TCPSocketHub::onSocketConnectedThreadSafe(TCPSocket* s) {
             pthread_mutex_lock(&m_mutex);
-            m_connectedSockets.pushBack(s);
+            s->retain();
+            m_connectedSockets.push_back(s);
             pthread_mutex_unlock(&m_mutex);
         }
         
         void TCPSocketHub::onSocketDisconnectedThreadSafe(TCPSocket* s) {
             pthread_mutex_lock(&m_mutex);
-            m_disconnectedSockets.pushBack(s);
+            s->retain();
+            m_disconnectedSockets.push_back(s);
+            pthread_mutex_unlock(&m_mutex);
+        }
+        
+        void TCPSocketHub::onSocketFailedThreadSafe(TCPSocket* s) {
+            pthread_mutex_lock(&m_mutex);
+            s->retain();
+            m_failedSockets.push_back(s);
             pthread_mutex_unlock(&m_mutex);
         }
         
-        void TCPSocketHub::onPacketReceivedThreadSafe(Packet* packet) {
+        void TCPSocketHub::onPacketReceivedThreadSafe(TCPSocket* s, Packet* packet) {
+            if(handleDirect(s, packet)) {
+                return;
+            }
+            if(isSheddingLoad()) {
+                m_shedPackets++;
+                return;
+            }
+            if(decodePacket(s, packet)) {
+                return;
+            }
+            queuePacketThreadSafe(packet);
+        }
+        
+        void TCPSocketHub::onSocketWritabilityChangedThreadSafe(TCPSocket* s) {
+            pthread_mutex_lock(&m_mutex);
+            s->retain();
+            m_writabilitySockets.push_back(s);
+            pthread_mutex_unlock(&m_mutex);
+        }
+        
+        void TCPSocketHub::queuePacketThreadSafe(Packet* packet) {
+            m_inboundBytes += packet->getPacketLength();
             pthread_mutex_lock(&m_mutex);
-            m_packets.pushBack(packet);
+            packet->retain();
+            m_packets.push_back(packet);
             pthread_mutex_unlock(&m_mutex);
         }
         
         bool TCPSocketHub::addSocket(TCPSocket* socket) {
-            for(auto s : m_sockets) {
-                if(s->getSocket() == socket->getSocket()) {
-                    return false;
-                }
+            if(m_socketIndex.count(socket)) {
+                return false;
+            }
+            
+            // an indexed socket which already closed its fd does not own that number any more
+            auto f = m_fdIndex.find(socket->getSocket());
+            if(f != m_fdIndex.end() && f->second->getSocket() == socket->getSocket()) {
+                return false;
+            }
+            SocketReactor* r = pickReactor(socket);
+            if(!r) {
+                return false;
             }
+            
+            // index
+            SocketIndexEntry& entry = m_socketIndex[socket];
+            entry.position = m_sockets.size();
+            entry.fd = socket->getSocket();
+            m_tagIndex[socket->getTag()].push_back(socket);
+            m_fdIndex[entry.fd] = socket;
+            
             m_sockets.pushBack(socket);
             socket->setHub(this);
+            socket->m_zeroCopy = m_zeroCopy;
+            socket->m_sendQueueConfig = m_sendQueueConfig;
+            socket->m_recvBufferConfig = m_recvBufferConfig;
+            if(m_packetPipeline && !socket->m_pipeline)
+                socket->setPacketPipeline(m_packetPipeline);
+            
+            // packets queued before socket joined hub count against hub budget from now on
+            m_queuedBytes += socket->m_queuedBytes;
+            m_inputBufferBytes += socket->m_inputBytes;
+            r->add(socket);
             return true;
         }
         
-        TCPSocket* TCPSocketHub::getSocket(int tag) {
-            for(auto s : m_sockets){
-                if(s->getTag() == tag) {
-                    return s;
+        SocketReactor* TCPSocketHub::pickReactor(TCPSocket* socket) {
+            if(m_reactors.empty()) {
+                return NULL;
+            }
+            
+            if(m_assignPolicy == AssignPolicy::HASH) {
+                int key = socket->getTag() >= 0 ? socket->getTag() : socket->getSocket();
+                return m_reactors.at((unsigned int)key % m_reactors.size());
+            }
+            
+            // least load
+            SocketReactor* best = NULL;
+            for(auto r : m_reactors) {
+                if(!best || r->getLoad() < best->getLoad()) {
+                    best = r;
                 }
             }
-            return NULL;
+            return best;
         }
         
+        void TCPSocketHub::removeSocket(TCPSocket* socket) {
+            auto it = m_socketIndex.find(socket);
+            if(it == m_socketIndex.end()) {
+                return;
+            }
+            
+            // groups
+            for(int group : it->second.groups) {
+                auto g = m_groups.find(group);
+                if(g != m_groups.end()) {
+                    g->second.erase(socket);
+                    if(g->second.empty()) {
+                        m_groups.erase(g);
+                    }
+                }
+            }
+            
+            // tag and fd
+            auto t = m_tagIndex.find(socket->getTag());
+            if(t != m_tagIndex.end()) {
+                auto& bucket = t->second;
+                bucket.erase(std::find(bucket.begin(), bucket.end(), socket));
+                if(bucket.empty()) {
+                    m_tagIndex.erase(t);
+                }
+            }
+            auto f = m_fdIndex.find(it->second.fd);
+            if(f != m_fdIndex.end() && f->second == socket) {
+                m_fdIndex.erase(f);
+            }
+            
+            // move last socket into the hole, it may release the socket so it goes last
+            ssize_t position = it->second.position;
+            m_socketIndex.erase(it);
+            ssize_t last = m_sockets.size() - 1;
+            if(position != last) {
+                m_sockets.swap(position, last);
+                m_socketIndex[m_sockets.at(position)].position = position;
+            }
+            socket->setHub(NULL);
+            m_sockets.popBack();
+        }
+        
+        TCPSocket* TCPSocketHub::getSocket(int tag) {
+            auto it = m_tagIndex.find(tag);
+            return it == m_tagIndex.end() ? NULL : it->second.front();
+        }
+        
+        TCPSocket* TCPSocketHub::getSocketByFd(int fd) {
+            auto it = m_fdIndex.find(fd);
+            return it == m_fdIndex.end() ? NULL : it->second;
+        }
+        
+        bool TCPSocketHub::addToGroup(int group, TCPSocket* socket) {
+            auto it = m_socketIndex.find(socket);
+            if(it == m_socketIndex.end()) {
+                return false;
+            }
+            if(m_groups[group].insert(socket).second) {
+                it->second.groups.push_back(group);
+            }
+            return true;
+        }
+        
+        void TCPSocketHub::removeFromGroup(int group, TCPSocket* socket) {
+            auto g = m_groups.find(group);
+            if(g == m_groups.end() || !g->second.erase(socket)) {
+                return;
+            }
+            if(g->second.empty()) {
+                m_groups.erase(g);
+            }
+            
+            auto& groups = m_socketIndex[socket].groups;
+            groups.erase(std::find(groups.begin(), groups.end(), group));
+        }
+        
+        size_t TCPSocketHub::getGroupSize(int group) {
+            auto g = m_groups.find(group);
+            return g == m_groups.end() ? 0 : g->second.size();
+        }
+        
+        int TCPSocketHub::sendPacketToGroup(int group, Packet* packet) {
+            auto g = m_groups.find(group);
+            if(g == m_groups.end()) {
+                return 0;
+            }
+            int sent = 0;
+            for(auto s : g->second) {
+                if(s->sendPacket(packet)) {
+                    sent++;
+                }
+            }
+            return sent;
+        }
+
+#ifndef TCPSOCKET_HEADLESS
         void TCPSocketHub::mainLoop(float delta) {
+            update();
+        }
+#endif
+        
+        void TCPSocketHub::update() {
+            // take pending events, I/O threads are blocked only for the swaps
             pthread_mutex_lock(&m_mutex);
+            m_connectedSockets.swap(m_dispatchConnected);
+            m_packets.swap(m_dispatchPackets);
+            m_disconnectedSockets.swap(m_dispatchDisconnected);
+            m_failedSockets.swap(m_dispatchFailed);
+            m_writabilitySockets.swap(m_dispatchWritability);
+            pthread_mutex_unlock(&m_mutex);
             
-            // notification center
-            auto nc = Director::getInstance()->getEventDispatcher();
+            // a listener may release hub
+            retain();
             
             // connected events
-            for(auto s : m_connectedSockets){
-                EventCustomObject *e = new EventCustomObject(kCCNotificationTCPSocketConnected, s);
-                nc->dispatchEvent(e);
-                e->release();
+            for(auto s : m_dispatchConnected){
+                if(m_delegate)
+                    m_delegate->onSocketConnected(this, s);
+                s->release();
+            }
+            m_dispatchConnected.clear();
+            
+            // writability events, changes which reverted before this update are not reported
+            for(auto s : m_dispatchWritability) {
+                bool writable = s->isWritable();
+                if(writable != s->m_reportedWritable) {
+                    s->m_reportedWritable = writable;
+                    if(m_delegate)
+                        m_delegate->onSocketWritabilityChanged(this, s, writable);
+                }
+                s->release();
             }
-            m_connectedSockets.clear();
+            m_dispatchWritability.clear();
             
             // data event
-            for (auto s : m_packets) {
-                EventCustomObject *e = new EventCustomObject(kCCNotificationPacketReceived, s);
-                nc->dispatchEvent(e);
-                e->release();
+            size_t inbound = 0;
+            for(auto p : m_dispatchPackets) {
+                inbound += p->getPacketLength();
+            }
+            if(m_batchDispatch) {
+                dispatchPacketBatch();
+            } else {
+                for(auto p : m_dispatchPackets) {
+                    if(m_delegate)
+                        m_delegate->onPacketReceived(this, p);
+                    p->release();
+                }
+                m_dispatchPackets.clear();
             }
-            m_packets.clear();
+            m_inboundBytes -= inbound;
             
             // disconnected event
-            for(auto s : m_disconnectedSockets){
-                EventCustomObject *e = new EventCustomObject(kCCNotificationTCPSocketDisconnected, s);
-                nc->dispatchEvent(e);
-                e->release();
+            for(auto s : m_dispatchDisconnected){
+                if(m_delegate)
+                    m_delegate->onSocketDisconnected(this, s);
                 
-                m_sockets.eraseObject(s);
+                removeSocket(s);
+                s->release();
             }
-            m_disconnectedSockets.clear();
+            m_dispatchDisconnected.clear();
             
-            pthread_mutex_unlock(&m_mutex);
+            // sockets which never connected have no event, they only leave the hub
+            for(auto s : m_dispatchFailed) {
+                removeSocket(s);
+                s->release();
+            }
+            m_dispatchFailed.clear();
+            
+            checkMemoryLimit();
+            release();
+
+#ifdef TCPSOCKET_HEADLESS
+            drainAutoreleasePool();
+#endif
         }
         
-        void TCPSocketHub::sendPacket(int tag, Packet* packet) {
-            for (auto s : m_sockets) {
-                if(s->getTag() == tag) {
-                    s->sendPacket(packet);
-                    break;
+        void TCPSocketHub::checkMemoryLimit() {
+            // sockets paused in STOP_READING read again when usage is well below limit
+            if(m_pausedReaders > 0) {
+                bool paused = m_memoryPolicy == MemoryPolicy::STOP_READING && m_memoryLimit > 0;
+                if(!paused || getMemoryUsage() <= m_memoryLimit / 100 * kCCHubMemoryResumePercent) {
+                    for(auto s : m_sockets) {
+                        SocketReactor* reactor = s->m_reactor;
+                        if(s->m_readPaused && reactor) {
+                            reactor->wakeup(s);
+                        }
+                    }
                 }
             }
+            
+            // wait until previous victim is gone, its memory is freed when its reactor detaches it
+            if(m_memoryVictim) {
+                if(m_socketIndex.count(m_memoryVictim)) {
+                    return;
+                }
+                m_memoryVictim->release();
+                m_memoryVictim = NULL;
+            }
+            if(m_memoryPolicy != MemoryPolicy::DISCONNECT_LARGEST || !isOverMemoryLimit()) {
+                return;
+            }
+            
+            TCPSocket* largest = NULL;
+            for(auto s : m_sockets) {
+                if(!s->getStop() && (!largest || s->getMemoryUsage() > largest->getMemoryUsage())) {
+                    largest = s;
+                }
+            }
+            if(largest) {
+                CCLOGWARN("TCPSocketHub: memory usage %ld over limit %ld, disconnect socket %d using %ld",
+                          (long)getMemoryUsage(), (long)m_memoryLimit, largest->getSocket(), (long)largest->getMemoryUsage());
+                largest->retain();
+                m_memoryVictim = largest;
+                largest->setStop(true);
+            }
+        }
+        
+        TCPSocketHub::MemoryStats TCPSocketHub::getMemoryStats() {
+            MemoryStats stats;
+            stats.inputBuffers = m_inputBufferBytes;
+            stats.outbound = m_queuedBytes;
+            stats.inbound = m_inboundBytes;
+            return stats;
+        }
+        
+        void TCPSocketHub::dispatchPacketBatch() {
+            if(m_dispatchPackets.empty()) {
+                return;
+            }
+            
+            // batch takes over our references
+            PacketBatch* batch = new PacketBatch();
+            batch->m_packets.assign(m_dispatchPackets.begin(), m_dispatchPackets.end());
+            m_dispatchPackets.clear();
+            
+            if(m_delegate)
+                m_delegate->onPacketsReceived(this, batch);
+            batch->release();
+        }
+        
+        bool TCPSocketHub::sendPacket(int tag, Packet* packet, bool handOff) {
+            TCPSocket* s = getSocket(tag);
+            if(!s) {
+                if(handOff)
+                    CC_SAFE_RELEASE(packet);
+                return false;
+            }
+            return s->sendPacket(packet, handOff);
         }
         
         void TCPSocketHub::disconnect(int tag) {
-            for (auto s : m_sockets) {
-                if(s->getTag() == tag) {
-                    s->setStop(true);
+            TCPSocket* s = getSocket(tag);
+            if(s) {
+                s->setStop(true);
+            }
+        }
+        
+        void TCPSocketHub::setPacketHandler(int command, const PacketHandler& handler, HandlerThread thread) {
+            if(thread == HandlerThread::DISPATCHER) {
+                startDispatcher();
+            }
+            
+            // I/O threads keep reading old map until new one is stored
+            std::shared_ptr<const HandlerMap> old = std::atomic_load(&m_handlers);
+            std::shared_ptr<HandlerMap> handlers = old ? std::make_shared<HandlerMap>(*old) : std::make_shared<HandlerMap>();
+            HandlerEntry& entry = (*handlers)[command];
+            entry.handler = handler;
+            entry.thread = thread;
+            std::atomic_store(&m_handlers, std::shared_ptr<const HandlerMap>(handlers));
+            m_hasHandlers = true;
+        }
+        
+        void TCPSocketHub::removePacketHandler(int command) {
+            std::shared_ptr<const HandlerMap> old = std::atomic_load(&m_handlers);
+            if(!old || !old->count(command)) {
+                return;
+            }
+            std::shared_ptr<HandlerMap> handlers = std::make_shared<HandlerMap>(*old);
+            handlers->erase(command);
+            m_hasHandlers = !handlers->empty();
+            std::atomic_store(&m_handlers, std::shared_ptr<const HandlerMap>(handlers));
+        }
+        
+        bool TCPSocketHub::handleDirect(TCPSocket* s, Packet* packet) {
+            if(!m_hasHandlers) {
+                return false;
+            }
+            std::shared_ptr<const HandlerMap> handlers = std::atomic_load(&m_handlers);
+            auto it = handlers->find(packet->getHeader().command);
+            if(it == handlers->end()) {
+                return false;
+            }
+            
+            if(it->second.thread == HandlerThread::IO) {
+                it->second.handler(s, packet);
+                return true;
+            }
+            
+            // dispatcher thread
+            if(isSheddingLoad()) {
+                m_shedPackets++;
+                return true;
+            }
+            pthread_mutex_lock(&m_dispatcherMutex);
+            if(!m_dispatcherRunning) {
+                pthread_mutex_unlock(&m_dispatcherMutex);
+                return false;
+            }
+            m_inboundBytes += packet->getPacketLength();
+            DirectItem item;
+            item.socket = s;
+            item.packet = packet;
+            s->retain();
+            packet->retain();
+            m_directItems.push_back(item);
+            pthread_cond_signal(&m_dispatcherCond);
+            pthread_mutex_unlock(&m_dispatcherMutex);
+            return true;
+        }
+        
+        void TCPSocketHub::startDispatcher() {
+            pthread_mutex_lock(&m_dispatcherMutex);
+            if(!m_dispatcherRunning) {
+                if(pthread_create(&m_dispatcherThread, NULL, dispatcherThreadEntry, (void*)this) == 0) {
+                    m_dispatcherRunning = true;
+                } else {
+                    CCLOG("TCPSocketHub: failed to start dispatcher thread");
+                }
+            }
+            pthread_mutex_unlock(&m_dispatcherMutex);
+        }
+        
+        void TCPSocketHub::stopDispatcher() {
+            pthread_mutex_lock(&m_dispatcherMutex);
+            bool running = m_dispatcherRunning;
+            m_dispatcherRunning = false;
+            pthread_cond_signal(&m_dispatcherCond);
+            pthread_mutex_unlock(&m_dispatcherMutex);
+            if(running) {
+                pthread_join(m_dispatcherThread, NULL);
+            }
+            
+            // drop what was not handled
+            for(auto& item : m_directItems) {
+                m_inboundBytes -= item.packet->getPacketLength();
+                item.socket->release();
+                item.packet->release();
+            }
+            m_directItems.clear();
+        }
+        
+        void* TCPSocketHub::dispatcherThreadEntry(void* arg) {
+            ((TCPSocketHub*)arg)->dispatcherLoop();
+            return NULL;
+        }
+        
+        void TCPSocketHub::dispatcherLoop() {
+            std::vector<DirectItem> items;
+            while(true) {
+                // take everything queued so far
+                pthread_mutex_lock(&m_dispatcherMutex);
+                while(m_dispatcherRunning && m_directItems.empty()) {
+                    pthread_cond_wait(&m_dispatcherCond, &m_dispatcherMutex);
+                }
+                if(!m_dispatcherRunning) {
+                    pthread_mutex_unlock(&m_dispatcherMutex);
                     break;
                 }
+                items.swap(m_directItems);
+                pthread_mutex_unlock(&m_dispatcherMutex);
+                
+                // handler may be removed after packet was queued, then update loop gets it
+                std::shared_ptr<const HandlerMap> handlers = std::atomic_load(&m_handlers);
+                for(auto& item : items) {
+                    auto it = handlers->find(item.packet->getHeader().command);
+                    if(it != handlers->end()) {
+                        it->second.handler(item.socket, item.packet);
+                    } else {
+                        queuePacketThreadSafe(item.packet);
+                    }
+                    m_inboundBytes -= item.packet->getPacketLength();
+                    item.socket->release();
+                    item.packet->release();
+                }
+                items.clear();
+            }
+        }
+        
+        TCPSocketHub::DecodeWorker::DecodeWorker(TCPSocketHub* h) :
+        hub(h),
+        running(false) {
+            pthread_mutex_init(&mutex, NULL);
+            pthread_cond_init(&cond, NULL);
+        }
+        
+        TCPSocketHub::DecodeWorker::~DecodeWorker() {
+            pthread_cond_destroy(&cond);
+            pthread_mutex_destroy(&mutex);
+        }
+        
+        void TCPSocketHub::setPacketPipeline(PacketPipeline* pipeline) {
+            if(pipeline != m_packetPipeline) {
+                CC_SAFE_RETAIN(pipeline);
+                CC_SAFE_RELEASE(m_packetPipeline);
+                m_packetPipeline = pipeline;
+            }
+        }
+        
+        void TCPSocketHub::setPacketDecoder(const PacketDecoder& decoder, int workerCount) {
+            stopDecodeWorkers();
+            std::shared_ptr<const PacketDecoder> d;
+            if(decoder) {
+                d = std::make_shared<PacketDecoder>(decoder);
+            }
+            std::atomic_store(&m_decoder, d);
+            if(!decoder || workerCount <= 0) {
+                return;
+            }
+            
+            std::shared_ptr<DecodeWorkerList> workers = std::make_shared<DecodeWorkerList>();
+            for(int i = 0; i < workerCount; i++) {
+                std::shared_ptr<DecodeWorker> w = std::make_shared<DecodeWorker>(this);
+                w->running = true;
+                if(pthread_create(&w->thread, NULL, decodeThreadEntry, (void*)w.get()) != 0) {
+                    CCLOG("TCPSocketHub: failed to start decode thread %d", i);
+                    continue;
+                }
+                workers->push_back(w);
+            }
+            std::atomic_store(&m_decodeWorkers, std::shared_ptr<const DecodeWorkerList>(workers));
+        }
+        
+        void TCPSocketHub::stopDecodeWorkers() {
+            std::shared_ptr<const DecodeWorkerList> workers = std::atomic_load(&m_decodeWorkers);
+            std::atomic_store(&m_decodeWorkers, std::shared_ptr<const DecodeWorkerList>());
+            if(!workers) {
+                return;
+            }
+            
+            for(auto& w : *workers) {
+                pthread_mutex_lock(&w->mutex);
+                w->running = false;
+                pthread_cond_signal(&w->cond);
+                pthread_mutex_unlock(&w->mutex);
+                pthread_join(w->thread, NULL);
+                
+                // queue refuses packets now, hand over what is left
+                for(auto p : w->packets) {
+                    queuePacketThreadSafe(p);
+                    m_inboundBytes -= p->getPacketLength();
+                    p->release();
+                }
+                w->packets.clear();
+            }
+        }
+        
+        bool TCPSocketHub::decodePacket(TCPSocket* s, Packet* packet) {
+            std::shared_ptr<const PacketDecoder> decoder = std::atomic_load(&m_decoder);
+            if(!decoder) {
+                return false;
+            }
+            
+            // same socket always goes to same worker, so its packets keep their order
+            std::shared_ptr<const DecodeWorkerList> workers = std::atomic_load(&m_decodeWorkers);
+            if(workers && !workers->empty()) {
+                DecodeWorker* w = (*workers)[(size_t)MAX(0, s->getSocket()) % workers->size()].get();
+                pthread_mutex_lock(&w->mutex);
+                if(w->running) {
+                    m_inboundBytes += packet->getPacketLength();
+                    packet->retain();
+                    w->packets.push_back(packet);
+                    pthread_cond_signal(&w->cond);
+                    pthread_mutex_unlock(&w->mutex);
+                    return true;
+                }
+                pthread_mutex_unlock(&w->mutex);
+            }
+            
+            Ref* decoded = (*decoder)(packet);
+            packet->setDecoded(decoded);
+            CC_SAFE_RELEASE(decoded);
+            return false;
+        }
+        
+        void* TCPSocketHub::decodeThreadEntry(void* arg) {
+            DecodeWorker* w = (DecodeWorker*)arg;
+            w->hub->decodeLoop(w);
+            return NULL;
+        }
+        
+        void TCPSocketHub::decodeLoop(DecodeWorker* w) {
+            std::vector<Packet*> packets;
+            while(true) {
+                pthread_mutex_lock(&w->mutex);
+                while(w->running && w->packets.empty()) {
+                    pthread_cond_wait(&w->cond, &w->mutex);
+                }
+                if(!w->running) {
+                    pthread_mutex_unlock(&w->mutex);
+                    break;
+                }
+                packets.swap(w->packets);
+                pthread_mutex_unlock(&w->mutex);
+                
+                // decoder may be removed meanwhile, packets are delivered without result then
+                std::shared_ptr<const PacketDecoder> decoder = std::atomic_load(&m_decoder);
+                for(auto p : packets) {
+                    if(decoder) {
+                        Ref* decoded = (*decoder)(p);
+                        p->setDecoded(decoded);
+                        CC_SAFE_RELEASE(decoded);
+                    }
+                    queuePacketThreadSafe(p);
+                    m_inboundBytes -= p->getPacketLength();
+                    p->release();
+                }
+                packets.clear();
             }
         }
         
@@ -26,12 +26,28 @@
 #ifndef __TCPSocketHub_h__
 #define __TCPSocketHub_h__
 
-#include "cocos2d.h"
+#include "NetworkConfig.h"
 #include "TCPSocket.h"
 #include "ByteBuffer.h"
 #include "Packet.h"
+#include "SocketReactor.h"
 #include <pthread.h>
+#include "PacketBatch.h"
+#include "HubDelegate.h"
+
+#ifndef TCPSOCKET_HEADLESS
 #include "EventCustomObject.h"
+#endif
+
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <memory>
+#include <atomic>
+
+/// paused sockets read again when hub memory usage drops to this percent of the limit
+#define kCCHubMemoryResumePercent 90
 
 namespace funny {
     namespace network {
@@ -46,59 +62,326 @@ namespace funny {
         /// object is packet
 #define kCCNotificationPacketReceived "kCCNotificationPacketReceived"
         
+        /// object is PacketBatch, posted instead of kCCNotificationPacketReceived in batch dispatch
+#define kCCNotificationPacketsReceived "kCCNotificationPacketsReceived"
+        
+        /// object is socket whose queued bytes went above high watermark
+#define kCCNotificationTCPSocketUnwritable "kCCNotificationTCPSocketUnwritable"
+        
+        /// object is socket whose queued bytes dropped back to low watermark
+#define kCCNotificationTCPSocketWritable "kCCNotificationTCPSocketWritable"
+        
+        class CocosHubDelegate;
+        
         /**
-         * It manages a group of sockets and monitor them in every update. The update loop is started
-         * after hub is created.
+         * It manages a group of sockets and monitor them in every update. Socket I/O is done by a
+         * pool of reactor threads owned by hub, each socket is served by one of them, events are
+         * delivered to delegate in update.
+         *
+         * In a cocos build update is scheduled on cocos scheduler when hub is created and events are
+         * posted as kCCNotification* custom events. A headless build has no default delegate and
+         * the owner calls update from its own loop.
          */
-        class CC_DLL TCPSocketHub : public cocos2d::Ref {
+        class CC_DLL TCPSocketHub : public Ref {
             friend class TCPSocket;
+            friend class SocketReactor;
+            
+        public:
+            /// handler of packets with one command, see setPacketHandler
+            typedef std::function<void(TCPSocket* socket, Packet* packet)> PacketHandler;
+            
+            /// turns body of a received packet into an object with one reference for caller, or NULL
+            typedef std::function<Ref*(Packet* packet)> PacketDecoder;
+            
+            /// where a packet handler runs
+            enum class HandlerThread {
+                /// I/O thread of socket, lowest latency, handler must not block
+                IO,
+                
+                /// one dispatcher thread of hub, packets of all sockets are handled in arrival order
+                DISPATCHER
+            };
+            
+            /// what hub does when its memory usage goes above the limit
+            enum class MemoryPolicy {
+                /// I/O threads stop reading until update delivers enough packets, peers are slowed
+                /// down by TCP flow control
+                STOP_READING,
+                
+                /// drop received packets before they are queued and reject new outgoing packets
+                SHED_LOAD,
+                
+                /// reset connection of socket using most memory and drop its unsent data, one per update
+                DISCONNECT_LARGEST
+            };
+            
+            /// memory held by hub and its sockets, in bytes
+            struct MemoryStats {
+                /// read buffers of sockets
+                size_t inputBuffers;
+                
+                /// packets accepted by sendPacket and not yet sent
+                size_t outbound;
+                
+                /// received packets waiting for update or dispatcher thread
+                size_t inbound;
+                
+                /// sum of above
+                size_t total() const { return inputBuffers + outbound + inbound; }
+            };
+            
+            /// how a new socket picks its I/O thread
+            enum class AssignPolicy {
+                /// reactor serving fewest sockets
+                LEAST_LOAD,
+                
+                /// socket tag modulo thread count, socket fd if tag is negative
+                HASH
+            };
             
         private:
+            /// where a socket is referenced by hub indexes
+            struct SocketIndexEntry {
+                /// position in m_sockets
+                ssize_t position;
+                
+                /// fd when socket was added, socket may close its fd before it is removed
+                int fd;
+                
+                /// groups socket belongs to
+                std::vector<int> groups;
+            };
+            
             /// pthread mutex
             pthread_mutex_t m_mutex;
             
-            /// connected sockets
-            cocos2d::Vector<TCPSocket *> m_connectedSockets;
+            /// index entry of every socket in m_sockets
+            std::unordered_map<TCPSocket*, SocketIndexEntry> m_socketIndex;
+            
+            /// sockets by tag in add order, tags are not required to be unique
+            std::unordered_map<int, std::vector<TCPSocket*>> m_tagIndex;
+            
+            /// sockets by fd
+            std::unordered_map<int, TCPSocket*> m_fdIndex;
+            
+            /// group members by group id
+            std::unordered_map<int, std::unordered_set<TCPSocket*>> m_groups;
+            
+            /// I/O threads, each runs its own event loop
+            Vector<SocketReactor *> m_reactors;
+            
+            /// connected sockets, retained, filled by I/O threads under mutex
+            std::vector<TCPSocket *> m_connectedSockets;
+            
+            /// disconnected sockets, retained, filled by I/O threads under mutex
+            std::vector<TCPSocket *> m_disconnectedSockets;
+            
+            /// sockets stopped before they connected, retained, filled by I/O threads under mutex
+            std::vector<TCPSocket *> m_failedSockets;
+            
+            /// packet array, retained, filled by I/O threads under mutex
+            std::vector<Packet *> m_packets;
+            
+            /// sockets whose writability changed, retained, filled by any thread under mutex
+            std::vector<TCPSocket *> m_writabilitySockets;
+            
+            /// lists being dispatched, swapped with the ones above in update, cocos thread only
+            std::vector<TCPSocket *> m_dispatchConnected;
+            std::vector<TCPSocket *> m_dispatchDisconnected;
+            std::vector<TCPSocket *> m_dispatchFailed;
+            std::vector<Packet *> m_dispatchPackets;
+            std::vector<TCPSocket *> m_dispatchWritability;
+            
+            /// bytes queued for sending by all sockets of hub
+            std::atomic<size_t> m_queuedBytes;
+            
+            /// bytes of socket read buffers
+            std::atomic<size_t> m_inputBufferBytes;
+            
+            /// bytes of received packets not yet handed to delegate or dispatcher handler
+            std::atomic<size_t> m_inboundBytes;
+            
+            /// sockets which stopped reading in STOP_READING policy
+            std::atomic<int> m_pausedReaders;
             
-            /// disconnected sockets
-            cocos2d::Vector<TCPSocket *> m_disconnectedSockets;
+            /// received packets dropped in SHED_LOAD policy
+            std::atomic<uint64_t> m_shedPackets;
             
-            /// packet array
-            cocos2d::Vector<Packet *> m_packets;
+            /// socket disconnected by DISCONNECT_LARGEST policy and not yet removed, retained
+            TCPSocket* m_memoryVictim;
+            
+            /// default pipeline of sockets, retained
+            PacketPipeline* m_packetPipeline;
+
+#ifndef TCPSOCKET_HEADLESS
+            /// posts events to cocos event dispatcher, default delegate
+            CocosHubDelegate* m_cocosDelegate;
+#endif
+            
+            /// registered handler
+            struct HandlerEntry {
+                PacketHandler handler;
+                HandlerThread thread;
+            };
+            typedef std::unordered_map<int, HandlerEntry> HandlerMap;
+            
+            /// handlers by command, copied on write and read by I/O threads with std::atomic_load
+            std::shared_ptr<const HandlerMap> m_handlers;
+            
+            /// true if m_handlers is not empty, lets I/O threads skip the lookup
+            std::atomic<bool> m_hasHandlers;
+            
+            /// packet waiting for dispatcher thread, both retained
+            struct DirectItem {
+                TCPSocket* socket;
+                Packet* packet;
+            };
+            
+            /// dispatcher thread, guards and signal for its queue
+            pthread_t m_dispatcherThread;
+            pthread_mutex_t m_dispatcherMutex;
+            pthread_cond_t m_dispatcherCond;
+            
+            /// true while dispatcher thread runs
+            bool m_dispatcherRunning;
+            
+            /// packets for dispatcher thread
+            std::vector<DirectItem> m_directItems;
+            
+            /// decode thread and its queue
+            struct DecodeWorker {
+                TCPSocketHub* hub;
+                pthread_t thread;
+                pthread_mutex_t mutex;
+                pthread_cond_t cond;
+                
+                /// false once worker is asked to stop, queue refuses packets then
+                bool running;
+                
+                /// packets waiting for decoder, retained
+                std::vector<Packet*> packets;
+                
+                DecodeWorker(TCPSocketHub* h);
+                ~DecodeWorker();
+            };
+            typedef std::vector<std::shared_ptr<DecodeWorker>> DecodeWorkerList;
+            
+            /// body decoder, replaced by cocos thread and read by I/O threads with std::atomic_load
+            std::shared_ptr<const PacketDecoder> m_decoder;
+            
+            /// decode threads, empty means decoding on I/O threads
+            std::shared_ptr<const DecodeWorkerList> m_decodeWorkers;
             
         protected:
-            TCPSocketHub();
+            TCPSocketHub(int ioThreadCount, bool pinThreads);
             
-            /// listen on socket, read and write if necessary
+            /// choose reactor for a new socket according to assign policy
+            SocketReactor* pickReactor(TCPSocket* socket);
+
+#ifndef TCPSOCKET_HEADLESS
+            /// cocos scheduler callback, it calls update
             void mainLoop(float delta);
+#endif
+            
+            /// give all packets in m_dispatchPackets to delegate as one batch
+            void dispatchPacketBatch();
+            
+            /// true if memory limit is set and usage is above it
+            bool isOverMemoryLimit() { return m_memoryLimit > 0 && getMemoryUsage() > m_memoryLimit; }
+            
+            /// true if I/O threads should stop reading, STOP_READING policy
+            bool shouldPauseReading() { return m_memoryPolicy == MemoryPolicy::STOP_READING && isOverMemoryLimit(); }
+            
+            /// true if new packets should be dropped, SHED_LOAD policy
+            bool isSheddingLoad() { return m_memoryPolicy == MemoryPolicy::SHED_LOAD && isOverMemoryLimit(); }
+            
+            /// apply memory policy once per update, cocos thread
+            void checkMemoryLimit();
             
             /// add socket to hub
             bool addSocket(TCPSocket* socket);
             
+            /// drop socket from socket list, indexes and groups, last socket takes its position
+            void removeSocket(TCPSocket* socket);
+            
             /// called by tcp socket when it is connected
             void onSocketConnectedThreadSafe(TCPSocket* s);
             
             /// called by tcp socket when it is disconnected
             void onSocketDisconnectedThreadSafe(TCPSocket* s);
             
+            /// called when connect of a socket failed or it was stopped before connecting, hub
+            /// removes it without an event
+            void onSocketFailedThreadSafe(TCPSocket* s);
+            
             /// called when a socket want to deliver a packet
-            void onPacketReceivedThreadSafe(Packet* packet);
+            void onPacketReceivedThreadSafe(TCPSocket* s, Packet* packet);
+            
+            /// called by sender or I/O thread when socket crossed a send queue watermark
+            void onSocketWritabilityChangedThreadSafe(TCPSocket* s);
+            
+            /// queue packet for update loop
+            void queuePacketThreadSafe(Packet* packet);
+            
+            /**
+             * run or queue handler registered for command of packet
+             *
+             * @return false if no handler, packet goes to update loop
+             */
+            bool handleDirect(TCPSocket* s, Packet* packet);
+            
+            /// dispatcher thread
+            static void* dispatcherThreadEntry(void* arg);
+            void dispatcherLoop();
+            
+            /// start dispatcher thread if it is not running
+            void startDispatcher();
+            
+            /// stop dispatcher thread, queued packets are dropped
+            void stopDispatcher();
+            
+            /**
+             * decode packet body on this thread or queue packet for a decode worker
+             *
+             * @return true if a worker took packet, false if caller queues it for update loop
+             */
+            bool decodePacket(TCPSocket* s, Packet* packet);
+            
+            /// decode thread
+            static void* decodeThreadEntry(void* arg);
+            void decodeLoop(DecodeWorker* w);
+            
+            /// stop decode threads, packets they hold go to update loop undecoded
+            void stopDecodeWorkers();
             
         public:
             virtual ~TCPSocketHub();
+            
+            /// create hub with one I/O thread
             static TCPSocketHub* create();
             
+            /**
+             * create hub with a pool of I/O threads
+             *
+             * @param ioThreadCount number of I/O threads, 0 or less means one per online cpu
+             * @param pinThreads true means I/O thread i is bound to cpu (i % cpu count)
+             * @return hub instance
+             */
+            static TCPSocketHub* create(int ioThreadCount, bool pinThreads = false);
+            
             /**
              * create socket instance and auto add it to hub
              *
              * @param hostname host name or ip address, ipv4 only
              * @param port port
              * @param tag tag of socket
-             * @param blockSec block time when create this socket, 0 means not block
+             * @param blockSec connect timeout in seconds, 0 means no timeout
              * @param keepAlive true means keep socket alive
+             * @param pipeline pipeline of this socket alone, e.g. one with a CipherTransform keyed for
+             * the session; NULL gives it the hub pipeline
              * @return instance or NULL if failed
              */
-            TCPSocket* createSocket(const std::string& hostname, int port, int tag, int blockSec = kCCSocketDefaultTimeout, bool keepAlive = false);
+            TCPSocket* createSocket(const std::string& hostname, int port, int tag, int blockSec = kCCSocketDefaultTimeout, bool keepAlive = false, PacketPipeline* pipeline = NULL);
             
             /// disconnect one socket
             void disconnect(int tag);
@@ -106,19 +389,143 @@ namespace funny {
             // stop all
             void stopAll();
             
-            /// get socket by tag
+            /// get socket by tag, first added one if tag is shared
             TCPSocket* getSocket(int tag);
             
-            /// send a packet
-            void sendPacket(int tag, Packet* packet);
+            /// get socket by fd
+            TCPSocket* getSocketByFd(int fd);
+            
+            /**
+             * send a packet
+             *
+             * @param handOff true gives caller's reference to socket, see TCPSocket::sendPacket
+             * @return false if no socket has the tag or its send queue rejected the packet
+             */
+            bool sendPacket(int tag, Packet* packet, bool handOff = false);
+            
+            /**
+             * handle packets with a command directly instead of posting kCCNotificationPacketReceived.
+             * Handler is called off cocos thread as soon as the packet is decoded, it must not touch
+             * cocos objects. Packet and socket are valid during the call, retain them to keep them.
+             * Raw packets have command 0.
+             *
+             * @param command command id in packet header
+             * @param handler handler, it replaces one registered for same command
+             * @param thread where handler runs
+             */
+            void setPacketHandler(int command, const PacketHandler& handler, HandlerThread thread = HandlerThread::IO);
+            
+            /// remove handler, later packets with the command go to update loop again
+            void removePacketHandler(int command);
+            
+            /**
+             * decode bodies of received packets before they reach update, so cocos thread gets a
+             * ready object from Packet::getDecoded instead of parsing it. Packets taken by a packet
+             * handler are not decoded. Packets of one socket keep their order, except packets in
+             * flight while the decoder is replaced.
+             *
+             * @param decoder decoder, called off cocos thread, nullptr stops decoding
+             * @param workerCount 0 decodes on I/O threads, more starts that many decode threads and
+             * sockets are spread over them
+             */
+            void setPacketDecoder(const PacketDecoder& decoder, int workerCount = 0);
+            
+            /**
+             * put a socket of this hub into a group, a socket can be in many groups
+             *
+             * @param group group id
+             * @param socket socket added to hub
+             * @return false if socket is not in hub
+             */
+            bool addToGroup(int group, TCPSocket* socket);
             
-            /// socket array
-            CC_SYNTHESIZE_PASS_BY_REF(cocos2d::Vector<TCPSocket *>, m_sockets, Sockets);
+            /// take socket out of group, it is done automatically when socket is removed from hub
+            void removeFromGroup(int group, TCPSocket* socket);
+            
+            /// number of sockets in group
+            size_t getGroupSize(int group);
+            
+            /// send a packet to every socket in group, return number of sockets which accepted it
+            int sendPacketToGroup(int group, Packet* packet);
+            
+            /// socket array, order changes when a socket is removed
+            CC_SYNTHESIZE_READONLY_PASS_BY_REF(Vector<TCPSocket *>, m_sockets, Sockets);
             
             /// raw policy means packet don't have header, just contains a piece of bytes
             /// so it will be developer's responsibility to parse the packet
             /// default value = true
             CC_SYNTHESIZE(bool, m_rawPolicy, RawPolicy);
+            
+            /// max body length of a standard packet, a larger length field is a protocol error and
+            /// socket is closed before anything is allocated. A frame larger than max read buffer of
+            /// its socket is received into a packet buffer of its own size. Default value is 16M
+            CC_SYNTHESIZE(int, m_maxPacketLength, MaxPacketLength);
+            
+            /// how sockets are spread over I/O threads, default is least load
+            CC_SYNTHESIZE(AssignPolicy, m_assignPolicy, AssignPolicy);
+            
+            /**
+             * true means received packets are slices of socket read chunks instead of copies, see
+             * Packet::isSlice. It applies to sockets added after it is set, default is false
+             */
+            CC_SYNTHESIZE(bool, m_zeroCopy, ZeroCopy);
+            
+            /**
+             * true means packets received between two updates are posted as one
+             * kCCNotificationPacketsReceived event instead of one kCCNotificationPacketReceived
+             * per packet, default is false
+             */
+            CC_SYNTHESIZE(bool, m_batchDispatch, BatchDispatch);
+            
+            /// number of I/O threads
+            int getIOThreadCount() { return (int)m_reactors.size(); }
+            
+            /// read buffer policy given to sockets when they are added, see ReceiveBufferConfig
+            CC_SYNTHESIZE_PASS_BY_REF(ReceiveBufferConfig, m_recvBufferConfig, ReceiveBufferConfig);
+            
+            /// send queue limits given to sockets when they are added, see SendQueueConfig
+            CC_SYNTHESIZE_PASS_BY_REF(SendQueueConfig, m_sendQueueConfig, SendQueueConfig);
+            
+            /// pipeline given to sockets added without one of their own, see TCPSocket::setPacketPipeline.
+            /// All those sockets share its stages, so it can't hold a CipherTransform
+            PacketPipeline* getPacketPipeline() { return m_packetPipeline; }
+            void setPacketPipeline(PacketPipeline* pipeline);
+            
+            /// max bytes queued for sending by all sockets together, a full hub makes every socket
+            /// apply its overflow policy. 0 means no limit, which is default
+            CC_SYNTHESIZE(size_t, m_maxQueuedBytes, MaxQueuedBytes);
+            
+            /// bytes queued for sending by all sockets of hub
+            size_t getQueuedBytes() { return m_queuedBytes; }
+            
+            /**
+             * cap of memory used by socket read buffers, queued outgoing packets and received packets
+             * not yet delivered. 0 means no limit, which is default. It is checked by I/O threads and
+             * in update, so usage can go above it by what one update interval brings in. Leave room
+             * for read buffers of all sockets, they are counted too
+             */
+            CC_SYNTHESIZE(size_t, m_memoryLimit, MemoryLimit);
+            
+            /// what hub does above memory limit, default is stop reading
+            CC_SYNTHESIZE(MemoryPolicy, m_memoryPolicy, MemoryPolicy);
+            
+            /// snapshot of memory accounting
+            MemoryStats getMemoryStats();
+            
+            /// total bytes counted by memory accountant
+            size_t getMemoryUsage() { return m_inputBufferBytes + m_queuedBytes + m_inboundBytes; }
+            
+            /// number of received packets dropped by SHED_LOAD policy
+            uint64_t getShedPacketCount() { return m_shedPackets; }
+            
+            /// receiver of hub events, not retained, NULL drops events
+            CC_SYNTHESIZE(HubDelegate*, m_delegate, Delegate);
+            
+            /**
+             * deliver events queued by I/O threads to delegate, on caller's thread. A headless build
+             * also drains autorelease pool of calling thread at the end, as cocos does once per frame
+             */
+            void update();
         };
         
     }
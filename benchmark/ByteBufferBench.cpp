@@ -0,0 +1,174 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+/**
+ * Cost of building a ByteBuffer of growing size from 4 byte writes, with and without a capacity
+ * hint. With geometric growth ns/byte stays flat as the buffer grows, messages up to
+ * kCCByteBufferInlineSize bytes don't allocate at all.
+ *
+ * Second table serializes an array of floats one by one, with writeArray and with writeArrayBE,
+ * which byte swaps with the simd kernel of ByteOrder, and reads it back with readArrayBE.
+ *
+ * Third table writes 1M signed deltas of growing magnitude with write<int> and as zigzag varints,
+ * showing bytes per value and millions of values per second for writes and batch reads.
+ *
+ * usage: ByteBufferBench [maxBytes]
+ */
+
+#include "ByteBuffer.h"
+
+#include <time.h>
+
+using namespace funny::network;
+
+namespace {
+
+    double nowSec() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+    /// build buffers of given size until about 64M bytes are written, return ns per byte
+    double build(size_t bytes, bool hint, size_t& check) {
+        size_t rounds = MAX((size_t)1, ((size_t)64 << 20) / bytes);
+        size_t words = bytes / sizeof(uint32_t);
+        double start = nowSec();
+        for(size_t r = 0; r < rounds; r++) {
+            ByteBuffer bb(hint ? bytes : 0);
+            for(size_t i = 0; i < words; i++) {
+                bb.write<uint32_t>((uint32_t)i);
+            }
+            check += bb.available();
+        }
+        return (nowSec() - start) * 1e9 / (rounds * words * sizeof(uint32_t));
+    }
+    
+    enum Mode { EACH, BULK, BULK_BE, READ_BE };
+    
+    /// serialize count floats until about 256M bytes are moved, return GB/s
+    double bulk(const std::vector<float>& values, Mode mode, size_t& check) {
+        size_t bytes = values.size() * sizeof(float);
+        size_t rounds = MAX((size_t)1, ((size_t)256 << 20) / bytes);
+        std::vector<float> out(values.size());
+        ByteBuffer bb(bytes);
+        bb.writeArrayBE(values.data(), values.size());
+        double start = nowSec();
+        for(size_t r = 0; r < rounds; r++) {
+            if(mode == READ_BE) {
+                bb.setReadPos(0);
+                check += bb.readArrayBE(out.data(), out.size());
+                continue;
+            }
+            bb.clear();
+            if(mode == EACH) {
+                for(size_t i = 0; i < values.size(); i++) {
+                    bb.write<float>(values[i]);
+                }
+            } else if(mode == BULK) {
+                bb.writeArray(values.data(), values.size());
+            } else {
+                bb.writeArrayBE(values.data(), values.size());
+            }
+            check += bb.available();
+        }
+        return rounds * bytes / (nowSec() - start) / 1e9;
+    }
+    
+    /// encode and decode deltas in [-range, range), print one row
+    void varints(int range, size_t& check) {
+        const size_t count = 1 << 20;
+        const int rounds = 20;
+        std::vector<int32_t> values(count), out(count);
+        unsigned int seed = 1;
+        for(size_t i = 0; i < count; i++) {
+            seed = seed * 1103515245 + 12345;
+            values[i] = (int32_t)((seed >> 8) % (2 * range)) - range;
+        }
+        
+        ByteBuffer bb(count * 5);
+        double start = nowSec();
+        for(int r = 0; r < rounds; r++) {
+            bb.clear();
+            for(size_t i = 0; i < count; i++) {
+                bb.write<int>(values[i]);
+            }
+        }
+        double fixed = rounds * count / (nowSec() - start) / 1e6;
+        size_t fixedBytes = bb.available();
+        
+        start = nowSec();
+        for(int r = 0; r < rounds; r++) {
+            bb.clear();
+            bb.writeSignedVarintArray(values.data(), count);
+        }
+        double encode = rounds * count / (nowSec() - start) / 1e6;
+        size_t varintBytes = bb.available();
+        
+        start = nowSec();
+        for(int r = 0; r < rounds; r++) {
+            bb.setReadPos(0);
+            check += bb.readSignedVarintArray(out.data(), count);
+        }
+        double decode = rounds * count / (nowSec() - start) / 1e6;
+        if(out != values)
+            check = 0;
+        
+        printf("%12d %8.2f %8.2f %12.1f %12.1f %12.1f\n", range, (double)fixedBytes / count,
+               (double)varintBytes / count, fixed, encode, decode);
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t maxBytes = argc > 1 ? (size_t)atol(argv[1]) : ((size_t)16 << 20);
+
+    size_t check = 0;
+    printf("%12s %14s %14s\n", "bytes", "ns/byte", "ns/byte hint");
+    for(size_t bytes = 64; bytes <= maxBytes; bytes *= 4) {
+        double grow = build(bytes, false, check);
+        double hint = build(bytes, true, check);
+        printf("%12d %14.3f %14.3f\n", (int)bytes, grow, hint);
+    }
+    
+    printf("\nfloat arrays, GB/s, swap kernel %s\n", ByteOrder::getKernelName());
+    printf("%12s %10s %10s %10s %10s\n", "floats", "each", "array", "arrayBE", "readBE");
+    for(size_t count = 256; count <= ((size_t)4 << 20); count *= 16) {
+        std::vector<float> values(count);
+        for(size_t i = 0; i < count; i++) {
+            values[i] = i * 0.5f;
+        }
+        double each = bulk(values, EACH, check);
+        double array = bulk(values, BULK, check);
+        double arrayBE = bulk(values, BULK_BE, check);
+        double readBE = bulk(values, READ_BE, check);
+        printf("%12d %10.2f %10.2f %10.2f %10.2f\n", (int)count, each, array, arrayBE, readBE);
+    }
+    
+    printf("\nsigned deltas, bytes/value and Mvalues/s\n");
+    printf("%12s %8s %8s %12s %12s %12s\n", "range", "int", "varint", "write<int>", "encode", "decode");
+    for(int range = 16; range <= (1 << 24); range *= 32) {
+        varints(range, check);
+    }
+    return check ? 0 : 1;
+}
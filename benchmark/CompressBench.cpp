@@ -0,0 +1,178 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+/**
+ * Bandwidth and CPU cost of CompressTransform per codec: bytes on the wire and time to encode
+ * and decode one packet, packet allocation included, for a small and a large json body and a
+ * binary body. Dictionaries are made from json bodies of other players, as a game would ship
+ * a sample of its traffic.
+ *
+ * usage: CompressBench [iterations]
+ */
+
+#include "PacketTransform.h"
+#include "PacketBuilder.h"
+#include "JsonWriter.h"
+
+#include <stdio.h>
+#include <time.h>
+
+using namespace funny::network;
+
+namespace {
+
+    double nowSec() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+    
+    /// state of count players as a game server would send it
+    std::string stateJson(int seed, int count) {
+        ByteBuffer b;
+        JsonWriter w(b);
+        w.startObject();
+        w.key("tick");
+        w.value(seed * 7919);
+        w.key("players");
+        w.startArray();
+        for(int i = 0; i < count; i++) {
+            int id = seed * 1000 + i;
+            w.startObject();
+            w.key("id");
+            w.value(id);
+            w.key("name");
+            w.value("player_" + std::to_string(id));
+            w.key("x");
+            w.value((id % 977) * 0.25);
+            w.key("y");
+            w.value((id % 613) * 0.5);
+            w.key("hp");
+            w.value(100 - id % 100);
+            w.key("alive");
+            w.value(id % 7 != 0);
+            w.endObject();
+        }
+        w.endArray();
+        w.endObject();
+        return std::string((const char*)b.getBuffer(), b.getWritePos());
+    }
+    
+    /// positions as little endian floats, little repetition
+    std::string binaryBody(int count) {
+        ByteBuffer b;
+        unsigned seed = 12345;
+        for(int i = 0; i < count; i++) {
+            seed = seed * 1103515245 + 12345;
+            b.writeLE<float>((seed >> 8) / 65536.0f);
+        }
+        return std::string((const char*)b.getBuffer(), b.getWritePos());
+    }
+    
+    void run(const char* codecName, PacketCodec* codec, const char* bodyName, const std::string& body, int iterations) {
+        CompressTransform* t = new CompressTransform();
+        t->addCodec(codec);
+        
+        PacketBuilder b;
+        b.begin("GAME", 1, 1, 1, -1, body.length());
+        b.write((const uint8_t*)body.data(), body.length());
+        Packet* p = b.finish();
+        
+        // transforms don't consume their input, a different output is a new reference
+        Packet* c = t->encode(p);
+        size_t wire = c->getBodyLength();
+        
+        double start = nowSec();
+        for(int i = 0; i < iterations; i++) {
+            Packet* e = t->encode(p);
+            if(e != p)
+                e->release();
+        }
+        double enc = (nowSec() - start) * 1e9 / iterations;
+        
+        printf("%-12s %-8s %8d %8d %7.1f%% %10.0f ", codecName, bodyName,
+               (int)body.length(), (int)wire, wire * 100.0 / body.length(), enc);
+        if(c == p) {
+            // body didn't get smaller and was sent as it is, there is nothing to decode
+            printf("%10s %9.0f %9s\n", "-", body.length() / enc * 1e3, "-");
+        } else {
+            start = nowSec();
+            long check = 0;
+            for(int i = 0; i < iterations; i++) {
+                Packet* d = t->decode(c);
+                check += d ? d->getBodyLength() : -1;
+                if(d && d != c)
+                    d->release();
+            }
+            double dec = (nowSec() - start) * 1e9 / iterations;
+            if(check != (long)body.length() * iterations)
+                printf("decode failed\n");
+            printf("%10.0f %9.0f %9.0f\n", dec, body.length() / enc * 1e3, body.length() / dec * 1e3);
+            c->release();
+        }
+        p->release();
+        t->release();
+    }
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+    
+    std::string dictionary;
+    for(int seed = 90; seed < 96; seed++) {
+        dictionary += stateJson(seed, 8);
+    }
+    struct {
+        const char* name;
+        std::string body;
+    } bodies[] = {
+        { "json 1K", stateJson(1, 14) },
+        { "json 16K", stateJson(2, 220) },
+        { "binary", binaryBody(1024) },
+    };
+    
+    printf("%d iterations, dictionary %d bytes, threshold %d\n", iterations, (int)dictionary.length(), kCCCompressDefaultThreshold);
+    printf("%-12s %-8s %8s %8s %8s %10s %10s %9s %9s\n", "codec", "body", "bytes", "wire", "ratio",
+           "enc ns", "dec ns", "enc MB/s", "dec MB/s");
+    for(size_t i = 0; i < sizeof(bodies) / sizeof(bodies[0]); i++) {
+        const std::string& body = bodies[i].body;
+        const char* name = bodies[i].name;
+        int n = body.length() > 8192 ? iterations / 8 : iterations;
+        
+        PacketCodec* codecs[] = {
+            new LZCodec(),
+            new LZCodec(dictionary, 1),
+#ifdef TCPSOCKET_ZLIB
+            new ZlibCodec(std::string(), 0, 1),
+            new ZlibCodec(dictionary, 1, 1),
+            new ZlibCodec(),
+#endif
+        };
+        const char* codecNames[] = { "lz", "lz+dict", "zlib1", "zlib1+dict", "zlib6" };
+        for(size_t k = 0; k < sizeof(codecs) / sizeof(codecs[0]); k++) {
+            run(codecNames[k], codecs[k], name, body, n);
+            codecs[k]->release();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,216 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+/**
+ * Cocos thread time per frame with packet bodies parsed in update versus parsed by a hub packet
+ * decoder on I/O threads or decode threads.
+ *
+ * An in-process server sends a burst of packets every 16ms, each body is a json array of
+ * numbers. The decoder parses it into a vector of doubles, standing in for a json parser. Each
+ * frame calls update and the time spent in it is what a game would lose from its frame.
+ *
+ * usage: DecodeBench [packetsPerFrame] [numbersPerPacket] [frames]
+ */
+
+#include "TCPSocketHub.h"
+#include "PacketBuilder.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <time.h>
+#include <algorithm>
+
+using namespace funny::network;
+
+namespace {
+
+    const double kFrameSec = 1.0 / 60;
+
+    double nowSec() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+    /// parsed body
+    class NumberArray : public Ref {
+    public:
+        std::vector<double> values;
+    };
+
+    /// parse a json array of numbers
+    Ref* parseNumbers(Packet* packet) {
+        NumberArray* a = new NumberArray();
+        std::string body(packet->getBody(), packet->getBodyLength());
+        const char* p = body.c_str();
+        while(*p) {
+            if(*p == '[' || *p == ',' || *p == ']') {
+                p++;
+                continue;
+            }
+            char* end;
+            a->values.push_back(strtod(p, &end));
+            p = end > p ? end : p + 1;
+        }
+        return a;
+    }
+
+    struct ServerConfig {
+        int listenFd;
+        int packetsPerFrame;
+        Packet* packet;
+    };
+
+    /// send a burst of packets each frame to every connection
+    void* serveConnection(void* arg) {
+        ServerConfig* c = (ServerConfig*)arg;
+        int fd = accept(c->listenFd, NULL, NULL);
+        while(fd >= 0) {
+            for(int i = 0; i < c->packetsPerFrame; i++) {
+                if(send(fd, c->packet->getBuffer(), c->packet->getPacketLength(), MSG_NOSIGNAL) <= 0) {
+                    close(fd);
+                    return NULL;
+                }
+            }
+            usleep((useconds_t)(kFrameSec * 1e6));
+        }
+        return NULL;
+    }
+
+    int startServer(ServerConfig* config) {
+        int lfd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        addr.sin_port = 0;
+        bind(lfd, (sockaddr*)&addr, sizeof(addr));
+        listen(lfd, 16);
+        socklen_t len = sizeof(addr);
+        getsockname(lfd, (sockaddr*)&addr, &len);
+        config->listenFd = lfd;
+        return ntohs(addr.sin_port);
+    }
+
+    /// parses bodies itself unless hub already did
+    class FrameDelegate : public HubDelegate {
+    public:
+        long packets;
+        double checksum;
+
+        FrameDelegate() : packets(0), checksum(0) {}
+
+        virtual void onPacketReceived(TCPSocketHub* /*hub*/, Packet* p) {
+            NumberArray* a = dynamic_cast<NumberArray*>(p->getDecoded());
+            if(!a) {
+                a = (NumberArray*)parseNumbers(p);
+                p->setDecoded(a);
+                a->release();
+            }
+            checksum += a->values.back();
+            packets++;
+        }
+    };
+
+    void runOnce(const char* name, int workers, bool decode, ServerConfig* config, int port, int frames) {
+        TCPSocketHub* hub = TCPSocketHub::create(2);
+        hub->retain();
+        hub->setRawPolicy(false);
+        FrameDelegate delegate;
+        hub->setDelegate(&delegate);
+        if(decode) {
+            hub->setPacketDecoder(parseNumbers, workers);
+        }
+
+        pthread_t server;
+        pthread_create(&server, NULL, serveConnection, config);
+        hub->createSocket("127.0.0.1", port, 1);
+
+        // let traffic start
+        double warm = nowSec() + 0.2;
+        while(nowSec() < warm) {
+            hub->update();
+            usleep(1000);
+        }
+
+        std::vector<double> times;
+        delegate.packets = 0;
+        for(int f = 0; f < frames; f++) {
+            double start = nowSec();
+            hub->update();
+            double spent = nowSec() - start;
+            times.push_back(spent * 1000);
+            if(spent < kFrameSec)
+                usleep((useconds_t)((kFrameSec - spent) * 1e6));
+        }
+        std::sort(times.begin(), times.end());
+        double sum = 0;
+        for(double t : times) {
+            sum += t;
+        }
+        printf("%-22s %10.3f %10.3f %10.3f %10.1f\n", name, sum / frames, times[frames * 99 / 100],
+               times.back(), (double)delegate.packets / frames);
+
+        hub->stopAll();
+        hub->update();
+        hub->setDelegate(NULL);
+        hub->release();
+        pthread_join(server, NULL);
+    }
+}
+
+int main(int argc, char** argv) {
+    int packetsPerFrame = argc > 1 ? atoi(argv[1]) : 8;
+    int numbers = argc > 2 ? atoi(argv[2]) : 4096;
+    int frames = argc > 3 ? atoi(argv[3]) : 180;
+
+    // body: [0.5,1.5,...]
+    std::string body = "[";
+    for(int i = 0; i < numbers; i++) {
+        char n[32];
+        snprintf(n, sizeof(n), i ? ",%d.5" : "%d.5", i);
+        body += n;
+    }
+    body += "]";
+    PacketBuilder b;
+    b.begin("BNCH", 1, 1, 1);
+    b.write((const uint8_t*)body.data(), body.length());
+
+    ServerConfig config;
+    config.packetsPerFrame = packetsPerFrame;
+    config.packet = b.finish();
+    int port = startServer(&config);
+
+    printf("%d packets of %d bytes per frame, %d frames\n", packetsPerFrame, (int)body.length(), frames);
+    printf("%-22s %10s %10s %10s %10s\n", "parse", "avg ms", "p99 ms", "max ms", "pkts/frame");
+    runOnce("in update", 0, false, &config, port, frames);
+    runOnce("I/O threads", 0, true, &config, port, frames);
+    runOnce("2 decode threads", 2, true, &config, port, frames);
+
+    close(config.listenFd);
+    config.packet->release();
+    return 0;
+}
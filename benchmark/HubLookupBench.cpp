@@ -0,0 +1,132 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+/**
+ * Cost of finding a socket in a hub by tag and by fd as the number of sockets grows.
+ *
+ * Sockets connect to a loopback listener which never accepts, lookups don't need a live
+ * connection. The fd limit is raised to its hard limit, largest run is capped by it.
+ *
+ * usage: HubLookupBench [maxSockets] [lookups]
+ */
+
+#include "TCPSocketHub.h"
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <time.h>
+
+using namespace funny::network;
+
+namespace {
+
+    double nowSec() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+    /// loopback listener which never accepts, return its port
+    int startSilentListener() {
+        int lfd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        addr.sin_port = 0;
+        bind(lfd, (sockaddr*)&addr, sizeof(addr));
+        listen(lfd, 64);
+        socklen_t len = sizeof(addr);
+        getsockname(lfd, (sockaddr*)&addr, &len);
+        return ntohs(addr.sin_port);
+    }
+
+    /// raise fd limit, return how many sockets we can open
+    int raiseFdLimit() {
+        rlimit rl;
+        getrlimit(RLIMIT_NOFILE, &rl);
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+        return (int)MIN(rl.rlim_cur, (rlim_t)1 << 20) - 64;
+    }
+
+    void runOnce(int port, int sockets, int lookups) {
+        TCPSocketHub* hub = TCPSocketHub::create(1);
+        hub->retain();
+
+        std::vector<int> fds;
+        for(int i = 0; i < sockets; i++) {
+            TCPSocket* s = hub->createSocket("127.0.0.1", port, i, 0);
+            if(!s)
+                break;
+            fds.push_back(s->getSocket());
+        }
+        int n = (int)fds.size();
+
+        // same pseudo random keys for both lookups
+        unsigned int seed = 1;
+        long found = 0;
+        double start = nowSec();
+        for(int i = 0; i < lookups; i++) {
+            seed = seed * 1103515245 + 12345;
+            if(hub->getSocket((seed >> 8) % n))
+                found++;
+        }
+        double byTag = (nowSec() - start) * 1e9 / lookups;
+
+        seed = 1;
+        start = nowSec();
+        for(int i = 0; i < lookups; i++) {
+            seed = seed * 1103515245 + 12345;
+            if(hub->getSocketByFd(fds[(seed >> 8) % n]))
+                found++;
+        }
+        double byFd = (nowSec() - start) * 1e9 / lookups;
+
+        printf("%10d %14.1f %14.1f %10s\n", n, byTag, byFd, found == 2L * lookups ? "ok" : "MISSING");
+
+        hub->stopAll();
+        hub->update();
+        hub->release();
+    }
+}
+
+int main(int argc, char** argv) {
+    int maxSockets = argc > 1 ? atoi(argv[1]) : 8192;
+    int lookups = argc > 2 ? atoi(argv[2]) : 1000000;
+
+    int port = startSilentListener();
+    maxSockets = MIN(maxSockets, raiseFdLimit());
+
+    printf("%d lookups per run\n", lookups);
+    printf("%10s %14s %14s %10s\n", "sockets", "ns/tag", "ns/fd", "check");
+    for(int sockets = 16; sockets < maxSockets; sockets *= 4) {
+        runOnce(port, sockets, lookups);
+    }
+    runOnce(port, maxSockets, lookups);
+    return 0;
+}
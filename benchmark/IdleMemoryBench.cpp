@@ -0,0 +1,160 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+/**
+ * Read buffer memory of many mostly idle connections.
+ *
+ * A loopback server accepts every connection and sends it one small message, then keeps it
+ * open and quiet. Once all messages are delivered the hub's memory accounting shows what the
+ * sockets keep: a fixed 64K mirrored ring per socket as before, or the adaptive pooled buffer
+ * which goes back to the pool when it is empty. The fd limit is raised to its hard limit,
+ * socket count is capped by it.
+ *
+ * usage: IdleMemoryBench [sockets]
+ */
+
+#include "TCPSocketHub.h"
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <pthread.h>
+
+using namespace funny::network;
+
+namespace {
+
+    struct Server {
+        int lfd;
+        int count;
+        std::vector<int> fds;
+    };
+
+    /// accept count connections and greet each one
+    void* serverEntry(void* arg) {
+        Server* s = (Server*)arg;
+        const char hello[] = "hello";
+        for(int i = 0; i < s->count; i++) {
+            int fd = accept(s->lfd, NULL, NULL);
+            if(fd < 0)
+                break;
+            ssize_t ret = send(fd, hello, sizeof(hello), 0);
+            (void)ret;
+            s->fds.push_back(fd);
+        }
+        return NULL;
+    }
+
+    /// counts delivered messages
+    class CountingDelegate : public HubDelegate {
+    public:
+        int connected;
+        int received;
+
+        CountingDelegate() : connected(0), received(0) {}
+
+        virtual void onSocketConnected(TCPSocketHub* /*hub*/, TCPSocket* /*socket*/) {
+            connected++;
+        }
+
+        virtual void onPacketReceived(TCPSocketHub* /*hub*/, Packet* /*packet*/) {
+            received++;
+        }
+    };
+
+    /// raise fd limit, return how many sockets we can open with both ends in this process
+    int raiseFdLimit() {
+        rlimit rl;
+        getrlimit(RLIMIT_NOFILE, &rl);
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+        return (int)(MIN(rl.rlim_cur, (rlim_t)1 << 20) - 64) / 2;
+    }
+
+    void runOnce(const char* name, const ReceiveBufferConfig& config, int sockets) {
+        Server server;
+        server.count = sockets;
+        server.lfd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        bind(server.lfd, (sockaddr*)&addr, sizeof(addr));
+        listen(server.lfd, 1024);
+        socklen_t len = sizeof(addr);
+        getsockname(server.lfd, (sockaddr*)&addr, &len);
+        pthread_t thread;
+        pthread_create(&thread, NULL, serverEntry, &server);
+
+        CountingDelegate delegate;
+        TCPSocketHub* hub = TCPSocketHub::create(1);
+        hub->retain();
+        hub->setDelegate(&delegate);
+        hub->setReceiveBufferConfig(config);
+        for(int i = 0; i < sockets; i++) {
+            hub->createSocket("127.0.0.1", ntohs(addr.sin_port), i, 0);
+        }
+        for(int i = 0; i < 2000 && delegate.received < sockets; i++) {
+            usleep(5000);
+            hub->update();
+        }
+        pthread_join(thread, NULL);
+
+        TCPSocketHub::MemoryStats stats = hub->getMemoryStats();
+        printf("%-24s %8d %8d %14ld %14.1f\n", name, delegate.connected, delegate.received,
+               (long)stats.inputBuffers, (double)stats.inputBuffers / MAX(1, delegate.connected));
+
+        hub->stopAll();
+        hub->update();
+        hub->release();
+        for(int fd : server.fds) {
+            close(fd);
+        }
+        close(server.lfd);
+    }
+}
+
+int main(int argc, char** argv) {
+    int sockets = argc > 1 ? atoi(argv[1]) : 10000;
+    sockets = MIN(sockets, raiseFdLimit());
+
+    printf("%-24s %8s %8s %14s %14s\n", "read buffer", "sockets", "msgs", "bytes", "bytes/socket");
+
+    ReceiveBufferConfig fixed;
+    fixed.minSize = kCCSocketInputBufferDefaultSize;
+    fixed.maxSize = kCCSocketInputBufferDefaultSize;
+    fixed.releaseWhenIdle = false;
+    fixed.mirrored = true;
+    runOnce("fixed 64K mirrored", fixed, sockets);
+
+    ReceiveBufferConfig adaptive;
+    adaptive.releaseWhenIdle = false;
+    runOnce("adaptive, kept", adaptive, sockets);
+
+    runOnce("adaptive, idle release", ReceiveBufferConfig(), sockets);
+    return 0;
+}
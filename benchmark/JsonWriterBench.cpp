@@ -0,0 +1,226 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+/**
+ * Json packet bodies: JsonWriter into a PacketBuilder against the way initWithJson built them
+ * before, text in a std::string with printf numbers and escaping byte by byte, copied into the
+ * packet afterwards. Runs a small state document with many numbers and a document of long chat
+ * strings.
+ *
+ * usage: JsonWriterBench [iterations]
+ */
+
+#include "JsonWriter.h"
+#include "PacketBuilder.h"
+
+#include <stdio.h>
+#include <time.h>
+
+using namespace funny::network;
+
+namespace {
+
+    double nowSec() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+    
+    struct Entity {
+        int id;
+        std::string name;
+        double x;
+        double y;
+        int hp;
+    };
+    
+    struct Doc {
+        std::vector<Entity> entities;
+        std::vector<std::string> chat;
+    };
+    
+    /// string building writer like the one behind initWithJson before
+    struct StringJson {
+        std::string out;
+        
+        void num(int v) {
+            char buf[16];
+            out.append(buf, snprintf(buf, sizeof(buf), "%d", v));
+        }
+        
+        void num(double v) {
+            char buf[32];
+            out.append(buf, snprintf(buf, sizeof(buf), "%.17g", v));
+        }
+        
+        void str(const std::string& s) {
+            out += '"';
+            for(size_t i = 0; i < s.length(); i++) {
+                unsigned char c = s[i];
+                if(c == '"' || c == '\\') {
+                    out += '\\';
+                    out += c;
+                } else if(c < 0x20) {
+                    char buf[8];
+                    out.append(buf, snprintf(buf, sizeof(buf), "\\u%04x", c));
+                } else {
+                    out += c;
+                }
+            }
+            out += '"';
+        }
+    };
+    
+    Packet* baseline(const Doc& doc) {
+        StringJson j;
+        j.out += "{\"entities\":[";
+        for(size_t i = 0; i < doc.entities.size(); i++) {
+            const Entity& e = doc.entities[i];
+            if(i)
+                j.out += ',';
+            j.out += "{\"id\":";
+            j.num(e.id);
+            j.out += ",\"name\":";
+            j.str(e.name);
+            j.out += ",\"x\":";
+            j.num(e.x);
+            j.out += ",\"y\":";
+            j.num(e.y);
+            j.out += ",\"hp\":";
+            j.num(e.hp);
+            j.out += '}';
+        }
+        j.out += "],\"chat\":[";
+        for(size_t i = 0; i < doc.chat.size(); i++) {
+            if(i)
+                j.out += ',';
+            j.str(doc.chat[i]);
+        }
+        j.out += "]}";
+        
+        Packet::Header h;
+        memcpy(h.magic, "GAME", 4);
+        h.protocolVersion = 1;
+        h.serverVersion = 1;
+        h.command = 1;
+        h.encryptAlgorithm = -1;
+        h.length = (int)j.out.length();
+        Packet* p = new Packet();
+        p->initWithHeader(h, j.out.data());
+        return p;
+    }
+    
+    Packet* writer(PacketBuilder& b, const Doc& doc) {
+        b.begin("GAME", 1, 1, 1);
+        JsonWriter w(b);
+        w.startObject();
+        w.key("entities");
+        w.startArray();
+        for(size_t i = 0; i < doc.entities.size(); i++) {
+            const Entity& e = doc.entities[i];
+            w.startObject();
+            w.key("id");
+            w.value(e.id);
+            w.key("name");
+            w.value(e.name);
+            w.key("x");
+            w.value(e.x);
+            w.key("y");
+            w.value(e.y);
+            w.key("hp");
+            w.value(e.hp);
+            w.endObject();
+        }
+        w.endArray();
+        w.key("chat");
+        w.startArray();
+        for(size_t i = 0; i < doc.chat.size(); i++) {
+            w.value(doc.chat[i]);
+        }
+        w.endArray();
+        w.endObject();
+        return b.finish();
+    }
+    
+    void run(const char* name, const Doc& doc, int iterations) {
+        PacketBuilder b;
+        Packet* a = baseline(doc);
+        Packet* c = writer(b, doc);
+        size_t bytes = c->getBodyLength();
+        long check = 0;
+        
+        double start = nowSec();
+        for(int i = 0; i < iterations; i++) {
+            Packet* p = baseline(doc);
+            check += p->getBodyLength();
+            p->release();
+        }
+        double base = (nowSec() - start) * 1e9 / iterations;
+        
+        start = nowSec();
+        for(int i = 0; i < iterations; i++) {
+            Packet* p = writer(b, doc);
+            check += p->getBodyLength();
+            p->release();
+        }
+        double fast = (nowSec() - start) * 1e9 / iterations;
+        
+        printf("%-10s %8d %8d %12.0f %12.0f %10.2f %8.2fx\n", name, (int)a->getBodyLength(), (int)bytes,
+               base, fast, bytes / fast, base / fast);
+        a->release();
+        c->release();
+        if(!check)
+            printf("unexpected empty output\n");
+    }
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+    printf("%d iterations, sizes differ since baseline prints doubles with %%.17g\n", iterations);
+    printf("%-10s %8s %8s %12s %12s %10s %9s\n", "document", "base B", "json B", "base ns", "writer ns", "GB/s", "speedup");
+    
+    Doc state;
+    for(int i = 0; i < 32; i++) {
+        Entity e;
+        e.id = 100000 + i * 37;
+        e.name = "player_" + std::to_string(i);
+        e.x = i * 1.25 - 20;
+        e.y = 1000.0 / (i + 3);
+        e.hp = 100 - i;
+        state.entities.push_back(e);
+    }
+    run("state", state, iterations);
+    
+    Doc chat;
+    for(int i = 0; i < 16; i++) {
+        std::string line;
+        while(line.length() < 240) {
+            line += "the quick brown fox jumps over the lazy dog, ";
+        }
+        line += "said \"player_" + std::to_string(i) + "\"\n";
+        chat.chat.push_back(line);
+    }
+    run("chat", chat, iterations);
+    
+    return 0;
+}
@@ -0,0 +1,119 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+
+
+/**
+ * Cost of binary message bodies made with CC_BINARY_MESSAGE: encoding into a reused ByteBuffer,
+ * building a packet, reading every field through a View and decoding into the struct.
+ *
+ * usage: MessageBench [iterations]
+ */
+
+#include "BinaryMessage.h"
+
+#include <time.h>
+
+using namespace funny::network;
+
+#define PLAYER_STATE_FIELDS(F) \
+    F(int32_t, id) \
+    F(float, x) \
+    F(float, y) \
+    F(float, z) \
+    F(int32_t, hp) \
+    F(bool, alive) \
+    F(std::string, name) \
+    F(std::vector<int32_t>, items)
+CC_BINARY_MESSAGE(PlayerState, 1001, PLAYER_STATE_FIELDS);
+
+namespace {
+
+    double nowSec() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+    
+    void report(const char* name, double start, int iterations) {
+        printf("%-24s %10.1f\n", name, (nowSec() - start) * 1e9 / iterations);
+    }
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    PlayerState s;
+    s.id = 12345;
+    s.x = 1.5f;
+    s.y = -20.25f;
+    s.z = 300.0f;
+    s.hp = 87;
+    s.alive = true;
+    s.name = "player_12345";
+    for(int i = 0; i < 16; i++) {
+        s.items.push_back(i * 100);
+    }
+    printf("body %d bytes, %d iterations\n", (int)s.encodedSize(), iterations);
+    printf("%-24s %10s\n", "", "ns/msg");
+
+    long check = 0;
+    ByteBuffer bb;
+    double start = nowSec();
+    for(int i = 0; i < iterations; i++) {
+        bb.clear();
+        s.encode(bb);
+        check += bb.available();
+    }
+    report("encode", start, iterations);
+
+    start = nowSec();
+    for(int i = 0; i < iterations; i++) {
+        Packet* p = s.toPacket("GAME", 1, 1);
+        check += p->getBodyLength();
+        p->release();
+    }
+    report("toPacket", start, iterations);
+
+    Packet* p = s.toPacket("GAME", 1, 1);
+    start = nowSec();
+    for(int i = 0; i < iterations; i++) {
+        PlayerState::View v(p);
+        ArrayRef<int32_t> items = v.items();
+        check += v.id() + v.hp() + v.alive() + (long)v.x() + (long)v.y() + (long)v.z() + v.name().length;
+        for(size_t k = 0; k < items.size(); k++) {
+            check += items[k];
+        }
+    }
+    report("view, all fields", start, iterations);
+
+    PlayerState d;
+    start = nowSec();
+    for(int i = 0; i < iterations; i++) {
+        d.decode(p);
+        check += d.items.size();
+    }
+    report("decode", start, iterations);
+    p->release();
+
+    return check ? 0 : 1;
+}
@@ -0,0 +1,238 @@
+/****************************************************************************
+ Copyright (c) 2015 QuanNguyen
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ****************************************************************************/
+
+/**
+ * Echo throughput of one hub with 1..N I/O threads.
+ *
+ * An in-process echo server (one blocking thread per connection) reflects every packet. Each
+ * hub socket keeps a window of packets in flight, a received packet triggers the next send,
+ * so the number reported is round trips per second through the I/O threads. Hub is driven by
+ * calling update in a busy loop, it builds headless or against cocos2d.
+ *
+ * usage: ReactorScalingBench [maxThreads] [sockets] [window] [seconds] [bodySize]
+ */
+
+#include "TCPSocketHub.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <time.h>
+
+using namespace funny::network;
+
+namespace {
+
+    double nowSec() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+    void* echoConnection(void* arg) {
+        int fd = (int)(intptr_t)arg;
+        char buf[64 * 1024];
+        while(true) {
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if(n <= 0)
+                break;
+            ssize_t off = 0;
+            while(off < n) {
+                ssize_t w = send(fd, buf + off, n - off, MSG_NOSIGNAL);
+                if(w <= 0) {
+                    close(fd);
+                    return NULL;
+                }
+                off += w;
+            }
+        }
+        close(fd);
+        return NULL;
+    }
+
+    void* echoAccept(void* arg) {
+        int lfd = (int)(intptr_t)arg;
+        while(true) {
+            int fd = accept(lfd, NULL, NULL);
+            if(fd < 0)
+                break;
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            pthread_t t;
+            pthread_create(&t, NULL, echoConnection, (void*)(intptr_t)fd);
+            pthread_detach(t);
+        }
+        return NULL;
+    }
+
+    /// start echo server on loopback, return its port
+    int startEchoServer() {
+        int lfd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        addr.sin_port = 0;
+        bind(lfd, (sockaddr*)&addr, sizeof(addr));
+        listen(lfd, 1024);
+        socklen_t len = sizeof(addr);
+        getsockname(lfd, (sockaddr*)&addr, &len);
+
+        pthread_t t;
+        pthread_create(&t, NULL, echoAccept, (void*)(intptr_t)lfd);
+        pthread_detach(t);
+        return ntohs(addr.sin_port);
+    }
+
+    /// a standard packet with header and body of given size
+    Packet* makePacket(int bodySize) {
+        std::vector<char> frame(kPacketHeaderLength + bodySize, 'x');
+        Packet::Header h;
+        memcpy(h.magic, "BNCH", 4);
+        h.protocolVersion = 1;
+        h.serverVersion = 1;
+        h.command = 1;
+        h.encryptAlgorithm = -1;
+        h.length = bodySize;
+        memcpy(&frame[0], &h, kPacketHeaderLength);
+        Packet* p = new Packet();
+        p->initWithStandardBuf(&frame[0], frame.size());
+        return p;
+    }
+
+    /// counts events and keeps window of every socket full
+    class EchoDelegate : public HubDelegate {
+    public:
+        int connected;
+        long received;
+        long total;
+        bool counting;
+        int sockets;
+        Packet* packet;
+
+        EchoDelegate(int sockets, Packet* packet) :
+        connected(0),
+        received(0),
+        total(0),
+        counting(false),
+        sockets(sockets),
+        packet(packet) {
+        }
+
+        virtual void onSocketConnected(TCPSocketHub* /*hub*/, TCPSocket* /*socket*/) {
+            connected++;
+        }
+
+        virtual void onPacketReceived(TCPSocketHub* hub, Packet* /*p*/) {
+            if(counting)
+                received++;
+            hub->sendPacket((int)(total++ % sockets), packet);
+        }
+    };
+
+    double runOnce(int port, int threads, int sockets, int window, double seconds, Packet* packet) {
+        TCPSocketHub* hub = TCPSocketHub::create(threads, true);
+        hub->retain();
+        hub->setRawPolicy(false);
+
+        EchoDelegate delegate(sockets, packet);
+        hub->setDelegate(&delegate);
+        auto pump = [hub]() {
+            hub->update();
+        };
+
+        for(int i = 0; i < sockets; i++) {
+            hub->createSocket("127.0.0.1", port, i);
+        }
+        double deadline = nowSec() + 5;
+        while(delegate.connected < sockets && nowSec() < deadline) {
+            pump();
+            usleep(1000);
+        }
+
+        for(int i = 0; i < sockets; i++) {
+            for(int j = 0; j < window; j++) {
+                hub->sendPacket(i, packet);
+            }
+        }
+
+        // warm up, then measure
+        double warm = nowSec() + 0.2;
+        while(nowSec() < warm) {
+            pump();
+        }
+        delegate.counting = true;
+        double start = nowSec();
+        while(nowSec() - start < seconds) {
+            pump();
+        }
+        double rate = delegate.received / (nowSec() - start);
+        delegate.counting = false;
+
+        hub->stopAll();
+        hub->setDelegate(NULL);
+        hub->release();
+        return rate;
+    }
+}
+
+int main(int argc, char** argv) {
+    int cpuCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int maxThreads = argc > 1 ? atoi(argv[1]) : MAX(1, cpuCount / 2);
+    int sockets = argc > 2 ? atoi(argv[2]) : 64;
+    int window = argc > 3 ? atoi(argv[3]) : 8;
+    double seconds = argc > 4 ? atof(argv[4]) : 2;
+    int bodySize = argc > 5 ? atoi(argv[5]) : 64;
+
+    int port = startEchoServer();
+    Packet* packet = makePacket(bodySize);
+
+    printf("sockets %d, window %d, body %d bytes, %.1fs per run\n", sockets, window, bodySize, seconds);
+    printf("%10s %14s %10s %8s\n", "threads", "packets/s", "MB/s", "scale");
+    std::vector<int> counts;
+    for(int threads = 1; threads < maxThreads; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(maxThreads);
+
+    double base = 0;
+    for(int threads : counts) {
+        double rate = runOnce(port, threads, sockets, window, seconds, packet);
+        if(base == 0)
+            base = rate;
+        printf("%10d %14.0f %10.1f %8.2f\n", threads, rate,
+               rate * packet->getPacketLength() / (1024 * 1024), base > 0 ? rate / base : 0);
+    }
+
+    PoolStats objects = Packet::getObjectPoolStats();
+    PoolStats buffers = Packet::getBufferPoolStats();
+    printf("packet pool: %llu hits, %llu misses; buffer pool: %llu hits, %llu misses\n",
+           (unsigned long long)objects.hits, (unsigned long long)objects.misses,
+           (unsigned long long)buffers.hits, (unsigned long long)buffers.misses);
+
+    packet->release();
+    return 0;
+}